@@ -32,10 +32,33 @@ public:
 //        channelArgs.SetResourceQuota(quota);
 
         Init(targetHost, targetPort, nullptr, &channelArgs);
+//
+//        // Example: Spread the calls among more instances of the target service,
+//        // and forward all the calls of a session to the same instance
+//        AddTarget(targetHost, targetPort + 1, nullptr, &channelArgs);
+//        SetTargetPicker(std::make_shared<gen::RingHashPicker>("sessionid"));
+//
+//        // Example: Or forward every call to the less loaded of two instances picked
+//        // at random, eject the slow or failing instances, and ping them before
+//        // they are readmitted
+//        SetTargetPicker(std::make_shared<gen::PowerOfTwoPicker>());
+//        SetProbe(&test::Hello::Stub::PrepareAsyncPing, test::PingRequest());
+//
+//        // Example: Mirror 1% of the unary calls to a new build of the target service
+//        // to validate it under real load (see OnShadowCallEnd())
+//        SetShadowTarget(gen::FormatDnsAddressUri(targetHost, targetPort + 100), 0.01);
+//
+//        // Example: Only forward the session id and the tracing metadata of the clients
+//        SetMetadataAllowList({ "sessionid", "x-trace-*" });
 
-        // Set Async or Sync forwarding method (default is sync)
+        // Set Async or Sync forwarding method (default is sync) of server streams
+        // forwarded with the synchronous stub functions (e.g. &test::Hello::Stub::ServerStream)
         SetAsyncForward(true /*asyncForward*/);
 
+        // Ping is idempotent, so let identical concurrent pings share a single
+        // call to the target service
+        SetCoalescing(true);
+
         // Set Verbose to get OnInfo() messages
         SetVerbose(true);
     }
@@ -78,7 +101,10 @@ private:
 };
 
 //
-// Router for test::Hello service
+// Router for test::Hello service.
+// Note: Calls are forwarded with the PrepareAsync stub functions, so they are
+// driven by the target client completion queue threads and no thread waits
+// for the target service (see gen::GrpcAsyncForwarder).
 //
 class HelloService : public gen::GrpcService<test::Hello>
 {
@@ -102,23 +128,30 @@ private:
     void Ping(const gen::Context& ctx,
               const test::PingRequest& req, test::PingResponse& resp)
     {
-        mRouter.Forward(ctx, req, resp, &test::Hello::Stub::Ping);
+        mRouter.Forward(ctx, req, resp, &test::Hello::Stub::PrepareAsyncPing);
+//
+//        // Example: Ping is read-only, so send a second attempt when the target
+//        // hasn't responded after the p95 latency of the pings (see gen::HedgingPolicy)
+//        mRouter.Forward(ctx, req, resp, &test::Hello::Stub::PrepareAsyncPing, mPingHedging);
     }
 
     void ServerStreamTest(const gen::ServerStreamContext& ctx,
                           const test::ServerStreamRequest& req, test::ServerStreamResponse& resp)
     {
-        mRouter.Forward(ctx, req, resp, &test::Hello::Stub::ServerStream);
+        mRouter.Forward(ctx, req, resp, &test::Hello::Stub::PrepareAsyncServerStream);
     }
 
     void ClientStreamTest(const gen::ClientStreamContext& ctx,
                           const test::ClientStreamRequest& req, test::ClientStreamResponse& resp)
     {
-        mRouter.Forward(ctx, req, resp, &test::Hello::Stub::ClientStream);
+        mRouter.Forward(ctx, req, resp, &test::Hello::Stub::PrepareAsyncClientStream);
     }
 
     // Class to forward requests to test::Hello service
     HelloServiceRouter mRouter;
+
+//    // Hedging policy of the pings
+//    std::shared_ptr<gen::HedgingPolicy> mPingHedging{std::make_shared<gen::HedgingPolicy>()};
 };
 
 #endif // __HELLO_SERVICE_ROUTER_HPP__
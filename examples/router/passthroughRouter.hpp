@@ -0,0 +1,98 @@
+//
+// passthroughRouter.hpp
+//
+#ifndef __PASSTHROUGH_ROUTER_HPP__
+#define __PASSTHROUGH_ROUTER_HPP__
+
+#include "grpcServer.hpp"
+#include "grpcRouter.hpp"       // GrpcRouter
+#include "logger.hpp"           // OUTMSG, INFOMSG, ERRORMSG, etc.
+
+//
+// Router of the calls of any service, with the raw messages (passthrough).
+// Note: Derive from gen::GrpcRouter<gen::AnyService> in order to override
+// the generic OnCallBegin/End, OnError/Info, etc.
+//
+class PassthroughRouter : public gen::GrpcRouter<gen::AnyService>
+{
+public:
+    PassthroughRouter(const std::string& targetHost, unsigned short targetPort)
+    {
+        grpc::ChannelArguments channelArgs;
+        channelArgs.SetMaxSendMessageSize(INT_MAX);
+        channelArgs.SetMaxReceiveMessageSize(INT_MAX);
+
+        Init(targetHost, targetPort, nullptr, &channelArgs);
+
+        // Set Verbose to get OnInfo() messages
+        SetVerbose(true);
+    }
+    virtual ~PassthroughRouter() = default;
+
+private:
+    virtual ::grpc::Status OnCallBegin(const gen::GenericContext& /*ctx*/, const grpc::ByteBuffer& /*req*/,
+                                       const void** /*callParam*/) override
+    {
+        // This method can be used for authentication and other purposes.
+        // If a Status other than OK is returned, the call will be terminated.
+        //
+        // Note: The request isn't parsed unless you need it. For example:
+        // test::PingRequest ping;
+        // if(ctx.GetMethod() == "/test.Hello/Ping" && !gen::ParseMessage(req, ping))
+        //     return { ::grpc::INVALID_ARGUMENT, "Invalid request" };
+        //
+        return ::grpc::Status::OK;
+    }
+
+    // Error/Info messages produced by gen::GrpcRouter
+    virtual void OnError(const char* /*fname*/, int /*lineNum*/, const std::string& err,
+                         const void* /*callParam*/) const override
+    {
+        ERRORMSG(err);
+    }
+
+    virtual void OnInfo(const char* /*fname*/, int /*lineNum*/, const std::string& info,
+                        const void* /*callParam*/) const override
+    {
+        INFOMSG(info);
+    }
+};
+
+//
+// Generic service to forward the calls of all the methods that the router
+// doesn't serve itself (e.g. the methods of the services it doesn't know)
+//
+class PassthroughService : public gen::GrpcGenericService
+{
+public:
+    PassthroughService(const std::string& targetHost, unsigned short targetPort)
+        : mRouter(targetHost, targetPort) {}
+    virtual ~PassthroughService() = default;
+
+private:
+    // gen::GrpcGenericService overrides
+    virtual bool OnInit() override
+    {
+        Bind(&PassthroughService::Forward);
+        return true;
+    }
+
+    void Forward(const gen::GenericContext& ctx,
+                 const grpc::ByteBuffer& req, grpc::ByteBuffer& resp)
+    {
+        mRouter.Forward(ctx, req, resp);
+//
+//        // Example: Retry the read-only methods once the target call fails with
+//        // a transient error (see gen::RetryPolicy)
+//        bool isReadOnly = (ctx.GetMethod().find("/Get") != std::string::npos);
+//        mRouter.Forward(ctx, req, resp, isReadOnly ? mRetry : nullptr);
+    }
+
+    // Class to forward calls to the target server
+    PassthroughRouter mRouter;
+
+//    // Retry policy of the read-only methods
+//    std::shared_ptr<gen::RetryPolicy> mRetry{std::make_shared<gen::RetryPolicy>()};
+};
+
+#endif // __PASSTHROUGH_ROUTER_HPP__
@@ -4,6 +4,7 @@
 #include <stdio.h>
 #include "grpcServer.hpp"
 #include "helloServiceRouter.hpp"
+#include "passthroughRouter.hpp"
 #include "controlService.hpp"
 #include "serverConfig.hpp"     // for PORT_NUMBER
 #include "logger.hpp"           // OUTMSG, INFOMSG, ERRORMSG, etc.
@@ -16,6 +17,7 @@ public:
         // Add all services
         AddService<HelloService>(targetHost, targetPort);
         AddService<ControlService>();
+        AddService<PassthroughService>(targetHost, targetPort);  // Any other method
     }
     virtual ~MyRouter() = default;
 
@@ -25,6 +27,10 @@ private:
     {
         builder.AddChannelArgument(GRPC_ARG_ALLOW_REUSEPORT, 0);
 
+        // Forwarded calls don't hold the server threads while the target
+        // service responds, so let every thread serve many of them at once
+        SetRpcSlots(4, 2048);
+
         // Example: Set the maximum message size for both inbound and outbound messages
         builder.SetMaxReceiveMessageSize(INT_MAX);
         builder.SetMaxSendMessageSize(INT_MAX);
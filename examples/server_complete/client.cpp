@@ -5,6 +5,7 @@
 #include <string>
 #include <thread>
 #include "grpcClient.hpp"
+#include <grpcpp/generic/generic_stub.h>
 #include "serverConfig.hpp"     // PORT_NUMBER, etc.
 #include "logger.hpp"           // OUTMSG, INFOMSG, ERRORMSG, etc.
 #include "hello.grpc.pb.h"
@@ -38,6 +39,71 @@ bool PingTest(const std::string& addressUri)
     return true;
 }
 
+bool AsyncPingTest(const std::string& addressUri)
+{
+    test::PingRequest req;
+    std::vector<test::PingResponse> responses(10);
+
+    std::map<std::string, std::string> metadata;
+    metadata["sessionid"] = std::to_string(rand() % 1000);
+    unsigned long timeout = 1000; // milliseconds
+
+    gen::GrpcClient<test::Hello> grpcClient(addressUri, gCreds);
+
+    // Start all the calls at once, and then wait for them.
+    // Note: Use the CallAsync() version with a callback to be called back
+    // (on a client completion queue thread) once a call is done instead.
+    std::vector<std::future<grpc::Status>> results;
+    for(test::PingResponse& resp : responses)
+        results.push_back(grpcClient.CallAsync(&test::Hello::Stub::PrepareAsyncPing, req, resp, metadata, timeout));
+
+    bool isOk = true;
+    for(size_t i = 0; i < results.size(); i++)
+    {
+        grpc::Status s = results[i].get();
+        if(!s.ok())
+        {
+            std::string errMsg;
+            grpcClient.FormatStatusMsg(errMsg, "CallAsync", req, s);
+            ERRORMSG(errMsg);
+            isOk = false;
+        }
+        else
+        {
+            INFOMSG(responses[i]);
+        }
+    }
+
+    return isOk;
+}
+
+bool ManyPingTest(const std::string& addressUri)
+{
+    std::vector<test::PingRequest> requests(100);
+    std::vector<test::PingResponse> responses;
+    std::vector<grpc::Status> statuses;
+
+    std::map<std::string, std::string> metadata;
+    metadata["sessionid"] = std::to_string(rand() % 1000);
+    unsigned long timeout = 2000; // milliseconds (for the whole batch)
+    size_t maxInFlight = 16;
+
+    gen::GrpcClient<test::Hello> grpcClient(addressUri, gCreds);
+
+    // Make all the calls with up to maxInFlight of them in flight at once
+    std::string errMsg;
+    if(!grpcClient.CallMany(&test::Hello::Stub::PrepareAsyncPing, requests, responses, statuses,
+                            metadata, errMsg, timeout, maxInFlight))
+    {
+        size_t failed = std::count_if(statuses.begin(), statuses.end(), [](const grpc::Status& s) { return !s.ok(); });
+        ERRORMSG(failed << " of " << requests.size() << " calls failed, first error: " << errMsg);
+        return false;
+    }
+
+    INFOMSG(responses.size() << " responses, first one: " << responses.front());
+    return true;
+}
+
 bool CompressionTest(const std::string& addressUri)
 {
     test::CompressionTestRequest req;
@@ -77,7 +143,7 @@ bool CompressionTest(const std::string& addressUri)
     return true;
 }
 
-bool ServerStreamTest(const std::string& addressUri, bool silent = false)
+bool ServerStreamTest(const std::string& addressUri, bool silent = false, bool producer = false)
 {
     test::ServerStreamRequest req;
     req.set_msg("ServerStreamRequest");
@@ -92,7 +158,8 @@ bool ServerStreamTest(const std::string& addressUri, bool silent = false)
 
     std::string errMsg;
     gen::GrpcClient<test::Hello> grpcClient(addressUri, gCreds);
-    if(!grpcClient.CallStream(&test::Hello::Stub::ServerStream, req, respCallback, errMsg))
+    if(!grpcClient.CallStream(producer ? &test::Hello::Stub::ProducerStream : &test::Hello::Stub::ServerStream,
+                              req, respCallback, errMsg))
     {
         ERRORMSG(errMsg);
         return false;
@@ -103,8 +170,11 @@ bool ServerStreamTest(const std::string& addressUri, bool silent = false)
         // Dump all collected responses
         std::unique_lock<std::mutex> lock(logger::GetLogMutex());
         std::cout << "BEGIN" << std::endl;
-        for(const test::ServerStreamResponse& resp : respList)
-            std::cout << resp.msg() << std::endl;
+        if(!producer)
+        {
+            for(const test::ServerStreamResponse& resp : respList)
+                std::cout << resp.msg() << std::endl;
+        }
         std::cout << "END: " << respList.size() << " responses" << std::endl;
     }
 
@@ -137,6 +207,85 @@ bool ClientStreamTest(const std::string& addressUri)
     return true;
 }
 
+bool BidiStreamTest(const std::string& addressUri)
+{
+    int count = 0;
+    std::function reqCallback = [&count](test::BidiStreamRequest& req) -> bool
+    {
+        if(++count > 20)
+            return false;   // Return false to stop streaming
+        req.set_msg("BidiStreamRequest " + std::to_string(count));
+        return true;
+    };
+
+    int respCount = 0;
+    std::function respCallback = [&respCount](const test::BidiStreamResponse& resp) -> bool
+    {
+        INFOMSG(resp);
+        respCount++;
+        return true;
+    };
+
+    std::string errMsg;
+    gen::GrpcClient<test::Hello> grpcClient(addressUri, gCreds);
+    if(!grpcClient.CallBidiStream(&test::Hello::Stub::BidiStream, reqCallback, respCallback, errMsg))
+    {
+        ERRORMSG(errMsg);
+        return false;
+    }
+
+    INFOMSG("END: " << respCount << " responses");
+    return true;
+}
+
+bool GenericTest(const std::string& addressUri)
+{
+    // Call a method that no typed service implements with a raw message.
+    // The generic service of the server echoes it back as is.
+    std::shared_ptr<grpc::Channel> channel = grpc::CreateChannel(addressUri,
+        gCreds ? gCreds : grpc::InsecureChannelCredentials());
+    grpc::GenericStub stub(channel);
+
+    std::string msg = "Hello from the generic client";
+    grpc::Slice slice(msg);
+    grpc::ByteBuffer req(&slice, 1);
+    grpc::ByteBuffer resp;
+
+    grpc::ClientContext context;
+    context.set_deadline(std::chrono::system_clock::now() + std::chrono::milliseconds(1000));
+
+    grpc::CompletionQueue cq;
+    grpc::Status status;
+    std::unique_ptr<grpc::GenericClientAsyncResponseReader> call =
+        stub.PrepareUnaryCall(&context, "/test.Echo/Echo", req, &cq);
+    call->StartCall();
+    call->Finish(&resp, &status, nullptr);
+
+    void* tag = nullptr;
+    bool ok = false;
+    if(!cq.Next(&tag, &ok) || !ok || !status.ok())
+    {
+        ERRORMSG("Generic call failed: " << status.error_message());
+        return false;
+    }
+
+    std::vector<grpc::Slice> slices;
+    resp.Dump(&slices);
+
+    std::string echo;
+    for(const grpc::Slice& s : slices)
+        echo.append(reinterpret_cast<const char*>(s.begin()), s.size());
+
+    if(echo != msg)
+    {
+        ERRORMSG("Generic call returned '" << echo << "' instead of '" << msg << "'");
+        return false;
+    }
+
+    INFOMSG("Echo: " << echo);
+    return true;
+}
+
 bool ShutdownTest(const std::string& addressUri)
 {
     test::ShutdownRequest req;
@@ -215,9 +364,14 @@ void PrintUsage()
     std::cout << "Usage: client <host:port (optional)> <test name>" << std::endl;
     std::cout << "       client localhost:50055 ping" << std::endl;
     std::cout << "       client ping" << std::endl;
+    std::cout << "       client asyncping" << std::endl;
+    std::cout << "       client manyping" << std::endl;
     std::cout << "       client serverstream" << std::endl;
+    std::cout << "       client producerstream" << std::endl;
     std::cout << "       client clientstream" << std::endl;
+    std::cout << "       client bidistream" << std::endl;
     std::cout << "       client compression" << std::endl;
+    std::cout << "       client generic" << std::endl;
     std::cout << "       client shutdown" << std::endl;
     std::cout << "       client status" << std::endl;
     std::cout << "       client load" << std::endl;
@@ -264,18 +418,38 @@ int main(int argc, char** argv)
     {
         PingTest(addressUri);
     }
+    else if(!strcmp(testName, "asyncping"))
+    {
+        AsyncPingTest(addressUri);
+    }
+    else if(!strcmp(testName, "manyping"))
+    {
+        ManyPingTest(addressUri);
+    }
     else if(!strcmp(testName, "serverstream"))
     {
         ServerStreamTest(addressUri);
     }
+    else if(!strcmp(testName, "producerstream"))
+    {
+        ServerStreamTest(addressUri, false /*silent*/, true /*producer*/);
+    }
     else if(!strcmp(testName, "clientstream"))
     {
         ClientStreamTest(addressUri);
     }
+    else if(!strcmp(testName, "bidistream"))
+    {
+        BidiStreamTest(addressUri);
+    }
     else if(!strcmp(testName, "compression"))
     {
         CompressionTest(addressUri);
     }
+    else if(!strcmp(testName, "generic"))
+    {
+        GenericTest(addressUri);
+    }
     else if(!strcmp(testName, "shutdown"))
     {
         ShutdownTest(addressUri);
@@ -0,0 +1,22 @@
+//
+// genericService.cpp
+//
+#include "genericService.hpp"
+#include "logger.hpp"           // OUTMSG, INFOMSG, ERRORMSG, etc.
+
+void GenericService::Process(const gen::GenericContext& ctx,
+                             const grpc::ByteBuffer& req,
+                             grpc::ByteBuffer& resp)
+{
+    INFOMSG("From " << ctx.Peer() << ": " << ctx.GetMethod() << " (" << req.Length() << " bytes)");
+
+    // Echo the request back as is.
+    // Note: Copying a ByteBuffer doesn't copy the message data.
+    if(ctx.GetMethod() == "/test.Echo/Echo")
+    {
+        resp = req;
+        return;
+    }
+
+    ctx.SetStatus(grpc::StatusCode::UNIMPLEMENTED, "Method '" + ctx.GetMethod() + "' is not implemented");
+}
@@ -0,0 +1,35 @@
+//
+// genericService.hpp
+//
+#ifndef __GENERIC_SERVICE_HPP__
+#define __GENERIC_SERVICE_HPP__
+
+#include "grpcServer.hpp"
+
+//
+// Serves the calls of all the methods that no other service implements,
+// without parsing the request and response messages
+//
+class GenericService : public gen::GrpcGenericService
+{
+public:
+    GenericService() = default;
+    virtual ~GenericService() = default;
+
+private:
+    // gen::GrpcService overrides
+    virtual bool OnInit() override
+    {
+        // Note: The responses depend on the request alone, so cache them
+        // for 10 seconds, up to 1MB of them
+        gen::BindOptions options;
+        options.cache = std::make_shared<gen::ResponseCache>(1024 * 1024, std::chrono::seconds(10));
+        Bind(&GenericService::Process, nullptr, options);
+        return true;
+    }
+
+    void Process(const gen::GenericContext& ctx,
+                 const grpc::ByteBuffer& req, grpc::ByteBuffer& resp);
+};
+
+#endif // __GENERIC_SERVICE_HPP__
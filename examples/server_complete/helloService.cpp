@@ -3,6 +3,8 @@
 //
 #include "helloService.hpp"
 #include "logger.hpp"           // OUTMSG, INFOMSG, ERRORMSG, etc.
+#include <condition_variable>
+#include <thread>
 
 // ResponseList is used to demonstrate server-side streaming
 struct ResponseList
@@ -112,6 +114,73 @@ void HelloService::ServerStreamTest(const gen::ServerStreamContext& ctx,
 //    OUTMSG("opened_streams=" << opened_streams);
 }
 
+// Producer is used to demonstrate server-side streaming in producer mode:
+// responses are written by another thread as fast as the stream takes them
+struct Producer
+{
+    gen::StreamWriter writer;
+    std::thread thread;
+    std::mutex mtx;
+    std::condition_variable cv;
+    size_t sentRows = 0;
+
+    void Run(size_t rowCount)
+    {
+        test::ServerStreamResponse resp;
+        while(sentRows < rowCount)
+        {
+            resp.set_msg("Resp[" + std::to_string(sentRows + 1) + "]: 'Produced row'");
+            resp.set_result(true);
+
+            // Write() fails when the queue is full: wait for it to drain
+            std::unique_lock<std::mutex> lock(mtx);
+            if(writer.Write(resp))
+                sentRows++;
+            else if(writer.IsClosed())
+                return;
+            else
+                cv.wait_for(lock, std::chrono::milliseconds(100));
+        }
+        writer.Finish();
+    }
+};
+
+void HelloService::ProducerStreamTest(const gen::ServerStreamContext& ctx,
+                                      const test::ServerStreamRequest& req,
+                                      test::ServerStreamResponse& resp)
+{
+    Producer* producer = static_cast<Producer*>(ctx.GetParam());
+
+    // Are we done?
+    if(ctx.GetStreamStatus() != gen::StreamStatus::STREAMING)
+    {
+        OUTMSG((ctx.GetStreamStatus() == gen::StreamStatus::SUCCESS ? "SUCCESS" : "ERROR")
+               << ", stream=" << ctx.GetParam()
+               << ", sent " << (producer ? producer->sentRows : 0) << " rows");
+
+        // Clean up...
+        if(producer)
+        {
+            producer->thread.join();
+            delete producer;
+        }
+        ctx.SetParam(nullptr);
+        return;
+    }
+
+    // This is the only call while streaming: switch to producer mode
+    // and start the thread that writes all the responses
+    OUTMSG("Req = '" << req.msg() << "'");
+    producer = new Producer;
+    ctx.SetParam(producer);
+    producer->writer = ctx.GetWriter([producer]()
+    {
+        std::unique_lock<std::mutex> lock(producer->mtx);
+        producer->cv.notify_one();
+    });
+    producer->thread = std::thread(&Producer::Run, producer, 1000);
+}
+
 void HelloService::ClientStreamTest(const gen::ClientStreamContext& ctx,
                                     const test::ClientStreamRequest& req,
                                     test::ClientStreamResponse& resp)
@@ -137,4 +206,28 @@ void HelloService::ClientStreamTest(const gen::ClientStreamContext& ctx,
     }
 }
 
+void HelloService::BidiStreamTest(const gen::BidiStreamContext& ctx,
+                                  const test::BidiStreamRequest& req,
+                                  test::BidiStreamResponse& resp)
+{
+    // Are we done?
+    if(ctx.GetStreamStatus() != gen::StreamStatus::STREAMING)
+    {
+        OUTMSG((ctx.GetStreamStatus() == gen::StreamStatus::SUCCESS ? "SUCCESS" : "ERROR"));
+        return;
+    }
 
+    if(ctx.GetHasMore())
+    {
+        // Echo every request back to the client.
+        // Note: Write() can be called any number of times, from any thread
+        INFOMSG(req);
+        resp.set_msg("Echo: '" + req.msg() + "'");
+        ctx.Write(resp);
+    }
+    else
+    {
+        // The client is done writing, so are we
+        ctx.EndOfStream();
+    }
+}
@@ -18,10 +18,21 @@ private:
     virtual bool OnInit() override
     {
         // Bind all HelloService RPCs
-        Bind(&HelloService::PingTest, &test::Hello::AsyncService::RequestPing);
-        Bind(&HelloService::CompressionTest, &test::Hello::AsyncService::RequestCompressionTest);
-        Bind(&HelloService::ServerStreamTest, &test::Hello::AsyncService::RequestServerStream);
+        // Note: Ping is cheap, so process it right on the completion queue thread
+        Bind(&HelloService::PingTest, &test::Hello::AsyncService::RequestPing,
+             nullptr, { 16 /*slots*/, 1024 /*maxSlots*/, gen::ExecMode::INLINE });
+        // Note: CompressionTest builds large responses, so create them on a per-slot arena
+        Bind(&HelloService::CompressionTest, &test::Hello::AsyncService::RequestCompressionTest,
+             nullptr, { 0 /*slots*/, 0 /*maxSlots*/, gen::ExecMode::DEFAULT, 64 * 1024 /*arenaBlockSize*/ });
+
+        // Note: Write the last row of the stream together with the stream status
+        gen::BindOptions streamOptions;
+        streamOptions.writeAhead = true;
+        Bind(&HelloService::ServerStreamTest, &test::Hello::AsyncService::RequestServerStream, nullptr, streamOptions);
+        Bind(&HelloService::ProducerStreamTest, &test::Hello::AsyncService::RequestProducerStream);
+
         Bind(&HelloService::ClientStreamTest, &test::Hello::AsyncService::RequestClientStream);
+        Bind(&HelloService::BidiStreamTest, &test::Hello::AsyncService::RequestBidiStream);
         return true;
     }
 
@@ -35,8 +46,14 @@ private:
     void ServerStreamTest(const gen::ServerStreamContext& ctx,
                           const test::ServerStreamRequest& req, test::ServerStreamResponse& resp);
 
+    void ProducerStreamTest(const gen::ServerStreamContext& ctx,
+                            const test::ServerStreamRequest& req, test::ServerStreamResponse& resp);
+
     void ClientStreamTest(const gen::ClientStreamContext& ctx,
                           const test::ClientStreamRequest& req, test::ClientStreamResponse& resp);
+
+    void BidiStreamTest(const gen::BidiStreamContext& ctx,
+                        const test::BidiStreamRequest& req, test::BidiStreamResponse& resp);
 };
 
 #endif // __HELLO_SERVICE_HPP__
@@ -7,6 +7,7 @@
 #include "grpcServer.hpp"
 #include "helloService.hpp"
 #include "controlService.hpp"
+#include "genericService.hpp"
 #include "serverConfig.hpp"  // OUTMSG, INFOMSG, ERRORMSG
 #include "interceptor.hpp"
 
@@ -23,6 +24,7 @@ private:
         // Add all services
         AddService<HelloService>();
         AddService<ControlService>();
+        AddService<GenericService>();   // Catch-all for any other method
 
         // Note: Use OnInit for any additional server initialization.
         // For example, to don't allow reusing port:
@@ -47,6 +49,18 @@ private:
         // For example, to receive OnRun() every 0.5 seconds:
         SetRunInterval(500);
 
+        // Set how many request slots are kept armed for every RPC on every
+        // completion queue (thread), and how far each pool of slots may grow
+        // when all of them are busy. The default is a single slot per RPC per
+        // thread. Individual RPCs can override it with gen::BindOptions.
+        SetRpcSlots(4, 64);
+
+        // Run process functions on 4 worker threads instead of the completion
+        // queue threads, so a slow RPC doesn't hold up other RPCs served by the
+        // same completion queue. Individual RPCs can opt out with gen::BindOptions.
+        SetWorkerThreads(4);
+        SetExecMode(gen::ExecMode::WORKER);
+
         // Experimental: Set Interceptor
         std::vector<std::unique_ptr<grpc::experimental::ServerInterceptorFactoryInterface>> creators;
         creators.push_back(std::unique_ptr<grpc::experimental::ServerInterceptorFactoryInterface>(new MyInterceptorFactory()));
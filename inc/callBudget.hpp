@@ -0,0 +1,61 @@
+// *INDENT-OFF*
+//
+// callBudget.hpp
+//
+#ifndef __CALL_BUDGET_HPP__
+#define __CALL_BUDGET_HPP__
+
+#include <algorithm>
+#include <atomic>
+
+namespace gen {
+
+//
+// Budget of the extra calls (e.g. hedges and retries) made on top of the calls:
+// a token bucket that every call adds a share of a token to, so that on average
+// there are at most that share of extra calls per call (e.g. 0.1 is 10%), with
+// bursts of up to maxBurst extra calls.
+//
+class CallBudget
+{
+public:
+    CallBudget(double share, unsigned maxBurst)
+        : mShare((int64_t)(share * kTokenSize)), mMaxTokens((int64_t)maxBurst * kTokenSize) {}
+    ~CallBudget() = default;
+
+    // A call is starting: Add its share of a token
+    void OnCall()
+    {
+        int64_t tokens = mTokens;
+        while(tokens < mMaxTokens &&
+              !mTokens.compare_exchange_weak(tokens, std::min(tokens + mShare, mMaxTokens)))
+            ;
+    }
+
+    // Take a token for an extra call. Return false if the budget is spent.
+    bool TryTake()
+    {
+        int64_t tokens = mTokens;
+        do
+        {
+            if(tokens < kTokenSize)
+                return false;
+        } while(!mTokens.compare_exchange_weak(tokens, tokens - kTokenSize));
+        return true;
+    }
+
+private:
+    CallBudget(const CallBudget&) = delete;
+    CallBudget& operator=(const CallBudget&) = delete;
+
+    static constexpr int64_t kTokenSize = 1000;     // Tokens are counted in thousandths
+
+    int64_t mShare;
+    int64_t mMaxTokens;
+    std::atomic<int64_t> mTokens{0};
+};
+
+} //namespace gen
+
+#endif // __CALL_BUDGET_HPP__
+// *INDENT-ON*
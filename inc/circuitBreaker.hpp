@@ -0,0 +1,248 @@
+// *INDENT-OFF*
+//
+// circuitBreaker.hpp
+//
+#ifndef __CIRCUIT_BREAKER_HPP__
+#define __CIRCUIT_BREAKER_HPP__
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-parameter"
+#include <grpcpp/grpcpp.h>
+#pragma GCC diagnostic pop
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+
+namespace gen {
+
+struct CircuitBreakerOptions
+{
+    // Trip (open) the breaker after that many failed calls in a row
+    unsigned consecutiveFailures{5};
+
+    // Trip the breaker once that share of the calls of the window has failed,
+    // if the window has at least minCalls calls
+    double failureRate{0.5};
+    unsigned minCalls{20};
+    std::chrono::milliseconds window{10000};
+
+    // How long calls fail fast once the breaker trips, before probe calls are let through
+    std::chrono::milliseconds openTime{5000};
+
+    // Number of probe calls let through while half-open. The breaker closes once
+    // they all succeed, and trips again as soon as one of them fails.
+    unsigned probes{1};
+};
+
+//
+// Circuit breaker of the calls to a target service (see GrpcClient::SetCircuitBreaker()).
+//   CLOSED:    Calls go through, and their failures are counted.
+//   OPEN:      Calls fail fast (Allow() returns false) until openTime has passed.
+//   HALF_OPEN: A few probe calls go through to tell if the target is back.
+// Only the failures that tell that the target is unhealthy (see IsFailure())
+// count: application errors (e.g. INVALID_ARGUMENT) are successful calls as far as
+// the breaker is concerned, and cancelled calls don't count at all.
+// Every call let through gets a ticket: While half-open, only the outcome of the
+// probe calls of the current half-open period counts, not the outcome of the calls
+// let through before the breaker has tripped (or of the probes given up on).
+// Note: If the outcome of a probe call is never reported, then new probes are let
+// through once openTime has passed again, so the breaker can't stay half-open.
+//
+class CircuitBreaker
+{
+public:
+    enum class State : char { CLOSED, OPEN, HALF_OPEN };
+
+    CircuitBreaker() = default;
+    explicit CircuitBreaker(const CircuitBreakerOptions& options) : mOptions(options) {}
+    ~CircuitBreaker() = default;
+
+    // Ticket of a call let through: the period (epoch) of the breaker state it's let
+    // through in, and whether it's a probe call
+    using Ticket = uint64_t;
+
+    // Can a call go through? Every call let through must report its status with
+    // OnCallDone(), along with the ticket it gets.
+    bool Allow(Ticket& ticket);
+
+    // Report the status of a call.
+    // Return true if the breaker has tripped (gone from closed or half-open to open).
+    bool OnCallDone(grpc::StatusCode code, Ticket ticket);
+
+    State GetState();
+    const char* GetStateStr();
+
+    uint64_t GetTrips() const { return mTrips; }
+    uint64_t GetRejected() const { return mRejected; }
+
+    // Does the status tell that the target is unhealthy?
+    static bool IsFailure(grpc::StatusCode code)
+    {
+        return (code == grpc::UNAVAILABLE || code == grpc::DEADLINE_EXCEEDED ||
+                code == grpc::RESOURCE_EXHAUSTED || code == grpc::INTERNAL ||
+                code == grpc::UNKNOWN);
+    }
+
+private:
+    CircuitBreaker(const CircuitBreaker&) = delete;
+    CircuitBreaker& operator=(const CircuitBreaker&) = delete;
+
+    using Clock = std::chrono::steady_clock;
+
+    // Helpers (called with the mutex locked)
+    void Trip(Clock::time_point now);
+    void Close(Clock::time_point now);
+    void StartProbing(Clock::time_point now);
+
+    CircuitBreakerOptions mOptions;
+
+    std::mutex mMtx;
+    State mState{State::CLOSED};
+    uint64_t mEpoch{0};                 // Changes with every state change
+    Clock::time_point mOpenUntil;       // OPEN: End of fast-fail, HALF_OPEN: Probes given up on
+    Clock::time_point mWindowStart;
+    unsigned mCalls{0};                 // Calls of the window
+    unsigned mFailures{0};              // Failed calls of the window
+    unsigned mConsecutiveFailures{0};
+    unsigned mProbes{0};                // Probe calls let through
+    unsigned mProbeSuccesses{0};
+
+    std::atomic<uint64_t> mTrips{0};
+    std::atomic<uint64_t> mRejected{0};
+};
+
+//
+// CircuitBreaker class implementation
+//
+inline bool CircuitBreaker::Allow(Ticket& ticket)
+{
+    std::unique_lock<std::mutex> lock(mMtx);
+    if(mState == State::CLOSED)
+    {
+        ticket = mEpoch << 1;
+        return true;
+    }
+
+    Clock::time_point now = Clock::now();
+    if(mState == State::OPEN || mProbes >= mOptions.probes)
+    {
+        if(now < mOpenUntil)
+        {
+            mRejected++;
+            return false;
+        }
+        StartProbing(now);
+    }
+
+    mProbes++;
+    ticket = (mEpoch << 1) | 1;
+    return true;
+}
+
+inline bool CircuitBreaker::OnCallDone(grpc::StatusCode code, Ticket ticket)
+{
+    std::unique_lock<std::mutex> lock(mMtx);
+    Clock::time_point now = Clock::now();
+    bool failed = IsFailure(code);
+
+    switch(mState)
+    {
+    case State::CLOSED:
+        if(code == grpc::CANCELLED)
+            return false;
+
+        if(now - mWindowStart >= mOptions.window)
+        {
+            mWindowStart = now;
+            mCalls = mFailures = 0;
+        }
+
+        mCalls++;
+        if(!failed)
+        {
+            mConsecutiveFailures = 0;
+            return false;
+        }
+
+        mFailures++;
+        if(++mConsecutiveFailures >= mOptions.consecutiveFailures ||
+           (mCalls >= mOptions.minCalls && mFailures >= mOptions.failureRate * mCalls))
+        {
+            Trip(now);
+            return true;
+        }
+        return false;
+
+    case State::HALF_OPEN:
+        if(ticket != ((mEpoch << 1) | 1))
+            return false;   // Not a probe call of this half-open period
+
+        if(code == grpc::CANCELLED)
+        {
+            // Let another probe through
+            if(mProbes > 0)
+                mProbes--;
+            return false;
+        }
+
+        if(failed)
+        {
+            Trip(now);
+            return true;
+        }
+
+        if(++mProbeSuccesses >= mOptions.probes)
+            Close(now);
+        return false;
+
+    default:
+        return false;   // A call let through before the breaker has tripped
+    }
+}
+
+inline CircuitBreaker::State CircuitBreaker::GetState()
+{
+    std::unique_lock<std::mutex> lock(mMtx);
+    return mState;
+}
+
+inline const char* CircuitBreaker::GetStateStr()
+{
+    switch(GetState())
+    {
+    case State::CLOSED:     return "CLOSED";
+    case State::OPEN:       return "OPEN";
+    case State::HALF_OPEN:  return "HALF_OPEN";
+    default:                return "UNKNOWN";
+    }
+}
+
+inline void CircuitBreaker::Trip(Clock::time_point now)
+{
+    mState = State::OPEN;
+    mEpoch++;
+    mOpenUntil = now + mOptions.openTime;
+    mTrips++;
+}
+
+inline void CircuitBreaker::Close(Clock::time_point now)
+{
+    mState = State::CLOSED;
+    mEpoch++;
+    mWindowStart = now;
+    mCalls = mFailures = mConsecutiveFailures = 0;
+}
+
+inline void CircuitBreaker::StartProbing(Clock::time_point now)
+{
+    mState = State::HALF_OPEN;
+    mEpoch++;
+    mOpenUntil = now + mOptions.openTime;
+    mProbes = mProbeSuccesses = 0;
+}
+
+} //namespace gen
+
+#endif // __CIRCUIT_BREAKER_HPP__
+// *INDENT-ON*
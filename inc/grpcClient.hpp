@@ -8,11 +8,25 @@
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Wunused-parameter"
 #include <grpcpp/grpcpp.h>
+#include <grpcpp/alarm.h>
+#include <grpcpp/generic/generic_stub.h>
 #pragma GCC diagnostic pop
 
 #include "grpcUtils.hpp"
+#include "circuitBreaker.hpp"
+#include "hedgingPolicy.hpp"
+#include "metadataView.hpp"
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
 #include <functional>
+#include <future>
 #include <mutex>
+#include <optional>
+#include <thread>
+#include <type_traits>
+#include <vector>
+#include <signal.h>     // pthread_sigmask
 
 namespace gen {
 
@@ -30,6 +44,298 @@ struct StatusEx : public grpc::Status
     operator bool() { return grpc::Status::ok(); }
 };
 
+//
+// Operation of an asynchronous client call. Its address is the completion
+// queue tag, and OnEvent() is called on the queue thread once it completes.
+//
+struct AsyncClientOp
+{
+    virtual void OnEvent(bool ok) = 0;
+    virtual ~AsyncClientOp() = default;
+};
+
+//
+// Completion queue threads that drive asynchronous client calls,
+// one thread per queue. Calls are spread among the queues round-robin.
+//
+class ClientQueues
+{
+public:
+    ClientQueues() = default;
+    ~ClientQueues() { Stop(); }
+
+    bool Start(int threadCount);
+
+    // Shutdown the queues and wait for the threads to drain them.
+    // Note: A queue is only drained once all the operations started on it
+    // complete, so all the calls must be done (or cancelled) by then.
+    void Stop();
+
+    bool IsRunning() const { return mRunning; }
+
+    // Get the queue to start the next call on
+    grpc::CompletionQueue* GetQueue() { return mQueues[mNextQueue++ % mQueues.size()].get(); }
+
+    // Is the calling thread a completion queue thread (of any client)?
+    // Note: Such a thread must not wait for a call, since it may be the one to complete it.
+    static bool IsQueueThread() { return sIsQueueThread; }
+
+private:
+    ClientQueues(const ClientQueues&) = delete;
+    ClientQueues& operator=(const ClientQueues&) = delete;
+
+    void Run(grpc::CompletionQueue* cq);
+
+    static inline thread_local bool sIsQueueThread{false};
+
+    std::vector<std::unique_ptr<grpc::CompletionQueue>> mQueues;
+    std::vector<std::thread> mThreads;
+    std::atomic<size_t> mNextQueue{0};
+    std::atomic<bool> mRunning{false};
+};
+
+inline bool ClientQueues::Start(int threadCount)
+{
+    if(mRunning || threadCount <= 0)
+        return false;
+
+    for(int i = 0; i < threadCount; i++)
+        mQueues.emplace_back(new grpc::CompletionQueue);
+
+    for(std::unique_ptr<grpc::CompletionQueue>& cq : mQueues)
+        mThreads.emplace_back(&ClientQueues::Run, this, cq.get());
+
+    mRunning = true;
+    return true;
+}
+
+inline void ClientQueues::Stop()
+{
+    if(!mRunning)
+        return;
+
+    mRunning = false;
+    for(std::unique_ptr<grpc::CompletionQueue>& cq : mQueues)
+        cq->Shutdown();
+
+    for(std::thread& thread : mThreads)
+        thread.join();
+
+    mThreads.clear();
+    mQueues.clear();
+}
+
+inline void ClientQueues::Run(grpc::CompletionQueue* cq)
+{
+    // Don't handle SIGHUP or SIGINT in the spawned threads -
+    // let the main thread handle them.
+    sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, SIGHUP);
+    sigaddset(&set, SIGINT);
+    pthread_sigmask(SIG_BLOCK, &set, nullptr);
+    sIsQueueThread = true;
+
+    void* tag = nullptr;
+    bool ok = false;
+    while(cq->Next(&tag, &ok))
+    {
+        static_cast<AsyncClientOp*>(tag)->OnEvent(ok);
+    }
+}
+
+//
+// Service of any method, for GrpcClient<AnyService> (and GrpcRouter<AnyService>)
+// to call methods by name with raw messages through grpc::GenericStub
+//
+struct AnyService
+{
+    using Stub = grpc::GenericStub;
+
+    static std::unique_ptr<Stub> NewStub(const std::shared_ptr<grpc::ChannelInterface>& channel)
+    {
+        return std::make_unique<Stub>(channel);
+    }
+};
+
+//
+// Hedged unary call (see HedgingPolicy): If the first attempt hasn't responded after
+// the hedging delay, a second attempt is sent on the same queue, with the stub set by
+// the hedge factory (e.g. of another channel or target). The first successful
+// response wins, and the other attempt is cancelled. A failed attempt only ends the call
+// once no other attempt is in flight. The done callback is called on the queue thread
+// with the status of the call, once the response is in resp.
+// Note: The request must be valid until done is called.
+// The call deletes itself once its attempts and its timer have all completed.
+//
+template <typename GRPC_SERVICE, typename GRPC_STUB_FUNC, typename REQ, typename RESP>
+class GrpcHedgedCall
+{
+public:
+    using Stub = typename GRPC_SERVICE::Stub;
+    using HedgeFactory = std::function<std::unique_ptr<grpc::ClientContext>(std::shared_ptr<Stub>& stub)>;
+    using DoneCallback = std::function<void(const grpc::Status&)>;
+
+    GrpcHedgedCall(const std::shared_ptr<Stub>& stub, grpc::CompletionQueue* cq,
+                   GRPC_STUB_FUNC grpcStubFunc, const REQ& req, RESP& resp,
+                   const std::shared_ptr<HedgingPolicy>& policy,
+                   HedgeFactory&& newHedge, DoneCallback&& done)
+        : mStub(stub), mCq(cq), mStubFunc(grpcStubFunc), mReq(req), mResp(resp),
+          mPolicy(policy), mNewHedge(std::move(newHedge)), mDone(std::move(done)) {}
+
+    // Start the first attempt with its context, and the hedging timer
+    void Start(std::unique_ptr<grpc::ClientContext> context);
+
+private:
+    GrpcHedgedCall(const GrpcHedgedCall&) = delete;
+    GrpcHedgedCall& operator=(const GrpcHedgedCall&) = delete;
+    ~GrpcHedgedCall() = default;
+
+    struct Attempt final : public AsyncClientOp
+    {
+        void OnEvent(bool /*ok*/) override { call->OnAttemptDone(*this); }
+
+        GrpcHedgedCall* call{nullptr};
+        std::shared_ptr<Stub> stub;
+        std::unique_ptr<grpc::ClientContext> context;
+        std::unique_ptr<grpc::ClientAsyncResponseReader<RESP>> reader;
+        RESP resp;
+        grpc::Status status;
+        std::chrono::steady_clock::time_point startTime;
+        bool isDone{false};
+    };
+
+    struct Timer final : public AsyncClientOp
+    {
+        void OnEvent(bool ok) override { call->OnTimer(ok); }
+
+        GrpcHedgedCall* call{nullptr};
+        grpc::Alarm alarm;
+    };
+
+    // Helpers (called with the mutex locked)
+    void StartAttempt(std::unique_ptr<grpc::ClientContext> context, std::shared_ptr<Stub>&& stub);
+    bool Release() { return (--mPending == 0); }
+
+    void OnAttemptDone(Attempt& attempt);
+    void OnTimer(bool expired);
+
+    std::shared_ptr<Stub> mStub;    // Stub of the first attempt
+    grpc::CompletionQueue* mCq{nullptr};
+    GRPC_STUB_FUNC mStubFunc;
+    const REQ& mReq;
+    RESP& mResp;
+    std::shared_ptr<HedgingPolicy> mPolicy;
+    HedgeFactory mNewHedge;
+    DoneCallback mDone;
+
+    std::mutex mMtx;
+    Attempt mAttempts[2];
+    int mAttemptCount{0};
+    Timer mTimer;
+    bool mIsTimerSet{false};
+    bool mIsDone{false};
+    int mPending{0};        // Attempts and timer that haven't completed yet
+};
+
+//
+// GrpcHedgedCall class implementation
+//
+template <typename GRPC_SERVICE, typename GRPC_STUB_FUNC, typename REQ, typename RESP>
+void GrpcHedgedCall<GRPC_SERVICE, GRPC_STUB_FUNC, REQ, RESP>::Start(std::unique_ptr<grpc::ClientContext> context)
+{
+    std::chrono::microseconds delay = (mPolicy ? mPolicy->OnCall() : std::chrono::microseconds(0));
+
+    std::unique_lock<std::mutex> lock(mMtx);
+    StartAttempt(std::move(context), std::shared_ptr<Stub>(mStub));
+
+    // Note: There is no point in hedging once the deadline has passed
+    std::chrono::system_clock::time_point hedgeTime = std::chrono::system_clock::now() + delay;
+    if(mPolicy && hedgeTime < mAttempts[0].context->deadline())
+    {
+        mTimer.call = this;
+        mTimer.alarm.Set(mCq, hedgeTime, &mTimer);
+        mIsTimerSet = true;
+        mPending++;
+    }
+}
+
+template <typename GRPC_SERVICE, typename GRPC_STUB_FUNC, typename REQ, typename RESP>
+void GrpcHedgedCall<GRPC_SERVICE, GRPC_STUB_FUNC, REQ, RESP>::StartAttempt(std::unique_ptr<grpc::ClientContext> context,
+                                                                          std::shared_ptr<Stub>&& stub)
+{
+    Attempt& attempt = mAttempts[mAttemptCount++];
+    attempt.call = this;
+    attempt.stub = std::move(stub);
+    attempt.context = std::move(context);
+    attempt.startTime = std::chrono::steady_clock::now();
+    attempt.reader = (attempt.stub.get()->*mStubFunc)(attempt.context.get(), mReq, mCq);
+    attempt.reader->StartCall();
+    attempt.reader->Finish(&attempt.resp, &attempt.status, &attempt);
+    mPending++;
+}
+
+template <typename GRPC_SERVICE, typename GRPC_STUB_FUNC, typename REQ, typename RESP>
+void GrpcHedgedCall<GRPC_SERVICE, GRPC_STUB_FUNC, REQ, RESP>::OnAttemptDone(Attempt& attempt)
+{
+    bool isDone = false;
+
+    {
+        std::unique_lock<std::mutex> lock(mMtx);
+        attempt.isDone = true;
+        if(attempt.status.ok() && mPolicy)
+            mPolicy->OnLatency(std::chrono::duration_cast<std::chrono::microseconds>(
+                                   std::chrono::steady_clock::now() - attempt.startTime));
+
+        bool isLastAttempt = std::all_of(mAttempts, mAttempts + mAttemptCount,
+                                         [](const Attempt& a) { return a.isDone; });
+        if(!mIsDone && (attempt.status.ok() || isLastAttempt))
+        {
+            // The attempt wins: cancel the others and the hedging timer
+            mIsDone = isDone = true;
+            mResp.Swap(&attempt.resp);
+            for(int i = 0; i < mAttemptCount; i++)
+            {
+                if(!mAttempts[i].isDone)
+                    mAttempts[i].context->TryCancel();
+            }
+            if(mIsTimerSet)
+                mTimer.alarm.Cancel();
+        }
+    }
+
+    // Note: The call can't be deleted by another attempt until it's released
+    if(isDone)
+        mDone(attempt.status);
+
+    std::unique_lock<std::mutex> lock(mMtx);
+    if(Release())
+    {
+        lock.unlock();
+        delete this;
+    }
+}
+
+template <typename GRPC_SERVICE, typename GRPC_STUB_FUNC, typename REQ, typename RESP>
+void GrpcHedgedCall<GRPC_SERVICE, GRPC_STUB_FUNC, REQ, RESP>::OnTimer(bool expired)
+{
+    std::unique_lock<std::mutex> lock(mMtx);
+    mIsTimerSet = false;
+    if(expired && !mIsDone && mAttemptCount < 2 && mPolicy->TryHedge())
+    {
+        // Note: The hedge is made with the stub of the first attempt, unless the factory sets another
+        std::shared_ptr<Stub> stub = mStub;
+        std::unique_ptr<grpc::ClientContext> context = mNewHedge(stub);
+        StartAttempt(std::move(context), std::move(stub));
+    }
+
+    if(Release())
+    {
+        lock.unlock();
+        delete this;
+    }
+}
+
 //
 // Helper class to call UNARY/STREAM gRpc service
 //
@@ -73,7 +379,7 @@ public:
     template <typename GRPC_STUB_FUNC, typename REQ, typename RESP>
     StatusEx Call(GRPC_STUB_FUNC grpcStubFunc,
                   const REQ& req, RESP& resp,
-                  const std::map<std::string, std::string>& metadata,
+                  const MetadataView& metadata,
                   std::string& errMsg, unsigned long timeout = 0);
 
     // UNARY gRpc - no metadata
@@ -85,11 +391,96 @@ public:
         return Call(grpcStubFunc, req, resp, dummy_metadata, errMsg, timeout);
     }
 
+    // UNARY gRpc - hedged (see HedgingPolicy): If the call hasn't responded after the
+    // hedging delay, a second attempt is sent, and the first successful response wins.
+    // Note: Use the PrepareAsync stub function (e.g. &Stub::PrepareAsyncPing), the attempts
+    // are made on the completion queue threads. Only hedge idempotent (e.g. read-only) calls.
+    // The call waits for its attempts, so it can't be made from a completion queue thread
+    // (e.g. from the callback of an asynchronous call): it fails with FAILED_PRECONDITION there.
+    // The hedge is sent on the next channel of the pool (see SetChannelCount()).
+    template <typename GRPC_STUB_FUNC, typename REQ, typename RESP>
+    StatusEx Call(GRPC_STUB_FUNC grpcStubFunc,
+                  const REQ& req, RESP& resp,
+                  const MetadataView& metadata,
+                  std::string& errMsg, unsigned long timeout,
+                  const std::shared_ptr<HedgingPolicy>& hedging);
+
+    // UNARY gRpc - asynchronous: The call is made on the completion queue threads, so a
+    // thread can have many calls in flight. Once the call is done, callback is called on a
+    // queue thread with the status of the call (and resp is set).
+    // Note: Use the PrepareAsync stub function (e.g. &Stub::PrepareAsyncPing).
+    // The request is only used until CallAsync() returns, but resp must be valid until
+    // callback is called. If the call can't start (e.g. the circuit breaker is open),
+    // then callback is called right away.
+    template <typename GRPC_STUB_FUNC, typename REQ, typename RESP>
+    void CallAsync(GRPC_STUB_FUNC grpcStubFunc,
+                   const REQ& req, RESP& resp,
+                   const MetadataView& metadata,
+                   std::function<void(const grpc::Status&)> callback, unsigned long timeout = 0);
+
+    // UNARY gRpc - asynchronous, no metadata
+    template <typename GRPC_STUB_FUNC, typename REQ, typename RESP>
+    void CallAsync(GRPC_STUB_FUNC grpcStubFunc,
+                   const REQ& req, RESP& resp,
+                   std::function<void(const grpc::Status&)> callback, unsigned long timeout = 0)
+    {
+        CallAsync(grpcStubFunc, req, resp, dummy_metadata, std::move(callback), timeout);
+    }
+
+    // UNARY gRpc - asynchronous, with a future of the status of the call
+    template <typename GRPC_STUB_FUNC, typename REQ, typename RESP>
+    std::future<grpc::Status> CallAsync(GRPC_STUB_FUNC grpcStubFunc,
+                                        const REQ& req, RESP& resp,
+                                        const MetadataView& metadata,
+                                        unsigned long timeout = 0)
+    {
+        auto promise = std::make_shared<std::promise<grpc::Status>>();
+        std::future<grpc::Status> result = promise->get_future();
+        CallAsync(grpcStubFunc, req, resp, metadata,
+                  [promise](const grpc::Status& s) { promise->set_value(s); }, timeout);
+        return result;
+    }
+
+    // UNARY gRpc - asynchronous, with a future of the status of the call, no metadata
+    template <typename GRPC_STUB_FUNC, typename REQ, typename RESP>
+    std::future<grpc::Status> CallAsync(GRPC_STUB_FUNC grpcStubFunc,
+                                        const REQ& req, RESP& resp, unsigned long timeout = 0)
+    {
+        return CallAsync(grpcStubFunc, req, resp, dummy_metadata, timeout);
+    }
+
+    // UNARY gRpc - batch (fan-out): Call the service with every request, with up to
+    // maxInFlight calls in flight at once on the completion queue threads, so the batch
+    // takes about as long as its slowest calls rather than the sum of its calls.
+    // The response and the status of every call are set at the index of its request.
+    // Return OK if every call succeeds, else the status of the first call that fails.
+    // Note: Use the PrepareAsync stub function (e.g. &Stub::PrepareAsyncPing). All the
+    // calls share the deadline (timeout is the timeout of the whole batch), and the calls
+    // that haven't started by then fail with DEADLINE_EXCEEDED. The batch waits for its
+    // calls, so it can't be made from a completion queue thread (e.g. from the callback
+    // of an asynchronous call): it fails with FAILED_PRECONDITION there.
+    template <typename GRPC_STUB_FUNC, typename REQ, typename RESP>
+    StatusEx CallMany(GRPC_STUB_FUNC grpcStubFunc,
+                      const std::vector<REQ>& reqs, std::vector<RESP>& resps,
+                      std::vector<grpc::Status>& statuses,
+                      const MetadataView& metadata,
+                      std::string& errMsg, unsigned long timeout = 0, size_t maxInFlight = 64);
+
+    // UNARY gRpc - batch (fan-out), no metadata
+    template <typename GRPC_STUB_FUNC, typename REQ, typename RESP>
+    StatusEx CallMany(GRPC_STUB_FUNC grpcStubFunc,
+                      const std::vector<REQ>& reqs, std::vector<RESP>& resps,
+                      std::vector<grpc::Status>& statuses,
+                      std::string& errMsg, unsigned long timeout = 0, size_t maxInFlight = 64)
+    {
+        return CallMany(grpcStubFunc, reqs, resps, statuses, dummy_metadata, errMsg, timeout, maxInFlight);
+    }
+
     // Server-side STREAM gRpc
     template <typename GRPC_STUB_FUNC, typename REQ, typename RESP>
     StatusEx CallStream(GRPC_STUB_FUNC grpcStubFunc,
                         const REQ& req, const std::function<bool(const RESP&)>& respCallback,
-                        const std::map<std::string, std::string>& metadata,
+                        const MetadataView& metadata,
                         std::string& errMsg, unsigned long timeout = 0);
 
     // Server-side STREAM gRpc - no metadata
@@ -105,7 +496,7 @@ public:
     template <typename GRPC_STUB_FUNC, typename REQ, typename RESP>
     StatusEx CallClientStream(GRPC_STUB_FUNC grpcStubFunc,
                               const std::function<bool(REQ&)>& reqCallback, RESP& resp,
-                              const std::map<std::string, std::string>& metadata,
+                              const MetadataView& metadata,
                               std::string& errMsg, unsigned long timeout = 0);
 
     // Client-side STREAM gRpc - no metadata
@@ -117,27 +508,92 @@ public:
         return CallClientStream(grpcStubFunc, reqCallback, resp, dummy_metadata, errMsg, timeout);
     }
 
+    // Bidirectional STREAM gRpc
+    // Note: Requests are written from a separate thread while responses are
+    // read, so reqCallback and respCallback are called concurrently.
+    template <typename GRPC_STUB_FUNC, typename REQ, typename RESP>
+    StatusEx CallBidiStream(GRPC_STUB_FUNC grpcStubFunc,
+                            const std::function<bool(REQ&)>& reqCallback,
+                            const std::function<bool(const RESP&)>& respCallback,
+                            const MetadataView& metadata,
+                            std::string& errMsg, unsigned long timeout = 0);
+
+    // Bidirectional STREAM gRpc - no metadata
+    template <typename GRPC_STUB_FUNC, typename REQ, typename RESP>
+    StatusEx CallBidiStream(GRPC_STUB_FUNC grpcStubFunc,
+                            const std::function<bool(REQ&)>& reqCallback,
+                            const std::function<bool(const RESP&)>& respCallback,
+                            std::string& errMsg, unsigned long timeout = 0)
+    {
+        return CallBidiStream(grpcStubFunc, reqCallback, respCallback, dummy_metadata, errMsg, timeout);
+    }
+
     void CreateContext(grpc::ClientContext& context,
-                       const std::map<std::string, std::string>& metadata,
+                       const MetadataView& metadata,
                        unsigned long timeout) const;
 
     template <typename GRPC_STUB_FUNC, typename REQ, typename RESP>
     StatusEx GetStream(GRPC_STUB_FUNC grpcStubFunc, const REQ& req,
                        std::unique_ptr<grpc::ClientReader<RESP>>& reader,
-                       grpc::ClientContext& context,
+                       grpc::ClientContext& context, CircuitBreaker::Ticket& ticket,
                        std::string& errMsg);
 
-    const std::shared_ptr<grpc::ChannelCredentials> GetCredentials() const { return mCreds; }
-    const std::shared_ptr<grpc::ChannelArguments> GetChannelArgs() const { return mChannelArgs; }
-    const std::string GetAddressUri() const { return mAddressUri; }
+    // Get the service stub to start an asynchronous call with
+    // (of the next channel, see SetChannelCount())
+    std::shared_ptr<typename GRPC_SERVICE::Stub> GetStub()
+    {
+        // Note: The copy keeps the stub (and its channel) alive during the call
+        StubRef stub(*this);
+        return (stub ? stub.GetShared() : nullptr);
+    }
+
+    // Set the number of channels to the target that the calls are spread among
+    // (round-robin). Every channel has its own connection, so the calls aren't
+    // limited by the max concurrent streams (and the transport lock) of a single
+    // HTTP/2 connection. The default is a single channel.
+    // Note: The channels are re-created, so set it before the first call.
+    bool SetChannelCount(int channelCount)
+    {
+        mChannelCount = std::max(channelCount, 1);
+        return (GetAddressUri().empty() || Reset());
+    }
+    int GetChannelCount() const { return mChannelCount; }
+
+    // Get a completion queue to start an asynchronous call on. Every tag must be
+    // an AsyncClientOp, that is called back on the queue thread once the operation
+    // completes. The queue threads are started on first use, and stopped when the
+    // GrpcClient is destroyed.
+    grpc::CompletionQueue* GetCompletionQueue();
+
+    // Set the number of completion queue threads (before the first asynchronous call)
+    void SetAsyncThreads(int threadCount) { mAsyncThreadCount = std::max(threadCount, 1); }
+
+    // Set the circuit breaker of the calls to the target (before the first call).
+    // While it's open, calls fail fast with UNAVAILABLE instead of piling up on a
+    // target that is down. Null (the default) means no circuit breaker.
+    void SetCircuitBreaker(const std::shared_ptr<CircuitBreaker>& breaker) { mBreaker = breaker; }
+    const std::shared_ptr<CircuitBreaker>& GetCircuitBreaker() const { return mBreaker; }
+
+    // Check the circuit breaker before starting a call (asynchronous calls).
+    // Every call let through must report its status with OnCallDone(), along
+    // with the ticket it gets (see CircuitBreaker::Allow()).
+    grpc::Status AllowCall(CircuitBreaker::Ticket& ticket) const;
+
+    // Report the status of a call to the circuit breaker. Once the breaker trips,
+    // the channel is re-created if its connectivity state tells that the
+    // connection is broken (otherwise gRpc keeps reconnecting it).
+    void OnCallDone(const grpc::Status& s, CircuitBreaker::Ticket ticket);
+
+    const std::shared_ptr<grpc::ChannelCredentials> GetCredentials() const;
+    const std::shared_ptr<grpc::ChannelArguments> GetChannelArgs() const;
+    const std::string GetAddressUri() const;
     bool IsValid();
 
-    // Terminate a channel (if it exists) and reset GrpcClient to the initial state
-    // Note: This method is NOT thread-safe and should not be used when the GrpcClient
-    // is shared among multiple threads.
+    // Terminate the channels (if they exist) and reset GrpcClient to the initial state
+    // Note: The calls in progress complete on the channels they have started on.
     void Clear();
 
-    // Terminate the channel (if it exists) and initialize the GrpcClient using
+    // Terminate the channels (if they exist) and initialize the GrpcClient using
     // the same arguments as the last Init() call
     bool Reset();
 
@@ -157,79 +613,654 @@ private:
     GrpcClient(const GrpcClient&) = delete;
     GrpcClient& operator=(const GrpcClient&) = delete;
 
+    void RecycleChannel();
+
+    // Channels (and their stubs) the calls are spread among (see SetChannelCount()),
+    // with the arguments they are created with. A state is never modified once it's
+    // published: Init(), Reset(), Clear() and RecycleChannel() publish a new one
+    // (see SetState()), so the calls use the state without a lock (see StubRef).
+    struct ChannelState
+    {
+        std::string addressUri;
+        std::shared_ptr<grpc::ChannelCredentials> creds;
+        std::shared_ptr<grpc::ChannelArguments> channelArgs;
+        std::vector<std::shared_ptr<grpc::Channel>> channels;
+        std::vector<std::shared_ptr<typename GRPC_SERVICE::Stub>> stubs;
+        uint64_t generation{0};     // Unique among the states
+    };
+
+    // Channel state cached by a thread (see ThreadCache)
+    struct CachedState
+    {
+        std::atomic<const ChannelState*> state{nullptr};
+        uint64_t generation{0};
+        size_t nextChannel{0};          // Round-robin of the thread among the channels
+        std::atomic<unsigned> pins{0};  // Calls of the thread that use the state
+    };
+
+    // Cache of the channel states of the clients a thread calls, so a call gets its stub
+    // without a lock, and without touching a reference count shared with the other
+    // threads. The cache doesn't own the states: The client does, and it only frees a
+    // retired state once no thread has it pinned (see FreeRetired()). A slot is only
+    // used while its generation is the published one, and it isn't evicted while pinned.
+    struct ThreadCache
+    {
+        ThreadCache();
+        ~ThreadCache();
+
+        static constexpr size_t kSize = 8;
+        CachedState states[kSize];
+        size_t nextSlot{0};
+
+        CachedState* Find(uint64_t generation);
+        CachedState* Insert(const ChannelState& state);
+    };
+
+    // Thread caches (to find the pinned states)
+    static inline std::mutex sCachesMtx;
+    static inline std::vector<ThreadCache*> sCaches;
+
+    static ThreadCache& GetThreadCache()
+    {
+        thread_local ThreadCache cache;
+        return cache;
+    }
+
+    // Stub of the next channel for the duration of a call. The state of the stub is
+    // pinned in the thread cache, or held by the StubRef if every slot is pinned
+    // (e.g. calls made from the callbacks of other calls).
+    class StubRef
+    {
+    public:
+        explicit StubRef(GrpcClient& client);
+        ~StubRef();
+
+        typename GRPC_SERVICE::Stub* get() const { return mStub->get(); }
+        const std::shared_ptr<typename GRPC_SERVICE::Stub>& GetShared() const { return *mStub; }
+        explicit operator bool() const { return mStub != nullptr; }
+
+    private:
+        StubRef(const StubRef&) = delete;
+        StubRef& operator=(const StubRef&) = delete;
+
+        GrpcClient& mClient;
+        const std::shared_ptr<typename GRPC_SERVICE::Stub>* mStub{nullptr};
+        CachedState* mCached{nullptr};
+        std::shared_ptr<const ChannelState> mState;
+    };
+
+    // Helpers (called with mStubMtx locked)
+    bool CreateChannels(ChannelState& state) const;
+    std::shared_ptr<grpc::Channel> CreateChannel(const ChannelState& state, int index) const;
+    void SetState(std::shared_ptr<ChannelState>&& state);
+    void FreeRetired();
+
+    std::shared_ptr<const ChannelState> GetState() const
+    {
+        std::unique_lock<std::mutex> lock(mStubMtx);
+        return mState;
+    }
+
 private:
-    std::shared_ptr<typename GRPC_SERVICE::Stub> mStub;  // Note: std::shared_ptr to support multithreading
-    std::shared_ptr<grpc::ChannelCredentials> mCreds;
-    std::shared_ptr<grpc::ChannelArguments> mChannelArgs;
-    std::string mAddressUri;
-    std::mutex mStubMtx;
+    // Published channel state (see ChannelState), its generation (0 if none),
+    // and the retired states still pinned by a thread
+    std::shared_ptr<const ChannelState> mState;
+    std::atomic<uint64_t> mGeneration{0};
+    std::vector<std::shared_ptr<const ChannelState>> mRetired;
+    static inline std::atomic<uint64_t> sLastGeneration{0};
+    mutable std::mutex mStubMtx;
+
+    int mChannelCount{1};
+    std::atomic<size_t> mNextChannel{0};
+    std::shared_ptr<CircuitBreaker> mBreaker;
+
+    // Completion queue threads of asynchronous calls
+    // Note: Declared last to be stopped first, while the stub is still valid
+    int mAsyncThreadCount{2};
+    std::mutex mQueuesMtx;
+    ClientQueues mQueues;
 
     // Dummy metadata used by no-metadata calls
-    static inline const std::map<std::string, std::string> dummy_metadata;
+    static inline const MetadataView dummy_metadata;
+};
+
+//
+// Asynchronous unary call (see GrpcClient::CallAsync()).
+// Note: The call deletes itself once it's done.
+//
+template <typename GRPC_SERVICE, typename RESP>
+class GrpcAsyncCall final : public AsyncClientOp
+{
+public:
+    using DoneCallback = std::function<void(const grpc::Status&)>;
+
+    GrpcAsyncCall(GrpcClient<GRPC_SERVICE>& client, RESP& resp, CircuitBreaker::Ticket ticket, DoneCallback&& done)
+        : mClient(client), mResp(resp), mTicket(ticket), mDone(std::move(done)) {}
+
+    // Start the call with the reader created by the PrepareAsync stub function
+    void Start(std::unique_ptr<grpc::ClientAsyncResponseReader<RESP>>&& reader)
+    {
+        mReader = std::move(reader);
+        mReader->StartCall();
+        mReader->Finish(&mResp, &mStatus, this);
+    }
+
+    grpc::ClientContext& GetContext() { return mContext; }
+
+    // AsyncClientOp implementation
+    void OnEvent(bool /*ok*/) override
+    {
+        mClient.OnCallDone(mStatus, mTicket);
+        mDone(mStatus);
+        delete this;
+    }
+
+private:
+    GrpcClient<GRPC_SERVICE>& mClient;
+    RESP& mResp;
+    CircuitBreaker::Ticket mTicket{0};  // Circuit breaker ticket of the call
+    DoneCallback mDone;
+
+    grpc::ClientContext mContext;
+    std::unique_ptr<grpc::ClientAsyncResponseReader<RESP>> mReader;
+    grpc::Status mStatus;
+};
+
+//
+// Batch of unary calls (see GrpcClient::CallMany()): The calls are made on the
+// completion queue threads, up to maxInFlight at once, and the next call is started
+// as soon as one is done, on the item (context and reader) of the call that's done.
+// Note: The responses and the statuses are set in place, at the index of the request.
+//
+template <typename GRPC_SERVICE, typename GRPC_STUB_FUNC, typename REQ, typename RESP>
+class GrpcBatchCall
+{
+public:
+    GrpcBatchCall(GrpcClient<GRPC_SERVICE>& client, GRPC_STUB_FUNC grpcStubFunc,
+                  const std::vector<REQ>& reqs, std::vector<RESP>& resps,
+                  std::vector<grpc::Status>& statuses, const MetadataView& metadata,
+                  unsigned long timeout)
+        : mClient(client), mStubFunc(grpcStubFunc), mReqs(reqs), mResps(resps), mStatuses(statuses),
+          mMetadata(metadata), mTimeout(timeout),
+          mDeadline(std::chrono::system_clock::now() + std::chrono::milliseconds(timeout)) {}
+    ~GrpcBatchCall() = default;
+
+    // Make the calls, and wait until they are all done.
+    // Return false if the items of the calls in flight can't be allocated.
+    bool Run(size_t maxInFlight);
+
+private:
+    GrpcBatchCall(const GrpcBatchCall&) = delete;
+    GrpcBatchCall& operator=(const GrpcBatchCall&) = delete;
+
+    struct Item final : public AsyncClientOp
+    {
+        void OnEvent(bool /*ok*/) override { batch->OnItemDone(*this); }
+
+        GrpcBatchCall* batch{nullptr};
+        Item* next{nullptr};                // Next free item
+        size_t index{0};
+        CircuitBreaker::Ticket ticket{0};   // Circuit breaker ticket of the call
+        std::optional<grpc::ClientContext> context; // Note: A context is only used once
+        std::unique_ptr<grpc::ClientAsyncResponseReader<RESP>> reader;
+    };
+
+    // Helpers (called with the mutex locked)
+    bool StartNext();
+    bool IsDone() const { return (mInFlight == 0 && mNext == mReqs.size()); }
+
+    void OnItemDone(Item& item);
+
+    GrpcClient<GRPC_SERVICE>& mClient;
+    GRPC_STUB_FUNC mStubFunc;
+    const std::vector<REQ>& mReqs;
+    std::vector<RESP>& mResps;
+    std::vector<grpc::Status>& mStatuses;
+    const MetadataView& mMetadata;
+    unsigned long mTimeout{0};
+    std::chrono::system_clock::time_point mDeadline;
+
+    std::unique_ptr<Item[]> mItems;
+    Item* mFree{nullptr};   // Items of no call in flight
+    std::mutex mMtx;
+    std::condition_variable mDoneCv;
+    size_t mNext{0};        // Index of the next request to call
+    size_t mInFlight{0};
 };
 
+//
+// GrpcBatchCall class implementation
+//
+template <typename GRPC_SERVICE, typename GRPC_STUB_FUNC, typename REQ, typename RESP>
+bool GrpcBatchCall<GRPC_SERVICE, GRPC_STUB_FUNC, REQ, RESP>::Run(size_t maxInFlight)
+{
+    size_t itemCount = std::min(maxInFlight, mReqs.size());
+    if(itemCount == 0)
+        return true;
+
+    if(mItems.reset(new (std::nothrow) Item[itemCount]); !mItems)
+        return false;
+
+    for(size_t i = 0; i < itemCount; i++)
+    {
+        mItems[i].batch = this;
+        mItems[i].next = mFree;
+        mFree = &mItems[i];
+    }
+
+    std::unique_lock<std::mutex> lock(mMtx);
+    while(mFree && StartNext())
+        ;
+
+    // Note: The last call notifies with the mutex locked, so the batch
+    // isn't destroyed before it's done with it
+    mDoneCv.wait(lock, [this]() { return IsDone(); });
+    return true;
+}
+
+// Start the call of the next request on a free item.
+// Return false once all the calls have started.
+// Note: The requests that can't be called are failed right away.
+template <typename GRPC_SERVICE, typename GRPC_STUB_FUNC, typename REQ, typename RESP>
+bool GrpcBatchCall<GRPC_SERVICE, GRPC_STUB_FUNC, REQ, RESP>::StartNext()
+{
+    while(mNext < mReqs.size())
+    {
+        size_t index = mNext++;
+        if(mTimeout > 0 && std::chrono::system_clock::now() >= mDeadline)
+        {
+            mStatuses[index] = { grpc::StatusCode::DEADLINE_EXCEEDED, "Deadline Exceeded" };
+            continue;
+        }
+
+        CircuitBreaker::Ticket ticket = 0;
+        if(grpc::Status s = mClient.AllowCall(ticket); !s.ok())
+        {
+            mStatuses[index] = s;
+            continue;
+        }
+
+        // Note: The calls are spread among the channels and the completion queues
+        std::shared_ptr<typename GRPC_SERVICE::Stub> stub = mClient.GetStub();
+        grpc::CompletionQueue* cq = mClient.GetCompletionQueue();
+        if(!stub || !cq)
+        {
+            mStatuses[index] = { grpc::StatusCode::INTERNAL, !stub ? "Invalid (null) gRpc service stub" :
+                                                             "Failed to start client completion queue threads" };
+            mClient.OnCallDone(mStatuses[index], ticket);
+            continue;
+        }
+
+        Item& item = *mFree;
+        mFree = item.next;
+        item.index = index;
+        item.ticket = ticket;
+
+        // Note: The reader of the previous call refers to its context
+        item.reader.reset();
+        item.context.emplace();
+        mClient.CreateContext(*item.context, mMetadata, 0);
+        if(mTimeout > 0)
+            item.context->set_deadline(mDeadline);
+
+        item.reader = (stub.get()->*mStubFunc)(&*item.context, mReqs[index], cq);
+        item.reader->StartCall();
+        item.reader->Finish(&mResps[index], &mStatuses[index], &item);
+        mInFlight++;
+        return true;
+    }
+    return false;
+}
+
+template <typename GRPC_SERVICE, typename GRPC_STUB_FUNC, typename REQ, typename RESP>
+void GrpcBatchCall<GRPC_SERVICE, GRPC_STUB_FUNC, REQ, RESP>::OnItemDone(Item& item)
+{
+    mClient.OnCallDone(mStatuses[item.index], item.ticket);
+
+    std::unique_lock<std::mutex> lock(mMtx);
+    mInFlight--;
+    item.next = mFree;
+    mFree = &item;
+    StartNext();
+    if(IsDone())
+        mDoneCv.notify_one();
+}
+
 template <typename GRPC_SERVICE>
 bool GrpcClient<GRPC_SERVICE>::Init(const std::string& addressUri,
                                     const std::shared_ptr<grpc::ChannelCredentials>& creds /*= nullptr*/,
                                     const grpc::ChannelArguments* channelArgs /*= nullptr*/)
 {
-    Clear();
-
-    mAddressUri = addressUri;
-    mCreds = (creds ? creds : grpc::InsecureChannelCredentials());
+    std::shared_ptr<ChannelState> state = std::make_shared<ChannelState>();
+    state->addressUri = addressUri;
+    state->creds = (creds ? creds : grpc::InsecureChannelCredentials());
 
     if(channelArgs)
     {
-        mChannelArgs = std::make_shared<grpc::ChannelArguments>(*channelArgs);
+        state->channelArgs = std::make_shared<grpc::ChannelArguments>(*channelArgs);
     }
     else
     {
-        mChannelArgs = std::make_shared<grpc::ChannelArguments>();
+        state->channelArgs = std::make_shared<grpc::ChannelArguments>();
 
         // Maximise sent/receive mesage size (instead of 4MB default)
-        mChannelArgs->SetMaxSendMessageSize(INT_MAX);
-        mChannelArgs->SetMaxReceiveMessageSize(INT_MAX);
+        state->channelArgs->SetMaxSendMessageSize(INT_MAX);
+        state->channelArgs->SetMaxReceiveMessageSize(INT_MAX);
     }
 
-    std::shared_ptr<grpc::Channel> channel = grpc::CreateCustomChannel(mAddressUri, mCreds, *mChannelArgs);
-    if(channel)
-        mStub = GRPC_SERVICE::NewStub(channel);
-    return (mStub != nullptr);
+    // Note: The state is published even if its channels fail to be created,
+    // so Reset() can create them later
+    std::unique_lock<std::mutex> lock(mStubMtx);
+    bool created = CreateChannels(*state);
+    SetState(std::move(state));
+    return created;
 }
 
 template <typename GRPC_SERVICE>
 bool GrpcClient<GRPC_SERVICE>::IsValid()
 {
-    std::unique_lock<std::mutex> lock(mStubMtx);
-    return (bool)mStub;
+    std::shared_ptr<const ChannelState> state = GetState();
+    return (state && !state->stubs.empty());
+}
+
+template <typename GRPC_SERVICE>
+const std::shared_ptr<grpc::ChannelCredentials> GrpcClient<GRPC_SERVICE>::GetCredentials() const
+{
+    std::shared_ptr<const ChannelState> state = GetState();
+    return (state ? state->creds : nullptr);
+}
+
+template <typename GRPC_SERVICE>
+const std::shared_ptr<grpc::ChannelArguments> GrpcClient<GRPC_SERVICE>::GetChannelArgs() const
+{
+    std::shared_ptr<const ChannelState> state = GetState();
+    return (state ? state->channelArgs : nullptr);
+}
+
+template <typename GRPC_SERVICE>
+const std::string GrpcClient<GRPC_SERVICE>::GetAddressUri() const
+{
+    std::shared_ptr<const ChannelState> state = GetState();
+    return (state ? state->addressUri : std::string());
 }
 
-// Terminate a channel (if it exists) and reset GrpcClient to the initial state
-// Note: This method is NOT thread-safe and should not be used when the GrpcClient
-// is shared among multiple threads.
+// Terminate the channels (if they exist) and reset GrpcClient to the initial state
+// Note: The calls in progress complete on the channels they have started on.
 template <typename GRPC_SERVICE>
 void GrpcClient<GRPC_SERVICE>::Clear()
 {
-    mStub.reset();
-    mCreds.reset();
-    mChannelArgs.reset();
-    mAddressUri.clear();
+    std::unique_lock<std::mutex> lock(mStubMtx);
+    SetState(nullptr);
 }
 
-// Terminate the channel (if it exists) and initialize the GrpcClient using
+// Terminate the channels (if they exist) and initialize the GrpcClient using
 // the same arguments as the last Init() call
 template <typename GRPC_SERVICE>
 bool GrpcClient<GRPC_SERVICE>::Reset()
 {
-    if(mAddressUri.empty())
+    std::unique_lock<std::mutex> lock(mStubMtx);
+    if(!mState)
         return false;
 
+    std::shared_ptr<ChannelState> state = std::make_shared<ChannelState>();
+    state->addressUri = mState->addressUri;
+    state->creds = mState->creds;
+    state->channelArgs = mState->channelArgs;
+
+    bool created = CreateChannels(*state);
+    SetState(std::move(state));
+    return created;
+}
+
+// Create the channels of the state and their stubs
+template <typename GRPC_SERVICE>
+bool GrpcClient<GRPC_SERVICE>::CreateChannels(ChannelState& state) const
+{
+    for(int i = 0; i < mChannelCount; i++)
+    {
+        std::shared_ptr<grpc::Channel> channel = CreateChannel(state, i);
+        if(!channel)
+        {
+            state.stubs.clear();
+            state.channels.clear();
+            return false;
+        }
+
+        state.channels.push_back(channel);
+        state.stubs.emplace_back(GRPC_SERVICE::NewStub(channel));
+    }
+    return true;
+}
+
+// Create a channel of the pool.
+// Note: gRpc shares the connections (subchannels) of the channels with the same
+// arguments, so every channel of the pool gets its own subchannel pool.
+template <typename GRPC_SERVICE>
+std::shared_ptr<grpc::Channel> GrpcClient<GRPC_SERVICE>::CreateChannel(const ChannelState& state, int index) const
+{
+    if(mChannelCount == 1)
+        return grpc::CreateCustomChannel(state.addressUri, state.creds, *state.channelArgs);
+
+    grpc::ChannelArguments channelArgs(*state.channelArgs);
+    channelArgs.SetInt(GRPC_ARG_USE_LOCAL_SUBCHANNEL_POOL, 1);
+    channelArgs.SetInt("gen.channel_index", index);
+    return grpc::CreateCustomChannel(state.addressUri, state.creds, channelArgs);
+}
+
+// Publish the channel state (null to clear it), and retire the previous one.
+// Note: The retired state is kept until no thread has it pinned (see FreeRetired()).
+template <typename GRPC_SERVICE>
+void GrpcClient<GRPC_SERVICE>::SetState(std::shared_ptr<ChannelState>&& state)
+{
+    if(state)
+        state->generation = ++sLastGeneration;
+    if(mState)
+        mRetired.push_back(std::move(mState));
+
+    mState = std::move(state);
+    mGeneration.store(mState ? mState->generation : 0);
+    FreeRetired();
+}
+
+// Free the retired states that no thread has pinned.
+// Note: A thread pins a state before it checks that the state isn't retired
+// (see StubRef), so a state that isn't pinned once it's retired is never used again.
+template <typename GRPC_SERVICE>
+void GrpcClient<GRPC_SERVICE>::FreeRetired()
+{
+    if(mRetired.empty())
+        return;
+
+    std::unique_lock<std::mutex> lock(sCachesMtx);
+    auto isPinned = [](const std::shared_ptr<const ChannelState>& state)
+    {
+        for(ThreadCache* cache : sCaches)
+        {
+            for(CachedState& cached : cache->states)
+            {
+                if(cached.pins > 0 && cached.state == state.get())
+                    return true;
+            }
+        }
+        return false;
+    };
+    mRetired.erase(std::remove_if(mRetired.begin(), mRetired.end(),
+                                  [&](const auto& state) { return !isPinned(state); }),
+                   mRetired.end());
+}
+
+template <typename GRPC_SERVICE>
+GrpcClient<GRPC_SERVICE>::ThreadCache::ThreadCache()
+{
+    std::unique_lock<std::mutex> lock(sCachesMtx);
+    sCaches.push_back(this);
+}
+
+template <typename GRPC_SERVICE>
+GrpcClient<GRPC_SERVICE>::ThreadCache::~ThreadCache()
+{
+    std::unique_lock<std::mutex> lock(sCachesMtx);
+    sCaches.erase(std::find(sCaches.begin(), sCaches.end(), this));
+}
+
+template <typename GRPC_SERVICE>
+typename GrpcClient<GRPC_SERVICE>::CachedState* GrpcClient<GRPC_SERVICE>::ThreadCache::Find(uint64_t generation)
+{
+    for(CachedState& cached : states)
+    {
+        if(cached.generation == generation)
+            return &cached;
+    }
+    return nullptr;
+}
+
+template <typename GRPC_SERVICE>
+typename GrpcClient<GRPC_SERVICE>::CachedState* GrpcClient<GRPC_SERVICE>::ThreadCache::Insert(const ChannelState& state)
+{
+    // Take the next slot that isn't pinned
+    for(size_t i = 0; i < kSize; i++)
+    {
+        CachedState& cached = states[nextSlot++ % kSize];
+        if(cached.pins > 0)
+            continue;
+
+        // Note: The threads start their round-robin on different channels
+        cached.state = &state;
+        cached.generation = state.generation;
+        cached.nextChannel = std::hash<std::thread::id>()(std::this_thread::get_id());
+        return &cached;
+    }
+    return nullptr;
+}
+
+template <typename GRPC_SERVICE>
+GrpcClient<GRPC_SERVICE>::StubRef::StubRef(GrpcClient& client) : mClient(client)
+{
+    uint64_t generation = client.mGeneration;
+    if(generation == 0)
+        return;
+
+    // Pin the cached state, then make sure it isn't retired: Either the client
+    // sees the pin (and keeps the state), or we see that the state is retired.
+    ThreadCache& cache = GetThreadCache();
+    if(CachedState* cached = cache.Find(generation); cached)
+    {
+        cached->pins++;
+        if(client.mGeneration == generation)
+            mCached = cached;
+        else
+            cached->pins--;
+    }
+
+    if(!mCached)
+    {
+        // First call of the thread since the state is published (or it was retired).
+        // Note: The state is held until it's pinned and known to be published, else
+        // the client might have freed it already.
+        mState = client.GetState();
+        if(!mState || mState->stubs.empty())
+            return;
+
+        if(CachedState* cached = cache.Insert(*mState); cached)
+        {
+            cached->pins++;
+            if(client.mGeneration == mState->generation)
+            {
+                mCached = cached;
+                mState.reset();
+            }
+            else
+            {
+                cached->pins--;
+            }
+        }
+
+        if(!mCached)
+        {
+            mStub = &mState->stubs[client.mNextChannel++ % mState->stubs.size()];
+            return;
+        }
+    }
+
+    const std::vector<std::shared_ptr<typename GRPC_SERVICE::Stub>>& stubs = mCached->state.load()->stubs;
+    if(stubs.empty())
+        return;
+
+    mStub = &stubs[stubs.size() == 1 ? 0 : mCached->nextChannel++ % stubs.size()];
+}
+
+template <typename GRPC_SERVICE>
+GrpcClient<GRPC_SERVICE>::StubRef::~StubRef()
+{
+    // Let the client free the state once it's retired and the last call is done with it
+    if(mCached && --mCached->pins == 0 && mCached->generation != mClient.mGeneration)
+    {
+        std::unique_lock<std::mutex> lock(mClient.mStubMtx);
+        mClient.FreeRetired();
+    }
+}
+
+template <typename GRPC_SERVICE>
+grpc::Status GrpcClient<GRPC_SERVICE>::AllowCall(CircuitBreaker::Ticket& ticket) const
+{
+    ticket = 0;
+    if(mBreaker && !mBreaker->Allow(ticket))
+        return { grpc::StatusCode::UNAVAILABLE, "Circuit breaker is open" };
+    return grpc::Status::OK;
+}
+
+template <typename GRPC_SERVICE>
+void GrpcClient<GRPC_SERVICE>::OnCallDone(const grpc::Status& s, CircuitBreaker::Ticket ticket)
+{
+    if(mBreaker && mBreaker->OnCallDone(s.error_code(), ticket))
+        RecycleChannel();
+}
+
+// Re-create the channels whose connection is broken.
+// Note: Only called when the circuit breaker trips, so at most once per openTime.
+template <typename GRPC_SERVICE>
+void GrpcClient<GRPC_SERVICE>::RecycleChannel()
+{
     std::unique_lock<std::mutex> lock(mStubMtx);
-    mStub.reset();
-    std::shared_ptr<grpc::Channel> channel = grpc::CreateCustomChannel(mAddressUri, mCreds, *mChannelArgs);
-    if(channel)
-        mStub = GRPC_SERVICE::NewStub(channel);
-    return (mStub != nullptr);
+    if(!mState)
+        return;
+
+    std::shared_ptr<ChannelState> state = std::make_shared<ChannelState>();
+    state->addressUri = mState->addressUri;
+    state->creds = mState->creds;
+    state->channelArgs = mState->channelArgs;
+    state->channels = mState->channels;
+    state->stubs = mState->stubs;
+
+    bool recycled = false;
+    for(size_t i = 0; i < state->channels.size(); i++)
+    {
+        grpc_connectivity_state channelState = state->channels[i]->GetState(false);
+        if(channelState != GRPC_CHANNEL_TRANSIENT_FAILURE && channelState != GRPC_CHANNEL_SHUTDOWN)
+            continue;
+
+        if(std::shared_ptr<grpc::Channel> channel = CreateChannel(*state, i); channel)
+        {
+            state->channels[i] = channel;
+            state->stubs[i] = GRPC_SERVICE::NewStub(channel);
+            recycled = true;
+        }
+    }
+
+    if(recycled)
+        SetState(std::move(state));
+}
+
+template <typename GRPC_SERVICE>
+grpc::CompletionQueue* GrpcClient<GRPC_SERVICE>::GetCompletionQueue()
+{
+    if(!mQueues.IsRunning())
+    {
+        std::unique_lock<std::mutex> lock(mQueuesMtx);
+        if(!mQueues.IsRunning() && !mQueues.Start(mAsyncThreadCount))
+            return nullptr;
+    }
+    return mQueues.GetQueue();
 }
 
 // UNARY gRpc
@@ -237,21 +1268,23 @@ template <typename GRPC_SERVICE>
 template <typename GRPC_STUB_FUNC, typename REQ, typename RESP>
 StatusEx GrpcClient<GRPC_SERVICE>::Call(GRPC_STUB_FUNC grpcStubFunc,
                                         const REQ& req, RESP& resp,
-                                        const std::map<std::string, std::string>& metadata,
+                                        const MetadataView& metadata,
                                         std::string& errMsg, unsigned long timeout)
 {
-    // Make a local copy of the stub std::shared_ptr.
-    // This is to make sure we have a valid stub even if another thread reset stub.
-    std::shared_ptr<typename GRPC_SERVICE::Stub> thisStub;
+    // Get the stub without a lock (see StubRef).
+    // This is to make sure we have a valid stub even if another thread resets the channels.
+    StubRef thisStub(*this);
 
+    if(!thisStub)
     {
-        std::unique_lock<std::mutex> lock(mStubMtx);
-        thisStub = mStub;
+        grpc::Status s(grpc::StatusCode::INTERNAL, "Invalid (null) gRpc service stub");
+        FormatStatusMsg(errMsg, __func__, req, s);
+        return s;
     }
 
-    if(!thisStub)
+    CircuitBreaker::Ticket ticket = 0;
+    if(grpc::Status s = AllowCall(ticket); !s.ok())
     {
-        grpc::Status s(grpc::StatusCode::INTERNAL, "Invalid (null) gRpc service stub");
         FormatStatusMsg(errMsg, __func__, req, s);
         return s;
     }
@@ -262,18 +1295,202 @@ StatusEx GrpcClient<GRPC_SERVICE>::Call(GRPC_STUB_FUNC grpcStubFunc,
 
     // Call service
     grpc::Status s = (thisStub.get()->*grpcStubFunc)(&context, req, &resp);
+    OnCallDone(s, ticket);
+    if(!s.ok())
+        FormatStatusMsg(errMsg, __func__, req, s);
+
+    return s;
+}
+
+// UNARY gRpc - hedged
+template <typename GRPC_SERVICE>
+template <typename GRPC_STUB_FUNC, typename REQ, typename RESP>
+StatusEx GrpcClient<GRPC_SERVICE>::Call(GRPC_STUB_FUNC grpcStubFunc,
+                                        const REQ& req, RESP& resp,
+                                        const MetadataView& metadata,
+                                        std::string& errMsg, unsigned long timeout,
+                                        const std::shared_ptr<HedgingPolicy>& hedging)
+{
+    static_assert(std::is_invocable_v<GRPC_STUB_FUNC, typename GRPC_SERVICE::Stub*,
+                                      grpc::ClientContext*, const REQ&, grpc::CompletionQueue*>,
+                  "Hedged calls are made with the PrepareAsync stub function");
+
+    // Note: The thread would wait for the attempts it may have to complete
+    if(ClientQueues::IsQueueThread())
+    {
+        grpc::Status s(grpc::StatusCode::FAILED_PRECONDITION, "Hedged Call() is called from a completion queue thread");
+        FormatStatusMsg(errMsg, __func__, req, s);
+        return s;
+    }
+
+    // Make a local copy of the stub std::shared_ptr.
+    // This is to make sure the stub is valid for all the attempts, even if another
+    // thread resets the channels.
+    std::shared_ptr<typename GRPC_SERVICE::Stub> thisStub = GetStub();
+
+    if(!thisStub)
+    {
+        grpc::Status s(grpc::StatusCode::INTERNAL, "Invalid (null) gRpc service stub");
+        FormatStatusMsg(errMsg, __func__, req, s);
+        return s;
+    }
+
+    grpc::CompletionQueue* cq = GetCompletionQueue();
+    if(!cq)
+    {
+        grpc::Status s(grpc::StatusCode::INTERNAL, "Failed to start client completion queue threads");
+        FormatStatusMsg(errMsg, __func__, req, s);
+        return s;
+    }
+
+    CircuitBreaker::Ticket ticket = 0;
+    if(grpc::Status s = AllowCall(ticket); !s.ok())
+    {
+        FormatStatusMsg(errMsg, __func__, req, s);
+        return s;
+    }
+
+    // Create the context of an attempt.
+    // Note: All the attempts share the deadline of the call.
+    std::chrono::system_clock::time_point deadline =
+            std::chrono::system_clock::now() + std::chrono::milliseconds(timeout);
+    auto newContext = [&]()
+    {
+        std::unique_ptr<grpc::ClientContext> context = std::make_unique<grpc::ClientContext>();
+        CreateContext(*context, metadata, 0);
+        if(timeout > 0)
+            context->set_deadline(deadline);
+        return context;
+    };
+
+    // Create the context of the hedge, and take the stub of the next channel.
+    // Note: The hedge isn't sent on the connection the first attempt is slow on
+    // (with the default pick_first policy, a channel has a single connection).
+    auto newHedge = [&](std::shared_ptr<typename GRPC_SERVICE::Stub>& stub)
+    {
+        if(std::shared_ptr<typename GRPC_SERVICE::Stub> next = GetStub(); next)
+            stub = next;
+        return newContext();
+    };
+
+    // Note: The call holds the promise until it's deleted, after it's done
+    auto promise = std::make_shared<std::promise<grpc::Status>>();
+    std::future<grpc::Status> result = promise->get_future();
+
+    using HedgedCall = GrpcHedgedCall<GRPC_SERVICE, GRPC_STUB_FUNC, REQ, RESP>;
+    HedgedCall* call = new (std::nothrow) HedgedCall(thisStub, cq, grpcStubFunc, req, resp, hedging, newHedge,
+                                                     [promise](const grpc::Status& s) { promise->set_value(s); });
+    if(!call)
+    {
+        grpc::Status s(grpc::StatusCode::INTERNAL, "Out of memory while allocating GrpcHedgedCall");
+        OnCallDone(s, ticket);
+        FormatStatusMsg(errMsg, __func__, req, s);
+        return s;
+    }
+
+    call->Start(newContext());
+    grpc::Status s = result.get();
+    OnCallDone(s, ticket);
     if(!s.ok())
         FormatStatusMsg(errMsg, __func__, req, s);
 
     return s;
 }
 
+// UNARY gRpc - batch (fan-out)
+template <typename GRPC_SERVICE>
+template <typename GRPC_STUB_FUNC, typename REQ, typename RESP>
+StatusEx GrpcClient<GRPC_SERVICE>::CallMany(GRPC_STUB_FUNC grpcStubFunc,
+                                            const std::vector<REQ>& reqs, std::vector<RESP>& resps,
+                                            std::vector<grpc::Status>& statuses,
+                                            const MetadataView& metadata,
+                                            std::string& errMsg, unsigned long timeout, size_t maxInFlight)
+{
+    static_assert(std::is_invocable_v<GRPC_STUB_FUNC, typename GRPC_SERVICE::Stub*,
+                                      grpc::ClientContext*, const REQ&, grpc::CompletionQueue*>,
+                  "Batch calls are made with the PrepareAsync stub function");
+
+    resps.clear();
+    resps.resize(reqs.size());
+    statuses.assign(reqs.size(), grpc::Status::OK);
+
+    // Note: The thread would wait for the calls it may have to complete
+    if(ClientQueues::IsQueueThread())
+    {
+        grpc::Status s(grpc::StatusCode::FAILED_PRECONDITION, "CallMany() is called from a completion queue thread");
+        statuses.assign(reqs.size(), s);
+        FormatStatusMsg(errMsg, __func__, REQ(), s);
+        return s;
+    }
+
+    GrpcBatchCall<GRPC_SERVICE, GRPC_STUB_FUNC, REQ, RESP> batch(*this, grpcStubFunc, reqs, resps,
+                                                                statuses, metadata, timeout);
+    if(!batch.Run(std::max<size_t>(maxInFlight, 1)))
+    {
+        grpc::Status s(grpc::StatusCode::INTERNAL, "Out of memory while allocating GrpcBatchCall");
+        statuses.assign(reqs.size(), s);
+        FormatStatusMsg(errMsg, __func__, REQ(), s);
+        return s;
+    }
+
+    for(size_t i = 0; i < reqs.size(); i++)
+    {
+        if(!statuses[i].ok())
+        {
+            FormatStatusMsg(errMsg, __func__, reqs[i], statuses[i]);
+            return statuses[i];
+        }
+    }
+    return grpc::Status::OK;
+}
+
+// UNARY gRpc - asynchronous
+template <typename GRPC_SERVICE>
+template <typename GRPC_STUB_FUNC, typename REQ, typename RESP>
+void GrpcClient<GRPC_SERVICE>::CallAsync(GRPC_STUB_FUNC grpcStubFunc,
+                                         const REQ& req, RESP& resp,
+                                         const MetadataView& metadata,
+                                         std::function<void(const grpc::Status&)> callback,
+                                         unsigned long timeout)
+{
+    static_assert(std::is_invocable_v<GRPC_STUB_FUNC, typename GRPC_SERVICE::Stub*,
+                                      grpc::ClientContext*, const REQ&, grpc::CompletionQueue*>,
+                  "Asynchronous calls are made with the PrepareAsync stub function");
+
+    // Get the stub without a lock (see StubRef).
+    // This is to make sure we have a valid stub even if another thread resets the channels.
+    StubRef thisStub(*this);
+
+    if(!thisStub)
+        return callback({ grpc::StatusCode::INTERNAL, "Invalid (null) gRpc service stub" });
+
+    grpc::CompletionQueue* cq = GetCompletionQueue();
+    if(!cq)
+        return callback({ grpc::StatusCode::INTERNAL, "Failed to start client completion queue threads" });
+
+    CircuitBreaker::Ticket ticket = 0;
+    if(grpc::Status s = AllowCall(ticket); !s.ok())
+        return callback(s);
+
+    auto call = new (std::nothrow) GrpcAsyncCall<GRPC_SERVICE, RESP>(*this, resp, ticket, std::move(callback));
+    if(!call)
+    {
+        grpc::Status s(grpc::StatusCode::INTERNAL, "Out of memory while allocating GrpcAsyncCall");
+        OnCallDone(s, ticket);
+        return callback(s);
+    }
+
+    // Note: The request is serialized by the stub function
+    CreateContext(call->GetContext(), metadata, timeout);
+    call->Start((thisStub.get()->*grpcStubFunc)(&call->GetContext(), req, cq));
+}
+
 // Server-side STREAM gRpc
 template <typename GRPC_SERVICE>
 template <typename GRPC_STUB_FUNC, typename REQ, typename RESP>
 StatusEx GrpcClient<GRPC_SERVICE>::CallStream(GRPC_STUB_FUNC grpcStubFunc,
                                               const REQ& req, const std::function<bool(const RESP&)>& respCallback,
-                                              const std::map<std::string, std::string>& metadata,
+                                              const MetadataView& metadata,
                                               std::string& errMsg, unsigned long timeout)
 {
     // Create client context
@@ -281,7 +1498,8 @@ StatusEx GrpcClient<GRPC_SERVICE>::CallStream(GRPC_STUB_FUNC grpcStubFunc,
     CreateContext(context, metadata, timeout);
 
     std::unique_ptr<grpc::ClientReader<RESP>> reader;
-    StatusEx s = GetStream(grpcStubFunc, req, reader, context, errMsg);
+    CircuitBreaker::Ticket ticket = 0;
+    StatusEx s = GetStream(grpcStubFunc, req, reader, context, ticket, errMsg);
     if(!s.ok())
         return s;
 
@@ -294,6 +1512,7 @@ StatusEx GrpcClient<GRPC_SERVICE>::CallStream(GRPC_STUB_FUNC grpcStubFunc,
     }
 
     s = reader->Finish();
+    OnCallDone(s, ticket);
     if(!s.ok())
         FormatStatusMsg(errMsg, __func__, req, s);
 
@@ -305,21 +1524,23 @@ template <typename GRPC_SERVICE>
 template <typename GRPC_STUB_FUNC, typename REQ, typename RESP>
 StatusEx GrpcClient<GRPC_SERVICE>::CallClientStream(GRPC_STUB_FUNC grpcStubFunc,
                                                     const std::function<bool(REQ&)>& reqCallback, RESP& resp,
-                                                    const std::map<std::string, std::string>& metadata,
+                                                    const MetadataView& metadata,
                                                     std::string& errMsg, unsigned long timeout)
 {
-    // Make a local copy of the stub std::shared_ptr.
-    // This is to make sure we have a valid stub even if another thread reset stub.
-    std::shared_ptr<typename GRPC_SERVICE::Stub> thisStub;
+    // Get the stub without a lock (see StubRef).
+    // This is to make sure we have a valid stub even if another thread resets the channels.
+    StubRef thisStub(*this);
 
+    if(!thisStub)
     {
-        std::unique_lock<std::mutex> lock(mStubMtx);
-        thisStub = mStub;
+        grpc::Status s(grpc::StatusCode::INTERNAL, "Invalid (null) gRpc service stub");
+        FormatStatusMsg(errMsg, __func__, REQ(), s);
+        return s;
     }
 
-    if(!thisStub)
+    CircuitBreaker::Ticket ticket = 0;
+    if(grpc::Status s = AllowCall(ticket); !s.ok())
     {
-        grpc::Status s(grpc::StatusCode::INTERNAL, "Invalid (null) gRpc service stub");
         FormatStatusMsg(errMsg, __func__, REQ(), s);
         return s;
     }
@@ -342,20 +1563,87 @@ StatusEx GrpcClient<GRPC_SERVICE>::CallClientStream(GRPC_STUB_FUNC grpcStubFunc,
     writer->WritesDone();
 
     grpc::Status s = writer->Finish();
+    OnCallDone(s, ticket);
     if(!s.ok())
         FormatStatusMsg(errMsg, __func__, req, s);
 
     return s;
 }
 
+// Bidirectional STREAM gRpc
+template <typename GRPC_SERVICE>
+template <typename GRPC_STUB_FUNC, typename REQ, typename RESP>
+StatusEx GrpcClient<GRPC_SERVICE>::CallBidiStream(GRPC_STUB_FUNC grpcStubFunc,
+                                                  const std::function<bool(REQ&)>& reqCallback,
+                                                  const std::function<bool(const RESP&)>& respCallback,
+                                                  const MetadataView& metadata,
+                                                  std::string& errMsg, unsigned long timeout)
+{
+    // Get the stub without a lock (see StubRef).
+    // This is to make sure we have a valid stub even if another thread resets the channels.
+    StubRef thisStub(*this);
+
+    if(!thisStub)
+    {
+        grpc::Status s(grpc::StatusCode::INTERNAL, "Invalid (null) gRpc service stub");
+        FormatStatusMsg(errMsg, __func__, REQ(), s);
+        return s;
+    }
+
+    CircuitBreaker::Ticket ticket = 0;
+    if(grpc::Status s = AllowCall(ticket); !s.ok())
+    {
+        FormatStatusMsg(errMsg, __func__, REQ(), s);
+        return s;
+    }
+
+    // Create client context
+    grpc::ClientContext context;
+    CreateContext(context, metadata, timeout);
+
+    // Call service
+    std::unique_ptr<grpc::ClientReaderWriter<REQ, RESP>> stream((thisStub.get()->*grpcStubFunc)(&context));
+
+    // Write requests while reading responses
+    std::thread writer([&]()
+    {
+        REQ req;
+        while(reqCallback(req))
+        {
+            if(!stream->Write(req))
+                break;
+            req.Clear();
+        }
+        stream->WritesDone();
+    });
+
+    RESP resp;
+    while(stream->Read(&resp))
+    {
+        if(!respCallback(resp))
+            context.TryCancel();
+        resp.Clear();
+    }
+
+    writer.join();
+
+    grpc::Status s = stream->Finish();
+    OnCallDone(s, ticket);
+    if(!s.ok())
+        FormatStatusMsg(errMsg, __func__, REQ(), s);
+
+    return s;
+}
+
 template <typename GRPC_SERVICE>
 void GrpcClient<GRPC_SERVICE>::CreateContext(grpc::ClientContext& context,
-                                             const std::map<std::string, std::string>& metadata,
+                                             const MetadataView& metadata,
                                              unsigned long timeout) const
 {
     // Create context and set metadata (if we have any...)
+    // Note: The context keeps its own copy of the metadata
     for(const auto& [key, value] : metadata)
-        context.AddMetadata(key, value);
+        context.AddMetadata(std::string(key.data(), key.size()), std::string(value.data(), value.size()));
 
     // Set deadline of how long to wait for a server reply
     if(timeout > 0)
@@ -371,21 +1659,23 @@ template <typename GRPC_SERVICE>
 template <typename GRPC_STUB_FUNC, typename REQ, typename RESP>
 StatusEx GrpcClient<GRPC_SERVICE>::GetStream(GRPC_STUB_FUNC grpcStubFunc, const REQ& req,
                                              std::unique_ptr<grpc::ClientReader<RESP>>& reader,
-                                             grpc::ClientContext& context,
+                                             grpc::ClientContext& context, CircuitBreaker::Ticket& ticket,
                                              std::string& errMsg)
 {
-    // Make a local copy of the stub std::shared_ptr.
-    // This is to make sure we have a valid stub even if another thread reset stub.
-    std::shared_ptr<typename GRPC_SERVICE::Stub> thisStub;
+    // Get the stub without a lock (see StubRef).
+    // This is to make sure we have a valid stub even if another thread resets the channels.
+    StubRef thisStub(*this);
 
+    if(!thisStub)
     {
-        std::unique_lock<std::mutex> lock(mStubMtx);
-        thisStub = mStub;
+        grpc::Status s(grpc::StatusCode::INTERNAL, "Invalid (null) gRpc service stub");
+        FormatStatusMsg(errMsg, __func__, req, s);
+        return s;
     }
 
-    if(!thisStub)
+    // Note: The caller reports the status of the stream (see OnCallDone())
+    if(grpc::Status s = AllowCall(ticket); !s.ok())
     {
-        grpc::Status s(grpc::StatusCode::INTERNAL, "Invalid (null) gRpc service stub");
         FormatStatusMsg(errMsg, __func__, req, s);
         return s;
     }
@@ -396,6 +1686,7 @@ StatusEx GrpcClient<GRPC_SERVICE>::GetStream(GRPC_STUB_FUNC grpcStubFunc, const
     if(!reader)
     {
         grpc::Status s(grpc::StatusCode::INTERNAL, "Invalid (null) client stream reader");
+        OnCallDone(s, ticket);
         FormatStatusMsg(errMsg, __func__, req, s);
         return s;
     }
@@ -408,7 +1699,7 @@ void GrpcClient<GRPC_SERVICE>::FormatStatusMsg(std::string& msg, const std::stri
                                                const google::protobuf::Message& req,
                                                const grpc::Status& status) const
 {
-    msg = fname + "(" + std::string(req.GetTypeName()) + ") to uri='" + mAddressUri + "', status: " +
+    msg = fname + "(" + std::string(req.GetTypeName()) + ") to uri='" + GetAddressUri() + "', status: " +
             std::to_string(status.error_code()) + " (" + StatusToStr(status.error_code()) + ")";
     if(!status.error_message().empty())
         msg += ", err: '" + status.error_message() + "'";
@@ -9,19 +9,50 @@
 #pragma GCC diagnostic ignored "-Wunused-parameter"
 #include <grpcpp/impl/codegen/status_code_enum.h>   // grpc::StatusCode
 #include <grpcpp/impl/codegen/server_context.h>     // grpc::ServerContext
+#include <grpcpp/generic/async_generic_service.h>   // grpc::GenericServerContext
+#include <grpcpp/impl/codegen/proto_utils.h>        // grpc::SerializationTraits
+#include <google/protobuf/io/coded_stream.h>        // google::protobuf::io::CodedOutputStream
+#include <google/protobuf/io/zero_copy_stream_impl_lite.h>
+#include <google/protobuf/message.h>                // google::protobuf::Message
 #pragma GCC diagnostic pop
 
+#include <functional>
 #include <string>
+#include <vector>
 
 namespace gen {
 
+//
+// Interface of a call whose processing can be deferred (see Context::Defer())
+//
+struct DeferredCall
+{
+    virtual void Defer() = 0;
+    virtual void Resume() = 0;
+    virtual ~DeferredCall() = default;
+};
+
+//
+// Helper function to un-escape peer by replacing "%5B" and "%5D" with "[" and "]"
+// respectively in order to support older gRpc releases
+//
+inline std::string UnescapePeer(std::string peer)
+{
+    for(const auto& [substr1, substr2] : { std::make_pair("%5B", "["), std::make_pair("%5D", "]") })
+    {
+        for(size_t i = peer.find(substr1, 0); i != std::string::npos; i = peer.find(substr1, i + 1))
+            peer.replace(i, 3, substr2);
+    }
+    return peer;
+}
+
 //
 // Class Context is sent to unary process function
 //
 class Context : public grpc::ServerContext
 {
 public:
-    Context(const void* param) : rpcParam(param) {}
+    Context(const void* param, DeferredCall* call = nullptr) : rpcParam(param), deferredCall(call) {}
     ~Context() = default;
 
     const ::grpc::Status& GetStatus() const { return grpcStatus; }
@@ -43,43 +74,108 @@ public:
 
     std::string GetMetadata(const char* key) const
     {
-        const std::multimap<::grpc::string_ref, ::grpc::string_ref>& metadata = grpc::ServerContext::client_metadata();
-        if(auto itr = metadata.find(key); itr != metadata.end())
-            return std::string(itr->second.data(), itr->second.size());
-        else
-            return "";
+        ::grpc::string_ref value = GetMetadataRef(key);
+        return std::string(value.data(), value.size());
     }
 
-    std::string Peer() const
+    // Get the value of a client metadata key without copying it (empty if the key is
+    // missing). The value is valid for the lifetime of the context.
+    ::grpc::string_ref GetMetadataRef(const char* key) const
     {
-        std::string peer = grpc::ServerContext::peer();
-
-        // Note: Un-escape peer by replacing "%5B" and "%5D" with "[" and "]"
-        // respectively in order to support older gRpc releases
-        Replace(peer, "%5B", "[");
-        Replace(peer, "%5D", "]");
-        return peer;
+        const std::multimap<::grpc::string_ref, ::grpc::string_ref>& metadata = grpc::ServerContext::client_metadata();
+        if(auto itr = metadata.find(key); itr != metadata.end())
+            return itr->second;
+        return {};
     }
 
+    std::string Peer() const { return UnescapePeer(grpc::ServerContext::peer()); }
+
     // Get application-level data set by AddUnaryRpcRequest/AddStreamRpcRequest
     const void* GetRpcParam() const { return rpcParam; }
 
-private:
-    // Helper method to replace all occurrences of substring with another substring
-    void Replace(std::string& str, const char* substr1, const char* substr2) const
+    // Defer the operation that follows the process function (e.g. reading the
+    // next request of a client stream) until Resume() is called, so the process
+    // function can return before the asynchronous work it has started is done.
+    // The context, the request and the response stay valid until then.
+    // Resume() can be called from any thread, once for every Defer(), and must
+    // not touch the context afterwards. Return false if the RPC can't be deferred.
+    // Note: A stopping server waits a few seconds for the deferred calls. The ones
+    // resumed later are dropped, but they must be resumed before it's run again
+    // or destroyed.
+    bool Defer() const
     {
-        if(size_t len1 = (substr1 ? strlen(substr1) : 0); len1 > 0)
-        {
-            size_t len2 = (substr2 ? strlen(substr2) : 0);
-            for(size_t i = str.find(substr1, 0); i != std::string::npos; i = str.find(substr1, i + len2))
-                str.replace(i, len1, substr2);
-        }
-    };
+        if(!deferredCall)
+            return false;
+        deferredCall->Defer();
+        return true;
+    }
 
+    void Resume() const
+    {
+        if(deferredCall)
+            deferredCall->Resume();
+    }
+
+private:
     const void* rpcParam{nullptr};
+    DeferredCall* deferredCall{nullptr};    // Call to defer (if the RPC supports it)
     mutable ::grpc::Status grpcStatus{::grpc::Status::OK};
 };
 
+//
+// Interface of a stream that responses can be written to from any thread.
+// Note: Every call served by the stream has its own generation, so the calls
+// made for a call that has already ended are ignored.
+//
+struct AsyncStreamWriter
+{
+    virtual bool Write(uint64_t generation, const google::protobuf::Message& resp, bool isLast) = 0;
+    virtual bool Finish(uint64_t generation, const ::grpc::Status& status) = 0;
+    virtual void SetOnDrain(uint64_t generation, std::function<void()>&& onDrain) = 0;
+    virtual bool IsClosed(uint64_t generation) = 0;
+
+    // The stream switches to producer mode (see ServerStreamContext::GetWriter())
+    virtual void SetProducer(uint64_t generation) {}
+    virtual ~AsyncStreamWriter() = default;
+};
+
+//
+// Class StreamWriter is a handle to write stream responses from any thread.
+// Responses are queued and written in order by the completion queue thread.
+// Write() returns false if the stream is closed, or if the queue is full (see
+// BindOptions::writeHighWater). In the latter case, the onDrain callback set by
+// GetWriter() is called on the completion queue thread once the queue drains.
+// Note: The handle can be kept after the stream ends (it's closed then),
+// but not after the server stops.
+//
+class StreamWriter
+{
+public:
+    StreamWriter() = default;
+
+    bool Write(const google::protobuf::Message& resp) const { return writer && writer->Write(generation, resp, false); }
+
+    // Write the last response and finish the stream with grpc::OK
+    bool WriteLast(const google::protobuf::Message& resp) const { return writer && writer->Write(generation, resp, true); }
+
+    // Finish the stream once all the queued responses are written
+    bool Finish(::grpc::StatusCode statusCode = grpc::OK, const std::string& err = "") const
+    {
+        return writer && writer->Finish(generation, statusCode == grpc::OK ? ::grpc::Status::OK : ::grpc::Status(statusCode, err));
+    }
+
+    bool IsClosed() const { return !writer || writer->IsClosed(generation); }
+
+private:
+    StreamWriter(AsyncStreamWriter* writer_, uint64_t generation_) : writer(writer_), generation(generation_) {}
+
+    AsyncStreamWriter* writer{nullptr};
+    uint64_t generation{0};
+
+    friend class ServerStreamContext;
+    friend class BidiStreamContext;
+};
+
 //
 // Class ServerStreamContext is sent to stream process function
 //
@@ -88,7 +184,8 @@ enum StreamStatus : char { STREAMING=1, SUCCESS, ERROR };
 class ServerStreamContext : public Context
 {
 public:
-    ServerStreamContext(const void* param) : Context(param) {}
+    ServerStreamContext(const void* param, AsyncStreamWriter* writer_ = nullptr, uint64_t generation_ = 0)
+        : Context(param), writer(writer_), generation(generation_) {}
     ~ServerStreamContext() = default;
 
     StreamStatus GetStreamStatus() const { return streamStatus; }
@@ -98,16 +195,40 @@ public:
 
     void  EndOfStream(::grpc::StatusCode statusCode = grpc::OK, const std::string& err = "") const
     {
+        if(isProducer)
+        {
+            StreamWriter(writer, generation).Finish(statusCode, err);
+            return;
+        }
+
         Context::SetStatus(statusCode, err);
         streamHasMore = false;
     }
 
+    // Switch the stream to producer mode: responses are written with the
+    // returned StreamWriter from any thread, as fast as they are produced.
+    // The process function isn't called for every response anymore (resp is
+    // ignored), only once more with the final stream status.
+    StreamWriter GetWriter(std::function<void()> onDrain = nullptr) const
+    {
+        if(!writer)
+            return StreamWriter();
+
+        isProducer = true;
+        writer->SetOnDrain(generation, std::move(onDrain));
+        writer->SetProducer(generation);
+        return StreamWriter(writer, generation);
+    }
+
 private:
     // Prevent from calling Context::SetStatus, force to use EndOfStream instead
     void SetStatus(::grpc::StatusCode statusCode, const std::string& err) const = delete;
 
+    AsyncStreamWriter* writer{nullptr};   // Producer mode stream writer
+    uint64_t generation{0};               // Generation of the call (see AsyncStreamWriter)
     StreamStatus streamStatus = STREAMING;
     mutable bool streamHasMore = true;    // Are there more responses to stream?
+    mutable bool isProducer = false;      // Is GetWriter() called?
     mutable void* streamParam = nullptr;  // Request-specific stream data (for derived class to use)
 
     template<typename RPC_SERVICE, typename REQ, typename RESP>
@@ -115,12 +236,14 @@ private:
 };
 
 //
-// Class ClientStreamContext is sent to client stream process function
+// Class ClientStreamContext is sent to client stream process function.
+// The next request isn't read until the process function returns, or until
+// the context is resumed if the process function defers it (see Defer()).
 //
 class ClientStreamContext : public Context
 {
 public:
-    ClientStreamContext(const void* param) : Context(param) {}
+    ClientStreamContext(const void* param, DeferredCall* call = nullptr) : Context(param, call) {}
     ~ClientStreamContext() = default;
 
     bool GetHasMore() const { return streamHasMore; }
@@ -136,6 +259,194 @@ private:
     friend struct ClientStreamRequestContext;
 };
 
+//
+// Class BidiStreamContext is sent to bidirectional stream process function.
+// Reads and writes are independent: the process function is called for every
+// request read, and writes responses with Write() whenever it has them, either
+// from the process function or from any other thread.
+//
+class BidiStreamContext : public Context
+{
+public:
+    BidiStreamContext(const void* param, AsyncStreamWriter* writer_, uint64_t generation_)
+        : Context(param), writer(writer_), generation(generation_) {}
+    ~BidiStreamContext() = default;
+
+    StreamStatus GetStreamStatus() const { return streamStatus; }
+
+    // Are there more requests to read? Once the client is done writing,
+    // the process function is called one more time with GetHasMore() false.
+    bool GetHasMore() const { return streamHasMore; }
+
+    void  SetParam(void* param) const { streamParam = param; }
+    void* GetParam() const { return streamParam; }
+
+    // Queue a response to be written to the stream. Return false if the stream
+    // is closed or the queue is full (see StreamWriter).
+    // Note: The context must not be used once the process function is called
+    // with a stream status other than STREAMING. Use GetWriter() to write
+    // responses from other threads.
+    bool Write(const google::protobuf::Message& resp) const { return GetWriter().Write(resp); }
+
+    // Finish the stream once all the queued responses are written.
+    // Note: The stream stays open until EndOfStream() is called or a write fails,
+    // even if the client is done writing (GetHasMore() is false).
+    void EndOfStream(::grpc::StatusCode statusCode = grpc::OK, const std::string& err = "") const
+    {
+        GetWriter().Finish(statusCode, err);
+    }
+
+    // Get a handle to write responses from any thread. The onDrain callback
+    // (if any) replaces the one set by a previous GetWriter() call.
+    StreamWriter GetWriter(std::function<void()> onDrain) const
+    {
+        writer->SetOnDrain(generation, std::move(onDrain));
+        return StreamWriter(writer, generation);
+    }
+
+    StreamWriter GetWriter() const { return StreamWriter(writer, generation); }
+
+private:
+    // Prevent from calling Context::SetStatus, force to use EndOfStream instead
+    void SetStatus(::grpc::StatusCode statusCode, const std::string& err) const = delete;
+
+    AsyncStreamWriter* writer{nullptr};
+    uint64_t generation{0};               // Generation of the call (see AsyncStreamWriter)
+    StreamStatus streamStatus = STREAMING;
+    bool streamHasMore = true;            // Are there more requests to read?
+    mutable void* streamParam = nullptr;  // Request-specific stream data (for derived class to use)
+
+    template<typename RPC_SERVICE, typename REQ, typename RESP>
+    friend struct BidiStreamRequestContext;
+};
+
+//
+// Class GenericContext is sent to generic process function (see GrpcGenericService).
+// Note: grpc::GenericServerContext can't be derived from, so the context owns it.
+//
+class GenericContext
+{
+public:
+    GenericContext(const void* param, DeferredCall* call = nullptr) : rpcParam(param), deferredCall(call) {}
+    ~GenericContext() = default;
+
+    // Full name of the method called, e.g. "/test.Hello/Ping"
+    const std::string& GetMethod() const { return serverContext.method(); }
+    const std::string& GetHost() const { return serverContext.host(); }
+
+    const ::grpc::Status& GetStatus() const { return grpcStatus; }
+
+    void SetStatus(::grpc::StatusCode statusCode, const std::string& err) const
+    {
+        // Note: Ignore err if status is grpc::OK (see Context::SetStatus())
+        if(statusCode != grpc::OK)
+            grpcStatus = ::grpc::Status(statusCode, err);
+        else
+            grpcStatus = ::grpc::Status::OK;
+    }
+
+    void SetMetadata(const char* key, const std::string& value)
+    {
+        serverContext.AddTrailingMetadata(key, value);
+    }
+
+    std::string GetMetadata(const char* key) const
+    {
+        ::grpc::string_ref value = GetMetadataRef(key);
+        return std::string(value.data(), value.size());
+    }
+
+    // Get the value of a client metadata key without copying it (see Context::GetMetadataRef())
+    ::grpc::string_ref GetMetadataRef(const char* key) const
+    {
+        const std::multimap<::grpc::string_ref, ::grpc::string_ref>& metadata = serverContext.client_metadata();
+        if(auto itr = metadata.find(key); itr != metadata.end())
+            return itr->second;
+        return {};
+    }
+
+    std::string Peer() const { return UnescapePeer(serverContext.peer()); }
+
+    // Get application-level data set by GrpcGenericService::Bind()
+    const void* GetRpcParam() const { return rpcParam; }
+
+    // Defer the response until Resume() is called (see Context::Defer())
+    bool Defer() const
+    {
+        if(!deferredCall)
+            return false;
+        deferredCall->Defer();
+        return true;
+    }
+
+    void Resume() const
+    {
+        if(deferredCall)
+            deferredCall->Resume();
+    }
+
+    const ::grpc::GenericServerContext& GetServerContext() const { return serverContext; }
+
+private:
+    ::grpc::GenericServerContext serverContext;
+    const void* rpcParam{nullptr};
+    DeferredCall* deferredCall{nullptr};
+    mutable ::grpc::Status grpcStatus{::grpc::Status::OK};
+
+    friend struct GenericRequestContext;
+};
+
+//
+// Helper function to parse a raw message (e.g. the request of a generic call)
+// only when it's needed. The buffer is left as is: its data isn't copied.
+//
+inline bool ParseMessage(const ::grpc::ByteBuffer& buffer, google::protobuf::Message& msg)
+{
+    ::grpc::ByteBuffer copy(buffer);    // Note: Deserialize() consumes the buffer
+    return ::grpc::SerializationTraits<google::protobuf::Message>::Deserialize(&copy, &msg).ok();
+}
+
+//
+// Helper functions to make the key of a call out of the values of the given
+// metadata keys and the request, e.g. to find the calls with identical requests.
+// Note: The metadata values are prefixed with their size, so a key can't be
+// mistaken for another one.
+//
+inline void AppendCallKey(std::string& key, const ::grpc::ServerContextBase& ctx,
+                          const std::vector<std::string>& metadataKeys)
+{
+    const std::multimap<::grpc::string_ref, ::grpc::string_ref>& metadata = ctx.client_metadata();
+    for(const std::string& metadataKey : metadataKeys)
+    {
+        uint32_t size = 0;
+        auto itr = metadata.find(metadataKey);
+        if(itr != metadata.end())
+            size = (uint32_t)itr->second.size();
+
+        key.append(reinterpret_cast<const char*>(&size), sizeof(size));
+        if(size > 0)
+            key.append(itr->second.data(), size);
+    }
+}
+
+inline void AppendCallKey(std::string& key, const google::protobuf::Message& req)
+{
+    // Note: Serialize map fields in a deterministic order
+    google::protobuf::io::StringOutputStream stream(&key);
+    google::protobuf::io::CodedOutputStream output(&stream);
+    output.SetSerializationDeterministic(true);
+    req.SerializePartialToCodedStream(&output);
+    output.Trim();
+}
+
+inline void AppendCallKey(std::string& key, const ::grpc::ByteBuffer& req)
+{
+    std::vector<::grpc::Slice> slices;
+    req.Dump(&slices);
+    for(const ::grpc::Slice& slice : slices)
+        key.append(reinterpret_cast<const char*>(slice.begin()), slice.size());
+}
+
 } //namespace gen
 
 #endif // __GRPC_CONTEXT_HPP__
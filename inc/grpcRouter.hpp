@@ -6,12 +6,21 @@
 #define __GRPC_ROUTER_HPP__
 
 #include "grpcContext.hpp"      // gen::Context & gen::ServerStreamContext
-#include "grpcClient.hpp"       // gen::GrpcClient
+#include "grpcClient.hpp"       // gen::GrpcClient & gen::AnyService
 #include "pipe.hpp"             // gen::Pipe
+#include "targetPicker.hpp"     // gen::TargetPicker
+#include "retryPolicy.hpp"      // gen::RetryPolicy
+#include <atomic>               // std::atomic
+#include <random>               // std::minstd_rand
 #include <sstream>              // stringstream
+#include <type_traits>          // std::is_invocable_v
+#include <unordered_map>        // std::unordered_map
 
 namespace gen {
 
+template <typename GRPC_SERVICE>
+class GrpcAsyncForwarder;
+
 //
 // Helper class to forward UNARY/STREAM a destination gRpc service
 //
@@ -19,54 +28,162 @@ template <typename GRPC_SERVICE>
 class GrpcRouter
 {
 public:
-    GrpcRouter() = default;
+    // Note: The calls to every target go through a circuit breaker with the default
+    // options (see CircuitBreaker). Use GetTargetClient(index).SetCircuitBreaker()
+    // to set another one, or to disable it.
+    GrpcRouter() { mTargetClient.SetCircuitBreaker(std::make_shared<CircuitBreaker>()); }
     virtual ~GrpcRouter() = default;
 
     GrpcRouter(const std::string& targetHost, unsigned short targetPort,
                const std::shared_ptr<grpc::ChannelCredentials>& creds = nullptr,
                const grpc::ChannelArguments* channelArgs = nullptr)
-        : mTargetClient(targetHost, targetPort, creds, channelArgs) {}
+        : mTargetClient(targetHost, targetPort, creds, channelArgs)
+    {
+        mTargetClient.SetCircuitBreaker(std::make_shared<CircuitBreaker>());
+    }
 
     GrpcRouter(const std::string& targetAddressUri,
                const std::shared_ptr<grpc::ChannelCredentials>& creds = nullptr,
                const grpc::ChannelArguments* channelArgs = nullptr)
-        : mTargetClient(targetAddressUri, creds, channelArgs) {}
+        : mTargetClient(targetAddressUri, creds, channelArgs)
+    {
+        mTargetClient.SetCircuitBreaker(std::make_shared<CircuitBreaker>());
+    }
 
     bool Init(const std::string& host, unsigned short port,
               const std::shared_ptr<grpc::ChannelCredentials>& creds = nullptr,
               const grpc::ChannelArguments* channelArgs = nullptr)
     {
-        return mTargetClient.Init(host, port, creds, channelArgs);
+        return Init(FormatDnsAddressUri(host, port), creds, channelArgs);
     }
 
     bool Init(const std::string& addressUriIn,
               const std::shared_ptr<grpc::ChannelCredentials>& creds = nullptr,
               const grpc::ChannelArguments* channelArgs = nullptr)
     {
-        return mTargetClient.Init(addressUriIn, creds, channelArgs);
+        bool isValid = mTargetClient.Init(addressUriIn, creds, channelArgs);
+        UpdateTargets();
+        return isValid;
+    }
+
+    // Add another target (backend) to forward the calls to. The target of every call
+    // is then picked by the target picker (see SetTargetPicker()), round-robin by default.
+    // Note: The target set and the picker must be set before the router forwards any call.
+    bool AddTarget(const std::string& host, unsigned short port,
+                   const std::shared_ptr<grpc::ChannelCredentials>& creds = nullptr,
+                   const grpc::ChannelArguments* channelArgs = nullptr)
+    {
+        return AddTarget(FormatDnsAddressUri(host, port), creds, channelArgs);
+    }
+
+    bool AddTarget(const std::string& addressUri,
+                   const std::shared_ptr<grpc::ChannelCredentials>& creds = nullptr,
+                   const grpc::ChannelArguments* channelArgs = nullptr);
+
+    // Set the picker of the target of every call (e.g. RingHashPicker)
+    void SetTargetPicker(const std::shared_ptr<TargetPicker>& picker)
+    {
+        mPicker = picker;
+        if(mPicker && mProber)
+            mPicker->SetProber(mProber);
+        UpdateTargets();
     }
+    const std::shared_ptr<TargetPicker>& GetTargetPicker() const { return mPicker; }
 
-    // Forward unary request
+    // Forward unary request.
+    // Note: If grpcStubFunc is the PrepareAsync stub function (e.g. &Stub::PrepareAsyncPing),
+    // then the request is forwarded asynchronously (see GrpcUnaryForwarder), so
+    // the server thread doesn't wait for the response. The request is then hedged
+    // with the hedging policy of the RPC, if any (see HedgingPolicy).
     template <typename GRPC_STUB_FUNC, typename REQ, typename RESP>
     void Forward(const gen::Context& ctx,
-                 const REQ& req, RESP& resp, GRPC_STUB_FUNC grpcStubFunc);
+                 const REQ& req, RESP& resp, GRPC_STUB_FUNC grpcStubFunc,
+                 const std::shared_ptr<HedgingPolicy>& hedging = nullptr)
+    {
+        ForwardUnary(ctx, req, resp, grpcStubFunc, hedging, nullptr);
+    }
+
+    // Forward unary request of an idempotent RPC, and retry it once the target call
+    // fails with a transient error (see RetryPolicy).
+    // Note: Use the PrepareAsync stub function (e.g. &Stub::PrepareAsyncPing).
+    template <typename GRPC_STUB_FUNC, typename REQ, typename RESP>
+    void Forward(const gen::Context& ctx,
+                 const REQ& req, RESP& resp, GRPC_STUB_FUNC grpcStubFunc,
+                 const std::shared_ptr<RetryPolicy>& retry)
+    {
+        static_assert(std::is_invocable_v<GRPC_STUB_FUNC, typename GRPC_SERVICE::Stub*,
+                                          grpc::ClientContext*, const REQ&, grpc::CompletionQueue*>,
+                      "Retried calls are forwarded with the PrepareAsync stub function");
+        ForwardUnary(ctx, req, resp, grpcStubFunc, nullptr, retry);
+    }
 
     // Forward server-side stream of requests
+    // Note: If grpcStubFunc is the PrepareAsync stub function (e.g. &Stub::PrepareAsyncServerStream),
+    // then the stream is forwarded asynchronously (see GrpcServerStreamForwarder),
+    // instead of with a thread per stream (GrpcAsyncStreamReader) or by blocking
+    // the server thread (GrpcSyncStreamReader).
     template <typename GRPC_STUB_FUNC, typename REQ, typename RESP>
     void Forward(const gen::ServerStreamContext& ctx,
                  const REQ& req, RESP& resp, GRPC_STUB_FUNC grpcStubFunc);
 
-    // Forward client-side stream of requests
+    // Forward client-side stream of requests.
+    // Note: Use the PrepareAsync stub function (e.g. &Stub::PrepareAsyncClientStream),
+    // the stream is forwarded asynchronously (see GrpcClientStreamForwarder).
     template <typename GRPC_STUB_FUNC, typename REQ, typename RESP>
     void Forward(const gen::ClientStreamContext& ctx,
                  const REQ& req, RESP& resp, GRPC_STUB_FUNC grpcStubFunc);
 
+    // Forward a generic call without parsing the request and the response (passthrough):
+    // the raw messages are passed between the client and the target service, and the
+    // method called (see GenericContext::GetMethod()) is called on the target as is.
+    // The call is forwarded asynchronously (see GrpcGenericForwarder), and retried once
+    // the target call fails with a transient error, if it has a retry policy.
+    // Note: Use GrpcRouter<gen::AnyService> to forward the methods of any service.
+    // Only pass a retry policy for the idempotent methods (see GenericContext::GetMethod()).
+    void Forward(const gen::GenericContext& ctx,
+                 const grpc::ByteBuffer& req, grpc::ByteBuffer& resp,
+                 const std::shared_ptr<RetryPolicy>& retry = nullptr);
+
     // Check the overall status
-    bool IsValid() const { return mTargetClient.IsValid(); }
+    bool IsValid() const
+    {
+        return std::all_of(mTargets.begin(), mTargets.end(),
+                           [](GrpcClient<GRPC_SERVICE>* target) { return target->IsValid(); });
+    }
 
-    // Get contained GrpcClient object
+    // Get contained GrpcClient object (the first target)
     GrpcClient<GRPC_SERVICE>& GetTargetClient() { return mTargetClient; }
 
+    // Get the GrpcClient object of a target (see AddTarget())
+    GrpcClient<GRPC_SERVICE>& GetTargetClient(size_t index) { return *mTargets[index]; }
+    size_t GetTargetCount() const { return mTargets.size(); }
+
+    // Get the index of the target to forward a call to
+    size_t PickTarget(const grpc::ServerContextBase& ctx)
+    {
+        if(mTargets.size() == 1 || !mPicker)
+            return 0;
+        size_t index = mPicker->Pick(ctx, mTargets.size());
+        return (index < mTargets.size() ? index : 0);
+    }
+
+    // Get the index of the target to send the hedge of a call to: Another target than
+    // the one of the call if there is more than one, so one slow target doesn't set
+    // the latency of the call (see HedgingPolicy).
+    size_t PickHedgeTarget(const grpc::ServerContextBase& ctx, size_t target)
+    {
+        if(mTargets.size() == 1)
+            return target;
+        size_t index = PickTarget(ctx);
+        return (index != target ? index : (target + 1) % mTargets.size());
+    }
+
+    // Send a probe call to a target before it's readmitted once it has been ejected by
+    // the picker (see PowerOfTwoPicker). The target is readmitted once the probe succeeds.
+    // Note: Use a cheap unary RPC with its PrepareAsync stub function (e.g. &Stub::PrepareAsyncPing).
+    template <typename GRPC_STUB_FUNC, typename REQ>
+    void SetProbe(GRPC_STUB_FUNC grpcStubFunc, const REQ& req, unsigned long timeoutMs = 1000);
+
     // Set Async or Sync forwarding method
     void SetAsyncForward(bool asyncForward) { mAsyncForward = asyncForward; }
     bool GetAsyncForward() { return mAsyncForward; }
@@ -75,6 +192,46 @@ public:
     void SetUnaryTimeout(unsigned long timeoutMs) { mUnaryTimeoutMs = timeoutMs; }
     unsigned long GetUnaryTimeout() { return mUnaryTimeoutMs; }
 
+    // Coalesce identical concurrent unary calls (singleflight): a call with the same
+    // request and the same values of the given metadata keys as a call still in flight
+    // to the target service doesn't call the target, but gets the response and the
+    // status of that call once it completes. The shared target call doesn't take the
+    // deadline or the cancellation of any of its clients: It has the unary timeout.
+    // Note: Only unary calls forwarded asynchronously are coalesced, and only for the
+    // RPCs the descriptors tell apart (see FindUnaryMethod()), so only enable it for
+    // routers of services whose unary RPCs are idempotent.
+    void SetCoalescing(bool coalesce, const std::vector<std::string>& metadataKeys = {})
+    {
+        mCoalesce = coalesce;
+        mCoalesceMetadataKeys = metadataKeys;
+    }
+    bool GetCoalescing() { return mCoalesce; }
+
+    // Only forward the client metadata with the given keys (and the keys that start with
+    // the prefixes of the list, e.g. "x-trace-*") to the target service (see GetMetadata()).
+    // The list is compiled once, so set it before the first call. An empty list (the
+    // default) forwards all the client metadata.
+    void SetMetadataAllowList(const std::vector<std::string>& allowList) { mMetadataFilter = MetadataFilter(allowList); }
+
+    // Mirror a sampled share (sampleRate, 0 to 1) of the unary calls forwarded asynchronously
+    // to a shadow target (e.g. a new build of the target service), fire-and-forget: the shadow
+    // responses are dropped, and their status and latency are only reported (see
+    // OnShadowCallEnd()), so the shadow target never affects the client calls.
+    // Note: At most maxInFlight shadow calls are in flight, the calls sampled beyond that
+    // aren't mirrored, so a slow shadow target can't take up the router memory. The shadow
+    // calls have their own completion queue threads (see GetShadowClient()).
+    // The shadow target must be set before the router forwards any call.
+    bool SetShadowTarget(const std::string& addressUri, double sampleRate, unsigned maxInFlight = 100,
+                         const std::shared_ptr<grpc::ChannelCredentials>& creds = nullptr,
+                         const grpc::ChannelArguments* channelArgs = nullptr);
+
+    // Get the GrpcClient object of the shadow target (null if there is none)
+    GrpcClient<GRPC_SERVICE>* GetShadowClient() { return mShadowClient.get(); }
+
+    uint64_t GetShadowCalls() const { return mShadowCalls; }
+    uint64_t GetShadowFailures() const { return mShadowFailures; }
+    uint64_t GetShadowDropped() const { return mShadowDropped; }
+
     // Enable/Disable Info logging
     void SetVerbose(bool verbose) { mVerbose = verbose; }
     bool GetVerbose() { return mVerbose; }
@@ -87,9 +244,49 @@ protected:
     virtual void OnCallEnd(const gen::Context& /*ctx*/, const void* /*callParam*/) { /**/ }
     virtual void OnEndOfStream(const gen::Context& /*ctx*/, const void* /*callParam*/) { /**/ }
 
+    // Call Begin/End notification of generic calls (passthrough).
+    // Note: The request isn't parsed. Use gen::ParseMessage() if it's needed.
+    virtual ::grpc::Status OnCallBegin(const gen::GenericContext& /*ctx*/, const grpc::ByteBuffer& /*req*/,
+                                       const void** /*callParam*/) { return ::grpc::Status::OK; }
+    virtual void OnCallEnd(const gen::GenericContext& /*ctx*/, const void* /*callParam*/) { /**/ }
+
+    // Outcome of a call mirrored to the shadow target (see SetShadowTarget()).
+    // Note: Called on a shadow completion queue thread, once the client call has ended.
+    virtual void OnShadowCallEnd(const ::grpc::Status& /*status*/, std::chrono::microseconds /*latency*/) { /**/ }
+
+    // Helper to mirror a call to the shadow target (see SetShadowTarget()).
+    // prepare creates the reader of the call: (Stub*, ClientContext*, CompletionQueue*) -> reader
+    template <typename PREPARE>
+    void Mirror(const grpc::ServerContextBase& ctx, unsigned long timeout, const void* callParam, PREPARE&& prepare);
+
+    // Helper to forward unary request
+    template <typename GRPC_STUB_FUNC, typename REQ, typename RESP>
+    void ForwardUnary(const gen::Context& ctx,
+                      const REQ& req, RESP& resp, GRPC_STUB_FUNC grpcStubFunc,
+                      const std::shared_ptr<HedgingPolicy>& hedging,
+                      const std::shared_ptr<RetryPolicy>& retry);
+
+    // Helpers to forward server-side stream of requests
+    template <typename GRPC_STUB_FUNC, typename REQ, typename RESP>
+    void ForwardSync(const gen::ServerStreamContext& ctx,
+                     const REQ& req, RESP& resp, GRPC_STUB_FUNC grpcStubFunc);
+
+    template <typename GRPC_STUB_FUNC, typename REQ, typename RESP>
+    void ForwardAsync(const gen::ServerStreamContext& ctx,
+                      const REQ& req, RESP& resp, GRPC_STUB_FUNC grpcStubFunc);
+
+    // Status code to end a client call with once the target call fails:
+    // UNAVAILABLE (e.g. the circuit breaker is open) is passed on, so the
+    // client knows it can retry, and any other error is INTERNAL.
+    static ::grpc::StatusCode GetErrorCode(const ::grpc::Status& s)
+    {
+        return (s.error_code() == ::grpc::UNAVAILABLE ? ::grpc::UNAVAILABLE : ::grpc::INTERNAL);
+    }
+
     // Helper method to get client metadata
-    virtual void GetMetadata(const grpc::ServerContext& ctx,
-                             std::map<std::string, std::string>& metadata,
+    // Note: The metadata refers to the client metadata of ctx (nothing is copied)
+    virtual void GetMetadata(const grpc::ServerContextBase& ctx,
+                             MetadataView& metadata,
                              const void* callParam) const;
 
     // Helper method to format status message
@@ -97,26 +294,85 @@ protected:
                                         const ::grpc::Status& status,
                                         const void* callParam) const;
 
+    // Helper method to format status message of generic calls
+    virtual std::string FormatStatusMsg(const gen::GenericContext& ctx,
+                                        const ::grpc::Status& status,
+                                        const void* callParam) const;
+
     // For derived class to override (Error and Info reporting)
     virtual void OnError(const char* fname, int lineNum, const std::string& err,
                          const void* callParam) const;
     virtual void OnInfo(const char* fname, int lineNum, const std::string& info,
                         const void* callParam) const;
 
+    // Let the picker know the addresses of the targets
+    void UpdateTargets();
+
+    // Let the picker know the calls forwarded to the targets
+    void OnTargetCallStart(size_t target)
+    {
+        if(mPicker)
+            mPicker->OnCallStart(target);
+    }
+
+    void OnTargetCallEnd(size_t target, const ::grpc::Status& s, std::chrono::microseconds latency)
+    {
+        if(mPicker)
+            mPicker->OnCallEnd(target, s.error_code(), latency);
+    }
+
 protected:
     GrpcClient<GRPC_SERVICE> mTargetClient;
+
+    // Targets to forward the calls to (the first one is mTargetClient)
+    std::vector<GrpcClient<GRPC_SERVICE>*> mTargets{ &mTargetClient };
+    std::vector<std::unique_ptr<GrpcClient<GRPC_SERVICE>>> mMoreTargets;
+    std::shared_ptr<TargetPicker> mPicker;
+    TargetPicker::Prober mProber;           // Sends the probe calls (see SetProbe())
+    std::string mTargetsStr;                // Addresses of the targets (for the messages)
     unsigned long mUnaryTimeoutMs{5000};    // 5 seconds timeout (in milliseconds) for unary gRpcs
+    MetadataFilter mMetadataFilter;         // Client metadata forwarded (see SetMetadataAllowList())
     bool mAsyncForward{false};
     bool mVerbose{false};
 
     // Max number or requests in pipe when forwarding is async (mAsyncForward is true)
     unsigned long mPipeCapacity{5};         // Max number or requests in pipe (when
 
+    // Calls in flight to the target service that identical calls can join (see SetCoalescing())
+    bool mCoalesce{false};
+    std::vector<std::string> mCoalesceMetadataKeys;
+    std::mutex mFlightsMtx;
+    std::unordered_map<std::string, GrpcAsyncForwarder<GRPC_SERVICE>*> mFlights;
+
+    // Shadow target the calls are mirrored to (see SetShadowTarget())
+    // Note: The client is declared last, so it's stopped while the counters are still valid
+    double mShadowSampleRate{0};
+    unsigned mShadowMaxInFlight{0};
+    std::atomic<unsigned> mShadowInFlight{0};
+    std::atomic<uint64_t> mShadowCalls{0};
+    std::atomic<uint64_t> mShadowFailures{0};
+    std::atomic<uint64_t> mShadowDropped{0};
+    std::unique_ptr<GrpcClient<GRPC_SERVICE>> mShadowClient;
+
     // Make GrpcAsyncStreamReader & GrpcAsyncStreamReader friends
     template <typename GRPC_SERVICE2, typename GRPC_STUB_FUNC, typename REQ, typename RESP>
     friend class GrpcAsyncStreamReader;
     template <typename GRPC_SERVICE2, typename GRPC_STUB_FUNC, typename REQ, typename RESP>
     friend class GrpcSyncStreamReader;
+
+    // Make the asynchronous forwarders friends
+    template <typename GRPC_SERVICE2>
+    friend class GrpcAsyncForwarder;
+    template <typename GRPC_SERVICE2, typename GRPC_STUB_FUNC, typename REQ, typename RESP>
+    friend class GrpcUnaryForwarder;
+    template <typename GRPC_SERVICE2, typename GRPC_STUB_FUNC, typename REQ, typename RESP>
+    friend class GrpcServerStreamForwarder;
+    template <typename GRPC_SERVICE2, typename GRPC_STUB_FUNC, typename REQ, typename RESP>
+    friend class GrpcClientStreamForwarder;
+    template <typename GRPC_SERVICE2>
+    friend class GrpcGenericForwarder;
+    template <typename GRPC_SERVICE2, typename RESP>
+    friend class GrpcShadowCall;
 };
 
 //
@@ -171,23 +427,24 @@ public:
                 return !mStop;
             };
 
-            // Copy client metadata from a ServerContext
-            std::map<std::string, std::string> metadata;
+            // Get client metadata from a ServerContext
+            MetadataView metadata;
             mRouter->GetMetadata(ctx, metadata, mCallParam);
             std::string errMsg;
 
-            GrpcClient<GRPC_SERVICE>& grpcClient = mRouter->GetTargetClient();
-            if(!grpcClient.CallStream(grpcStubFunc, req, respCallback, metadata, errMsg))
+            size_t target = mRouter->PickTarget(ctx);
+            GrpcClient<GRPC_SERVICE>& grpcClient = mRouter->GetTargetClient(target);
+            mRouter->OnTargetCallStart(target);
+            StatusEx s = grpcClient.CallStream(grpcStubFunc, req, respCallback, metadata, errMsg);
+            mRouter->OnTargetCallEnd(target, s, std::chrono::microseconds(0));
+            if(!s)
             {
                 // std::cerr << errMsg << std::endl;
                 // Empty the pipe and cause Pop() to return (it anyone waiting)
                 mPipe.Clear();
-                mStatus = { ::grpc::INTERNAL, errMsg };
+                mStatus = { mRouter->GetErrorCode(s), errMsg };
                 errMsg = mRouter->FormatStatusMsg(req, mStatus, mCallParam);
                 mRouter->OnError(__FNAME__, __LINE__, errMsg, mCallParam);
-
-                // Reset the channel to avoid gRPC's internal handling of broken connections
-                grpcClient.Reset();
             }
             else
             {
@@ -236,23 +493,26 @@ class GrpcSyncStreamReader final : public GrpcStreamReader<GRPC_SERVICE, GRPC_ST
 {
 public:
     GrpcSyncStreamReader(GrpcRouter<GRPC_SERVICE>* router, const void* callParam)
-        : GrpcStreamReader<GRPC_SERVICE, GRPC_STUB_FUNC, REQ, RESP>(router, callParam),
-          mGrpcClient(router->GetTargetClient()) {}
+        : GrpcStreamReader<GRPC_SERVICE, GRPC_STUB_FUNC, REQ, RESP>(router, callParam) {}
     virtual ~GrpcSyncStreamReader() = default;
 
     virtual void Call(const gen::ServerStreamContext& ctx,
                       const REQ& req, GRPC_STUB_FUNC grpcStubFunc) override
     {
-        // Copy client metadata from a ServerContext
-        std::map<std::string, std::string> metadata;
+        // Get client metadata from a ServerContext
+        MetadataView metadata;
         mRouter->GetMetadata(ctx, metadata, mCallParam);
 
         // Create client stream reader
         std::string errMsg;
-        mGrpcClient.CreateContext(mClientContext, metadata, 0);
-        if(!mGrpcClient.GetStream(grpcStubFunc, req, mReader, mClientContext, errMsg))
+        mTarget = mRouter->PickTarget(ctx);
+        mGrpcClient = &mRouter->GetTargetClient(mTarget);
+        mGrpcClient->CreateContext(mClientContext, metadata, 0);
+        mRouter->OnTargetCallStart(mTarget);
+        if(StatusEx s = mGrpcClient->GetStream(grpcStubFunc, req, mReader, mClientContext, mTicket, errMsg); !s)
         {
-            mStatus = { ::grpc::INTERNAL, errMsg };
+            mRouter->OnTargetCallEnd(mTarget, s, std::chrono::microseconds(0));
+            mStatus = { mRouter->GetErrorCode(s), errMsg };
             errMsg = mRouter->FormatStatusMsg(req, mStatus, mCallParam);
             mRouter->OnError(__FNAME__, __LINE__, errMsg, mCallParam);
         }
@@ -267,16 +527,16 @@ public:
             return true;
 
         // Read() returned false, done reading
-        if(grpc::Status s = mReader->Finish(); !s.ok())
+        grpc::Status s = mReader->Finish();
+        mGrpcClient->OnCallDone(s, mTicket);
+        mRouter->OnTargetCallEnd(mTarget, s, std::chrono::microseconds(0));
+        if(!s.ok())
         {
             std::string errMsg;
-            mGrpcClient.FormatStatusMsg(errMsg, __func__, REQ(), s);
-            mStatus = { ::grpc::INTERNAL, errMsg };
+            mGrpcClient->FormatStatusMsg(errMsg, __func__, REQ(), s);
+            mStatus = { mRouter->GetErrorCode(s), errMsg };
             errMsg = mRouter->FormatStatusMsg(REQ(), mStatus, mCallParam);
             mRouter->OnError(__FNAME__, __LINE__, errMsg, mCallParam);
-
-            // Reset the channel to avoid gRPC's internal handling of broken connections
-            mGrpcClient.Reset();
         }
         else
         {
@@ -298,7 +558,9 @@ public:
                 ;
             std::string errMsg;
             grpc::Status s = mReader->Finish();
-            mGrpcClient.FormatStatusMsg(errMsg, __func__, REQ(), s);
+            mGrpcClient->OnCallDone(s, mTicket);
+            mRouter->OnTargetCallEnd(mTarget, s, std::chrono::microseconds(0));
+            mGrpcClient->FormatStatusMsg(errMsg, __func__, REQ(), s);
             mStatus = { ::grpc::INTERNAL, errMsg };
             errMsg = mRouter->FormatStatusMsg(REQ(), mStatus, mCallParam);
             mRouter->OnError(__FNAME__, __LINE__, errMsg, mCallParam);
@@ -312,186 +574,1569 @@ private:
     using GrpcStreamReader<GRPC_SERVICE, GRPC_STUB_FUNC, REQ, RESP>::mCallParam;
 
     // Class members
-    GrpcClient<GRPC_SERVICE>& mGrpcClient;
+    size_t mTarget{0};                      // Target of the stream
+    GrpcClient<GRPC_SERVICE>* mGrpcClient{nullptr};
+    CircuitBreaker::Ticket mTicket{0};      // Circuit breaker ticket of the stream
     grpc::ClientContext mClientContext;
     std::unique_ptr<grpc::ClientReader<RESP>> mReader;
 };
 
 //
-// Forward unary request
+// Base class of the helpers that forward a call to the target service
+// asynchronously, driven by the target client completion queue threads (see
+// GrpcClient::GetCompletionQueue()), so no thread is dedicated to a call and
+// no server thread waits for the target.
+// Note: A forwarder deletes itself once the call ends and nothing holds it.
 //
 template <typename GRPC_SERVICE>
-template <typename GRPC_STUB_FUNC, typename REQ, typename RESP>
-void GrpcRouter<GRPC_SERVICE>::Forward(const gen::Context& ctx,
-                                       const REQ& req, RESP& resp, GRPC_STUB_FUNC grpcStubFunc)
+class GrpcAsyncForwarder : public AsyncClientOp
 {
-    // Send CallBegin notification.
-    const void* callParam = nullptr;
-    ::grpc::Status s = OnCallBegin(ctx, &callParam);
-    if(!s.ok())
+public:
+    const void* GetCallParam() const { return mCallParam; }
+
+protected:
+    GrpcAsyncForwarder(GrpcRouter<GRPC_SERVICE>* router, const grpc::ServerContextBase& ctx, const void* callParam)
+        : mRouter(router), mTargetIndex(router->PickTarget(ctx)), mTarget(&router->GetTargetClient(mTargetIndex)),
+          mServerContext(ctx), mCallParam(callParam) {}
+
+    // Report a target call that hasn't started or hasn't completed (see OnCallDone())
+    ~GrpcAsyncForwarder() override
     {
-        ctx.SetStatus(s.error_code(), s.error_message());
-        std::string err = FormatStatusMsg(req, ctx.GetStatus(), callParam);
-        OnError(__FNAME__, __LINE__, err, callParam);
-        OnCallEnd(ctx, callParam);  // Send CallEnd notification
-        return;
+        if(mIsCounted || mIsAllowed)
+        {
+            if(mStatus.ok())
+                mStatus = { ::grpc::CANCELLED, "The target call hasn't completed" };
+            OnCallDone();
+        }
     }
 
-    // Check for Deadline Expiration.
-    // Get the Deadline (std::chrono::time_point) and calculate the remaining time.
-    std::chrono::time_point<std::chrono::system_clock> deadline = ctx.deadline();
-    auto remainingTime = deadline - std::chrono::system_clock::now();
+    // Create the context of the target call and get the queue to start it on.
+    // Note: The deadline and the cancellation of the client call are propagated
+    // to the target call (e.g. it's cancelled when the server shuts down), unless
+    // other calls can join it (see NewClientContext()).
+    ::grpc::Status CreateContext(grpc::CompletionQueue*& cq, unsigned long timeout = 0)
+    {
+        GrpcClient<GRPC_SERVICE>& grpcClient = *mTarget;
+        if(mStub = grpcClient.GetStub(); !mStub)
+            return { ::grpc::INTERNAL, "Invalid (null) gRpc service stub" };
+
+        if(cq = grpcClient.GetCompletionQueue(); !cq)
+            return { ::grpc::INTERNAL, "Failed to start client completion queue threads" };
+
+        // Note: The outcome of the target call is reported with OnCallDone()
+        mRouter->OnTargetCallStart(mTargetIndex);
+        mIsCounted = true;
+        mStartTime = std::chrono::steady_clock::now();
+        if(mStatus = grpcClient.AllowCall(mTicket); !mStatus.ok())
+            return mStatus;
+        mIsAllowed = true;
+
+        // Note: The retries share the deadline of the first attempt
+        mClientContext = NewClientContext(*mTarget, timeout);
+        if(mAttempts > 1)
+            mClientContext->set_deadline(mDeadline);
+        else
+            mDeadline = mClientContext->deadline();
+        mCq = cq;
+        return ::grpc::Status::OK;
+    }
 
-    if(remainingTime <= std::chrono::milliseconds(0))
+    // Create the context of an attempt of the target call.
+    // Note: The calls that have joined this one must not fail because the client that
+    // started it is cancelled, so a coalesced call doesn't propagate the client call.
+    std::unique_ptr<grpc::ClientContext> NewClientContext(GrpcClient<GRPC_SERVICE>& target, unsigned long timeout) const
     {
-        ctx.SetStatus(::grpc::DEADLINE_EXCEEDED, "Request already past deadline");
-        std::string err = FormatStatusMsg(req, ctx.GetStatus(), callParam);
-        OnError(__FNAME__, __LINE__, err, callParam);
-        OnCallEnd(ctx, callParam);  // Send CallEnd notification
-        return;
+        std::unique_ptr<grpc::ClientContext> context = (mFlightKey ? std::make_unique<grpc::ClientContext>() :
+                                                        grpc::ClientContext::FromServerContext(mServerContext));
+        MetadataView metadata;
+        mRouter->GetMetadata(mServerContext, metadata, mCallParam);
+        target.CreateContext(*context, metadata, timeout);
+        return context;
     }
 
-    // Limit forward timeout not to exceed mUnaryTimeoutMs
-    unsigned long timeout = std::chrono::duration_cast<std::chrono::milliseconds>(remainingTime).count();
-    if(timeout > mUnaryTimeoutMs)
-        timeout = mUnaryTimeoutMs;
+    // Report the failure of the target call (mStatus).
+    // Return the status to end the client call with.
+    ::grpc::Status OnCallFailed(const char* fname, const google::protobuf::Message& req)
+    {
+        std::string errMsg;
+        mTarget->FormatStatusMsg(errMsg, fname, req, mStatus);
+        ::grpc::Status s(mRouter->GetErrorCode(mStatus), errMsg);
+        errMsg = mRouter->FormatStatusMsg(req, s, mCallParam);
+        mRouter->OnError(__FNAME__, __LINE__, errMsg, mCallParam);
+        return s;
+    }
 
-    // Copy client metadata from a ServerContext
-    std::map<std::string, std::string> metadata;
-    GetMetadata(ctx, metadata, callParam);
+    void OnCallSucceeded(const google::protobuf::Message& req)
+    {
+        if(mRouter->GetVerbose())
+        {
+            std::string info = mRouter->FormatStatusMsg(req, mStatus, mCallParam);
+            mRouter->OnInfo(__FNAME__, __LINE__, info, mCallParam);
+        }
+    }
 
-    // Call Grpc Service
-    std::string errMsg;
-    if(!mTargetClient.Call(grpcStubFunc, req, resp, metadata, errMsg, timeout))
+    // Report the outcome of the target call to the circuit breaker and to the picker.
+    // Note: The latency of the calls is only tracked for unary calls.
+    void OnCallDone(bool isUnary = false)
     {
-        // Reset the channel to avoid gRPC's internal handling of broken connections
-        mTargetClient.Reset();
-        ctx.SetStatus(::grpc::INTERNAL, errMsg);
-        std::string err = FormatStatusMsg(req, ctx.GetStatus(), callParam);
-        OnError(__FNAME__, __LINE__, err, callParam);
+        if(mIsAllowed)
+            mTarget->OnCallDone(mStatus, mTicket);
+
+        if(mIsCounted)
+        {
+            std::chrono::microseconds latency(0);
+            if(isUnary)
+                latency = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - mStartTime);
+            mRouter->OnTargetCallEnd(mTargetIndex, mStatus, latency);
+        }
+        mIsCounted = mIsAllowed = false;
+    }
+
+    // Retry the failed target call after a backoff, if its retry policy allows it
+    // (see RetryPolicy) and the backoff ends before the deadline of the call.
+    // Once the backoff ends, OnEvent() is called and IsBackingOff() is true.
+    bool ScheduleRetry()
+    {
+        if(!mRetry || !mCq)
+            return false;
+
+        std::chrono::system_clock::time_point retryTime =
+                std::chrono::system_clock::now() + mRetry->GetBackoff(mAttempts);
+        if(retryTime >= mDeadline || !mRetry->TryRetry(mStatus.error_code(), mAttempts))
+            return false;
+
+        if(!mAlarm && !(mAlarm = std::unique_ptr<grpc::Alarm>(new (std::nothrow) grpc::Alarm)))
+            return false;
+
+        mAttempts++;
+        mIsBackingOff = true;
+        mAlarm->Set(mCq, retryTime, this);
+        return true;
     }
-    else if(mVerbose)
+
+    bool IsBackingOff() const { return mIsBackingOff; }
+
+    // Create the context of the retry once the backoff has ended.
+    // Note: The target is picked again, so the retry can go to another target.
+    ::grpc::Status CreateRetryContext(grpc::CompletionQueue*& cq)
     {
-        std::string info = FormatStatusMsg(req, ctx.GetStatus(), callParam);
-        OnInfo(__FNAME__, __LINE__, info, callParam);
+        mIsBackingOff = false;
+        mTargetIndex = mRouter->PickTarget(mServerContext);
+        mTarget = &mRouter->GetTargetClient(mTargetIndex);
+        return CreateContext(cq);
     }
 
-    OnCallEnd(ctx, callParam);  // Send CallEnd notification
-}
+    // Delete the forwarder once nothing holds it anymore
+    void Release()
+    {
+        if(--mRefs == 0)
+            delete this;
+    }
+
+    // Let identical calls join this one until it completes (see GrpcRouter::SetCoalescing()).
+    // Note: Called with GrpcRouter::mFlightsMtx locked
+    void StartFlight(std::string&& key)
+    {
+        mFlightKey = &mRouter->mFlights.emplace(std::move(key), this).first->first;
+    }
+
+    // Stop calls from joining this one.
+    // Note: Once it's done, no other thread touches the calls that have joined.
+    void EndFlight()
+    {
+        if(mFlightKey)
+        {
+            std::unique_lock<std::mutex> lock(mRouter->mFlightsMtx);
+            mRouter->mFlights.erase(*mFlightKey);
+            mFlightKey = nullptr;
+        }
+    }
+
+    GrpcRouter<GRPC_SERVICE>* mRouter{nullptr};
+    size_t mTargetIndex;                // Target the call is forwarded to (see GrpcRouter::PickTarget())
+    GrpcClient<GRPC_SERVICE>* mTarget;
+    const grpc::ServerContextBase& mServerContext;
+    const void* mCallParam{nullptr};    // Any void* parameter set by client for this call
+
+    std::shared_ptr<typename GRPC_SERVICE::Stub> mStub;
+    std::unique_ptr<grpc::ClientContext> mClientContext;
+    ::grpc::Status mStatus;             // Target call status
+    std::atomic<int> mRefs{1};          // The call holds the forwarder until it ends
+    std::chrono::steady_clock::time_point mStartTime;
+    bool mIsCounted{false};             // Has the picker been told about the target call?
+    bool mIsAllowed{false};             // Has the circuit breaker let the target call through?
+    CircuitBreaker::Ticket mTicket{0};  // Circuit breaker ticket of the target call
+    const std::string* mFlightKey{nullptr}; // Key of the call in flight (if calls can join it)
+
+    // Retries of the target call (see ScheduleRetry())
+    std::shared_ptr<RetryPolicy> mRetry;
+    unsigned mAttempts{1};
+    std::chrono::system_clock::time_point mDeadline;    // Deadline of all the attempts
+    grpc::CompletionQueue* mCq{nullptr};
+    std::unique_ptr<grpc::Alarm> mAlarm;
+    bool mIsBackingOff{false};
+
+    friend class GrpcRouter<GRPC_SERVICE>;
+};
 
 //
-// Forward server-side stream of requests
+// Helper class to forward a unary request asynchronously.
+// The response is sent once the target responds (see Context::Defer()).
 //
-template <typename GRPC_SERVICE>
-template <typename GRPC_STUB_FUNC, typename REQ, typename RESP>
-void GrpcRouter<GRPC_SERVICE>::Forward(const gen::ServerStreamContext& ctx,
-                                       const REQ& req, RESP& resp, GRPC_STUB_FUNC grpcStubFunc)
+template <typename GRPC_SERVICE, typename GRPC_STUB_FUNC, typename REQ, typename RESP>
+class GrpcUnaryForwarder final : public GrpcAsyncForwarder<GRPC_SERVICE>
 {
-    // Start or continue streaming
-    auto reader = (GrpcStreamReader<GRPC_SERVICE, GRPC_STUB_FUNC, REQ, RESP>*)ctx.GetParam();
+public:
+    GrpcUnaryForwarder(GrpcRouter<GRPC_SERVICE>* router, const gen::Context& ctx, const void* callParam)
+        : GrpcAsyncForwarder<GRPC_SERVICE>(router, ctx, callParam), mCtx(ctx) {}
 
-    // Are we done?
-    if(ctx.GetStreamStatus() == gen::StreamStatus::SUCCESS ||
-       ctx.GetStreamStatus() == gen::StreamStatus::ERROR)
+    // Call the target service.
+    // Note: The forwarder deletes itself once the call ends, unless it fails to start.
+    ::grpc::Status Call(GRPC_STUB_FUNC grpcStubFunc, const REQ& req, RESP& resp, unsigned long timeout,
+                        const std::shared_ptr<HedgingPolicy>& hedging, const std::shared_ptr<RetryPolicy>& retry)
     {
-        // Clean up...
-        if(reader)
+        grpc::CompletionQueue* cq = nullptr;
+        if(::grpc::Status s = this->CreateContext(cq, timeout); !s.ok())
+            return s;
+
+        if(hedging)
+            return CallHedged(grpcStubFunc, req, resp, cq, hedging);
+
+        mStubFunc = grpcStubFunc;
+        mReq = &req;
+        mResp = &resp;
+        if(::grpc::Status s = PrepareCall(cq); !s.ok())
+            return s;
+
+        if(mRetry = retry; mRetry)
+            mRetry->OnCall();
+
+        // Note: The response can arrive (and resume the call) on another
+        // thread before we return, so hold the forwarder until then
+        mRefs++;
+        mCtx.Defer();
+        StartCall();
+        this->Release();
+        return ::grpc::Status::OK;
+    }
+
+    // Call the target service with hedged attempts (see GrpcHedgedCall).
+    // Note: The hedged call ends the call with OnEvent() once it's done.
+    ::grpc::Status CallHedged(GRPC_STUB_FUNC grpcStubFunc, const REQ& req, RESP& resp,
+                              grpc::CompletionQueue* cq, const std::shared_ptr<HedgingPolicy>& hedging)
+    {
+        // Create the context of the hedge, and take the stub of another target (if any).
+        // Note: All the attempts share the deadline of the call. The outcome of the call
+        // is reported to the target of the first attempt.
+        std::chrono::system_clock::time_point deadline = mClientContext->deadline();
+        auto newHedge = [this, deadline](std::shared_ptr<typename GRPC_SERVICE::Stub>& stub)
         {
-            reader->Stop(); // Note: Stop() does nothing if the reader is already complete
-            OnCallEnd(ctx, reader->GetCallParam());  // Send CallEnd notification
-            delete reader;
-        }
-        reader = nullptr;
-        ctx.SetParam(nullptr);
+            size_t targetIndex = mRouter->PickHedgeTarget(this->mServerContext, this->mTargetIndex);
+            GrpcClient<GRPC_SERVICE>& target = mRouter->GetTargetClient(targetIndex);
+            if(std::shared_ptr<typename GRPC_SERVICE::Stub> next = target.GetStub(); next)
+                stub = next;
+
+            std::unique_ptr<grpc::ClientContext> context = this->NewClientContext(target, 0);
+            context->set_deadline(deadline);
+            return context;
+        };
+
+        using HedgedCall = GrpcHedgedCall<GRPC_SERVICE, GRPC_STUB_FUNC, REQ, RESP>;
+        HedgedCall* call = new (std::nothrow) HedgedCall(mStub, cq, grpcStubFunc, req, resp, hedging, newHedge,
+                                                         [this](const ::grpc::Status& s) { mStatus = s; OnEvent(true); });
+        if(!call)
+            return { ::grpc::INTERNAL, "Out of memory while allocating GrpcHedgedCall" };
+
+        mReq = &req;
+        mResp = &resp;
+        mRefs++;
+        mCtx.Defer();
+        call->Start(std::move(mClientContext));
+        this->Release();
+        return ::grpc::Status::OK;
     }
-    else
+
+    // Wait for the response of this call instead of calling the target
+    // (see GrpcRouter::SetCoalescing()).
+    // Note: Called with GrpcRouter::mFlightsMtx locked
+    void Join(const gen::Context& ctx, RESP& resp, const void* callParam)
     {
-        // Start or continue streaming
-        if(!reader)
+        ctx.Defer();
+        mWaiters.push_back({ &ctx, &resp, callParam });
+    }
+
+    // Send the response and the status of this call to the calls that have joined it
+    void ResumeWaiters(const ::grpc::Status& s)
+    {
+        this->EndFlight();
+        for(const Waiter& waiter : mWaiters)
         {
-            // Send CallBegin notification.
-            const void* callParam = nullptr;
-            ::grpc::Status s = OnCallBegin(ctx, &callParam);
             if(s.ok())
-            {
-                // Create GrpcStreamReader.
-                if(mAsyncForward)
-                    reader = new (std::nothrow) GrpcAsyncStreamReader<GRPC_SERVICE, GRPC_STUB_FUNC, REQ, RESP>(this, callParam, mPipeCapacity);
-                else
-                    reader = new (std::nothrow) GrpcSyncStreamReader<GRPC_SERVICE, GRPC_STUB_FUNC, REQ, RESP>(this, callParam);
+                waiter.resp->CopyFrom(*mResp);
+            else
+                waiter.ctx->SetStatus(s.error_code(), s.error_message());
 
-                if(!reader)
-                    s = { ::grpc::INTERNAL, "Out of memory while allocating GrpcAsyncStreamReader" };
-            }
+            mRouter->OnCallEnd(*waiter.ctx, waiter.callParam);  // Send CallEnd notification
+            waiter.ctx->Resume();
+        }
+        mWaiters.clear();
+    }
 
-            if(!s.ok())
+    // AsyncClientOp implementation
+    void OnEvent(bool /*ok*/) override
+    {
+        if(this->IsBackingOff())
+        {
+            // Retry the target call
+            grpc::CompletionQueue* cq = nullptr;
+            if(mStatus = this->CreateRetryContext(cq); mStatus.ok())
             {
-                ctx.EndOfStream(s.error_code(), s.error_message());
-                std::string err = FormatStatusMsg(req, ctx.GetStatus(), callParam);
-                OnError(__FNAME__, __LINE__, err, callParam);
-                OnEndOfStream(ctx, callParam);  // Send EndOfStream notification
-
-                // Since we don't have a reader, we have no place to keep callParam.
-                // Let's send CallEnd notification now while we still have callParam.
-                OnCallEnd(ctx, callParam);  // Send CallEnd notification
-                return;
+                if(mStatus = PrepareCall(cq); mStatus.ok())
+                {
+                    mResp->Clear();
+                    StartCall();
+                    return;
+                }
             }
-
-            ctx.SetParam(reader);
-            reader->Call(ctx, req, grpcStubFunc);
         }
-
-        // Get data to send
-        if(reader->Read(resp))
+        else
         {
-            // We read some data, send it and come back for more
+            this->OnCallDone(true);
+            if(!mStatus.ok() && this->ScheduleRetry())
+                return;
         }
-        else if(!reader->IsValid())
+
+        if(!mStatus.ok())
         {
-            const ::grpc::Status& s = reader->GetStatus();
-            ctx.EndOfStream(s.error_code(), s.error_message());
-            OnEndOfStream(ctx, reader->GetCallParam());  // Send EndOfStream notification
+            ::grpc::Status s = this->OnCallFailed("Call", *mReq);
+            mCtx.SetStatus(s.error_code(), s.error_message());
         }
         else
         {
-            ctx.EndOfStream(); // No more data to send
-            if(mVerbose)
-            {
-                std::string info = FormatStatusMsg(req, ctx.GetStatus(), reader->GetCallParam());
-                OnInfo(__FNAME__, __LINE__, info, reader->GetCallParam());
-            }
-            OnEndOfStream(ctx, reader->GetCallParam());  // Send EndOfStream notification
+            this->OnCallSucceeded(*mReq);
         }
+
+        // Note: The response must be copied before the call is resumed
+        ResumeWaiters(mCtx.GetStatus());
+
+        mRouter->OnCallEnd(mCtx, mCallParam);  // Send CallEnd notification
+
+        // Note: The call must not be touched once it's resumed
+        mCtx.Resume();
+        this->Release();
     }
-}
 
-//
-// Forward client-side stream of requests
-//
-template <typename GRPC_SERVICE>
-template <typename GRPC_STUB_FUNC, typename REQ, typename RESP>
-void GrpcRouter<GRPC_SERVICE>::Forward(const gen::ClientStreamContext& ctx,
-                                       const REQ& req, RESP& resp, GRPC_STUB_FUNC grpcStubFunc)
-{
-    ctx.SetStatus(::grpc::INTERNAL, "Not Implemented Yet");
-}
+private:
+    // Create the reader of an attempt of the target call
+    ::grpc::Status PrepareCall(grpc::CompletionQueue* cq)
+    {
+        mReader = (mStub.get()->*mStubFunc)(mClientContext.get(), *mReq, cq);
+        if(!mReader)
+            return { ::grpc::INTERNAL, "Invalid (null) client response reader" };
+        return ::grpc::Status::OK;
+    }
+
+    void StartCall()
+    {
+        mReader->StartCall();
+        mReader->Finish(mResp, &mStatus, this);
+    }
+
+    // Bring base class members into derived (this) class's scope
+    using GrpcAsyncForwarder<GRPC_SERVICE>::mRouter;
+    using GrpcAsyncForwarder<GRPC_SERVICE>::mCallParam;
+    using GrpcAsyncForwarder<GRPC_SERVICE>::mStub;
+    using GrpcAsyncForwarder<GRPC_SERVICE>::mClientContext;
+    using GrpcAsyncForwarder<GRPC_SERVICE>::mStatus;
+    using GrpcAsyncForwarder<GRPC_SERVICE>::mRefs;
+    using GrpcAsyncForwarder<GRPC_SERVICE>::mRetry;
+
+    const gen::Context& mCtx;
+    GRPC_STUB_FUNC mStubFunc{nullptr};
+    const REQ* mReq{nullptr};
+    RESP* mResp{nullptr};
+    std::unique_ptr<grpc::ClientAsyncResponseReader<RESP>> mReader;
+
+    // Calls waiting for the response of this one
+    struct Waiter { const gen::Context* ctx; RESP* resp; const void* callParam; };
+    std::vector<Waiter> mWaiters;
+};
 
 //
-// For derived class to override (Error and Info reporting)
+// Helper class to forward a generic call asynchronously with the raw messages
+// (see GrpcRouter::Forward(const gen::GenericContext&, ...)).
+// The response is sent once the target responds (see GenericContext::Defer()).
 //
 template <typename GRPC_SERVICE>
-void GrpcRouter<GRPC_SERVICE>::OnError(const char* fname, int lineNum, const std::string& err,
-                                       const void* /*callParam*/) const
+class GrpcGenericForwarder final : public GrpcAsyncForwarder<GRPC_SERVICE>
 {
-    std::cout << "ERROR: " << fname << ":" << lineNum << " " << err << std::endl;
-}
+public:
+    GrpcGenericForwarder(GrpcRouter<GRPC_SERVICE>* router, const gen::GenericContext& ctx, const void* callParam)
+        : GrpcAsyncForwarder<GRPC_SERVICE>(router, ctx.GetServerContext(), callParam), mCtx(ctx) {}
 
-template <typename GRPC_SERVICE>
-void GrpcRouter<GRPC_SERVICE>::OnInfo(const char* fname, int lineNum, const std::string& info,
-                                      const void* /*callParam*/) const
-{
-    std::cout << "INFO: " << fname << ":" << lineNum << " " << info << std::endl;
-}
+    // Call the target service.
+    // Note: The forwarder deletes itself once the call ends, unless it fails to start.
+    ::grpc::Status Call(const grpc::ByteBuffer& req, grpc::ByteBuffer& resp, unsigned long timeout,
+                        const std::shared_ptr<RetryPolicy>& retry)
+    {
+        grpc::CompletionQueue* cq = nullptr;
+        if(::grpc::Status s = this->CreateContext(cq, timeout); !s.ok())
+            return s;
+
+        mReq = &req;
+        mResp = &resp;
+        if(::grpc::Status s = PrepareCall(cq); !s.ok())
+            return s;
+
+        if(mRetry = retry; mRetry)
+            mRetry->OnCall();
+
+        // Note: The response can arrive (and resume the call) on another
+        // thread before we return, so hold the forwarder until then
+        mRefs++;
+        mCtx.Defer();
+        StartCall();
+        this->Release();
+        return ::grpc::Status::OK;
+    }
+
+    // Wait for the response of this call instead of calling the target
+    // (see GrpcRouter::SetCoalescing()).
+    // Note: Called with GrpcRouter::mFlightsMtx locked
+    void Join(const gen::GenericContext& ctx, grpc::ByteBuffer& resp, const void* callParam)
+    {
+        ctx.Defer();
+        mWaiters.push_back({ &ctx, &resp, callParam });
+    }
+
+    // Send the response and the status of this call to the calls that have joined it
+    void ResumeWaiters(const ::grpc::Status& s)
+    {
+        this->EndFlight();
+        for(const Waiter& waiter : mWaiters)
+        {
+            if(s.ok())
+                *waiter.resp = *mResp;  // Note: The message data isn't copied
+            else
+                waiter.ctx->SetStatus(s.error_code(), s.error_message());
+
+            mRouter->OnCallEnd(*waiter.ctx, waiter.callParam);  // Send CallEnd notification
+            waiter.ctx->Resume();
+        }
+        mWaiters.clear();
+    }
+
+    // AsyncClientOp implementation
+    void OnEvent(bool /*ok*/) override
+    {
+        if(this->IsBackingOff())
+        {
+            // Retry the target call
+            grpc::CompletionQueue* cq = nullptr;
+            if(mStatus = this->CreateRetryContext(cq); mStatus.ok())
+            {
+                if(mStatus = PrepareCall(cq); mStatus.ok())
+                {
+                    mResp->Clear();
+                    StartCall();
+                    return;
+                }
+            }
+        }
+        else
+        {
+            this->OnCallDone(true);
+            if(!mStatus.ok() && this->ScheduleRetry())
+                return;
+        }
+
+        if(!mStatus.ok())
+        {
+            std::string errMsg = mRouter->FormatStatusMsg(mCtx, mStatus, mCallParam);
+            mRouter->OnError(__FNAME__, __LINE__, errMsg, mCallParam);
+            mCtx.SetStatus(mRouter->GetErrorCode(mStatus), errMsg);
+        }
+        else if(mRouter->GetVerbose())
+        {
+            std::string info = mRouter->FormatStatusMsg(mCtx, mStatus, mCallParam);
+            mRouter->OnInfo(__FNAME__, __LINE__, info, mCallParam);
+        }
+
+        // Note: The response must be copied before the call is resumed
+        ResumeWaiters(mCtx.GetStatus());
+
+        mRouter->OnCallEnd(mCtx, mCallParam);  // Send CallEnd notification
+
+        // Note: The call must not be touched once it's resumed
+        mCtx.Resume();
+        this->Release();
+    }
+
+private:
+    // Create the reader of an attempt of the target call
+    ::grpc::Status PrepareCall(grpc::CompletionQueue* cq)
+    {
+        mReader = mStub->PrepareUnaryCall(mClientContext.get(), mCtx.GetMethod(), *mReq, cq);
+        if(!mReader)
+            return { ::grpc::INTERNAL, "Invalid (null) client response reader" };
+        return ::grpc::Status::OK;
+    }
+
+    void StartCall()
+    {
+        mReader->StartCall();
+        mReader->Finish(mResp, &mStatus, this);
+    }
+
+    // Bring base class members into derived (this) class's scope
+    using GrpcAsyncForwarder<GRPC_SERVICE>::mRouter;
+    using GrpcAsyncForwarder<GRPC_SERVICE>::mCallParam;
+    using GrpcAsyncForwarder<GRPC_SERVICE>::mStub;
+    using GrpcAsyncForwarder<GRPC_SERVICE>::mClientContext;
+    using GrpcAsyncForwarder<GRPC_SERVICE>::mStatus;
+    using GrpcAsyncForwarder<GRPC_SERVICE>::mRefs;
+    using GrpcAsyncForwarder<GRPC_SERVICE>::mRetry;
+
+    const gen::GenericContext& mCtx;
+    const grpc::ByteBuffer* mReq{nullptr};
+    grpc::ByteBuffer* mResp{nullptr};
+    std::unique_ptr<grpc::GenericClientAsyncResponseReader> mReader;
+
+    // Calls waiting for the response of this one
+    struct Waiter { const gen::GenericContext* ctx; grpc::ByteBuffer* resp; const void* callParam; };
+    std::vector<Waiter> mWaiters;
+};
+
+//
+// Helper class to forward a server-side stream asynchronously.
+// The client stream is switched to producer mode (see ServerStreamContext::GetWriter())
+// and every target response is written to it as soon as it's read. Once the client
+// stream queue is full, reading the target stream waits for the queue to drain.
+// Note: The forwarder is held by both streams, and guarded by the mutex, since
+// the client stream and the target stream complete on different threads.
+//
+template <typename GRPC_SERVICE, typename GRPC_STUB_FUNC, typename REQ, typename RESP>
+class GrpcServerStreamForwarder final : public GrpcAsyncForwarder<GRPC_SERVICE>
+{
+public:
+    GrpcServerStreamForwarder(GrpcRouter<GRPC_SERVICE>* router, const gen::ServerStreamContext& ctx,
+                              const void* callParam)
+        : GrpcAsyncForwarder<GRPC_SERVICE>(router, ctx, callParam), mCtx(ctx) {}
+
+    // Start the target stream.
+    // Note: The forwarder deletes itself once both streams end, unless it fails to start.
+    ::grpc::Status Call(GRPC_STUB_FUNC grpcStubFunc, const REQ& req)
+    {
+        grpc::CompletionQueue* cq = nullptr;
+        if(::grpc::Status s = this->CreateContext(cq); !s.ok())
+            return s;
+
+        mReader = (mStub.get()->*grpcStubFunc)(mClientContext.get(), req, cq);
+        if(!mReader)
+            return { ::grpc::INTERNAL, "Invalid (null) client stream reader" };
+
+        mWriter = mCtx.GetWriter([this]() { OnDrain(); });
+
+        std::unique_lock<std::mutex> lock(mMtx);
+        mRefs++;
+        mState = START;
+        mReader->StartCall(this);
+        return ::grpc::Status::OK;
+    }
+
+    // The client stream has ended (the process function is called with its final status)
+    void OnStreamEnd()
+    {
+        {
+            std::unique_lock<std::mutex> lock(mMtx);
+            mStreamEnded = true;
+            if(mState != DONE)
+            {
+                // Stop the target stream
+                mClientContext->TryCancel();
+                if(mState == PAUSED)
+                    Finish();
+            }
+        }
+
+        mRouter->OnCallEnd(mCtx, mCallParam);  // Send CallEnd notification
+        this->Release();
+    }
+
+    // AsyncClientOp implementation
+    void OnEvent(bool ok) override
+    {
+        std::unique_lock<std::mutex> lock(mMtx);
+        switch(mState)
+        {
+        case START:
+        case READ:
+            if(ok && !mStreamEnded)
+            {
+                if(mState == START)
+                    Read();
+                else
+                    Relay();
+            }
+            else
+            {
+                Finish();   // The target stream is done, get its status
+            }
+            break;
+
+        case FINISH:
+            mState = DONE;
+            this->OnCallDone();
+            if(!mStreamEnded)
+            {
+                if(!mStatus.ok())
+                {
+                    ::grpc::Status s = this->OnCallFailed("CallStream", REQ());
+                    mWriter.Finish(s.error_code(), s.error_message());
+                }
+                else
+                {
+                    this->OnCallSucceeded(REQ());
+                    mWriter.Finish();
+                }
+                mRouter->OnEndOfStream(mCtx, mCallParam);  // Send EndOfStream notification
+            }
+            lock.unlock();
+            this->Release();
+            break;
+
+        default:
+            break;
+        }
+    }
+
+private:
+    // Helpers (called with the mutex locked)
+    void Read()
+    {
+        mState = READ;
+        mResp.Clear();
+        mReader->Read(&mResp, this);
+    }
+
+    void Finish()
+    {
+        mState = FINISH;
+        mReader->Finish(&mStatus, this);
+    }
+
+    // Write the target response to the client stream and read the next one
+    void Relay()
+    {
+        if(mWriter.Write(mResp))
+        {
+            Read();
+        }
+        else if(mWriter.IsClosed())
+        {
+            mClientContext->TryCancel();
+            Finish();
+        }
+        else
+        {
+            mState = PAUSED;    // Wait for the client stream queue to drain
+        }
+    }
+
+    // The client stream queue has drained (called on the server thread)
+    void OnDrain()
+    {
+        std::unique_lock<std::mutex> lock(mMtx);
+        if(mState == PAUSED && !mStreamEnded)
+            Relay();
+    }
+
+    // Bring base class members into derived (this) class's scope
+    using GrpcAsyncForwarder<GRPC_SERVICE>::mRouter;
+    using GrpcAsyncForwarder<GRPC_SERVICE>::mCallParam;
+    using GrpcAsyncForwarder<GRPC_SERVICE>::mStub;
+    using GrpcAsyncForwarder<GRPC_SERVICE>::mClientContext;
+    using GrpcAsyncForwarder<GRPC_SERVICE>::mStatus;
+    using GrpcAsyncForwarder<GRPC_SERVICE>::mRefs;
+
+    const gen::ServerStreamContext& mCtx;
+    gen::StreamWriter mWriter;          // Client stream (not used once it has ended)
+    std::unique_ptr<grpc::ClientAsyncReader<RESP>> mReader;
+    RESP mResp;                         // Target response being read or relayed
+
+    std::mutex mMtx;
+    enum : char { NONE=0, START, READ, PAUSED, FINISH, DONE } mState{NONE};
+    bool mStreamEnded{false};           // Has the client stream ended?
+};
+
+//
+// Helper class to forward a client-side stream of requests asynchronously.
+// Every request is written to the target before the next one is read (see
+// Context::Defer()), so the client is flow-controlled by the target.
+// Note: There is at most one operation in flight at a time.
+//
+template <typename GRPC_SERVICE, typename GRPC_STUB_FUNC, typename REQ, typename RESP>
+class GrpcClientStreamForwarder final : public GrpcAsyncForwarder<GRPC_SERVICE>
+{
+public:
+    GrpcClientStreamForwarder(GrpcRouter<GRPC_SERVICE>* router, const gen::ClientStreamContext& ctx,
+                              const void* callParam)
+        : GrpcAsyncForwarder<GRPC_SERVICE>(router, ctx, callParam), mCtx(ctx) {}
+
+    // Create the target stream
+    ::grpc::Status Call(GRPC_STUB_FUNC grpcStubFunc)
+    {
+        grpc::CompletionQueue* cq = nullptr;
+        if(::grpc::Status s = this->CreateContext(cq); !s.ok())
+            return s;
+
+        mWriter = (mStub.get()->*grpcStubFunc)(mClientContext.get(), &mResp, cq);
+        if(!mWriter)
+            return { ::grpc::INTERNAL, "Invalid (null) client stream writer" };
+
+        return ::grpc::Status::OK;
+    }
+
+    // Forward the request, or finish the target stream once the client is
+    // done writing. Reading the next request is deferred until it's done.
+    void Forward(const REQ& req, RESP& resp)
+    {
+        // Has the target already responded? Then drop the rest of the stream.
+        if(mState == DONE)
+        {
+            if(!mCtx.GetHasMore())
+            {
+                resp.Swap(&mResp);
+                End();
+                this->Release();
+            }
+            return;
+        }
+
+        // Note: The operation can complete (and resume the call) on another
+        // thread before we return, so hold the forwarder until then
+        mRefs++;
+        mReq = &req;
+        mDownstreamResp = &resp;
+        mHasMore = mCtx.GetHasMore();
+        mCtx.Defer();
+
+        if(mState == NONE)
+        {
+            mState = START;
+            mWriter->StartCall(this);
+        }
+        else
+        {
+            Next();
+        }
+        this->Release();
+    }
+
+    // AsyncClientOp implementation
+    void OnEvent(bool ok) override
+    {
+        switch(mState)
+        {
+        case START:
+            if(ok)
+                Next();
+            else
+                Finish();   // The stream is broken, get its status
+            break;
+
+        case WRITE:
+            if(ok)
+                mCtx.Resume();
+            else
+                Finish();   // The stream is broken, get its status
+            break;
+
+        case WRITES_DONE:
+            Finish();
+            break;
+
+        case FINISH:
+            OnFinishDone();
+            break;
+
+        default:
+            break;
+        }
+    }
+
+private:
+    void Next()
+    {
+        if(mHasMore)
+        {
+            mState = WRITE;
+            mWriter->Write(*mReq, this);
+        }
+        else
+        {
+            mState = WRITES_DONE;
+            mWriter->WritesDone(this);
+        }
+    }
+
+    void Finish()
+    {
+        mState = FINISH;
+        mWriter->Finish(&mStatus, this);
+    }
+
+    // Completion of Finish(): the target response and status are known.
+    // Note: If the target responds before the end of the stream, then the
+    // call ends once the client is done writing (see Forward()).
+    void OnFinishDone()
+    {
+        mState = DONE;
+        this->OnCallDone();
+        bool isEnded = true;
+        if(!mStatus.ok())
+        {
+            ::grpc::Status s = this->OnCallFailed("CallClientStream", REQ());
+            mCtx.SetStatus(s.error_code(), s.error_message());
+            End();
+        }
+        else if(!mHasMore)
+        {
+            mDownstreamResp->Swap(&mResp);
+            End();
+        }
+        else
+        {
+            isEnded = false;
+        }
+
+        // Note: The call must not be touched once it's resumed
+        mCtx.Resume();
+        if(isEnded)
+            this->Release();
+    }
+
+    void End()
+    {
+        if(mStatus.ok())
+            this->OnCallSucceeded(REQ());
+        mRouter->OnCallEnd(mCtx, mCallParam);  // Send CallEnd notification
+        mCtx.SetParam(nullptr);
+    }
+
+    // Bring base class members into derived (this) class's scope
+    using GrpcAsyncForwarder<GRPC_SERVICE>::mRouter;
+    using GrpcAsyncForwarder<GRPC_SERVICE>::mCallParam;
+    using GrpcAsyncForwarder<GRPC_SERVICE>::mStub;
+    using GrpcAsyncForwarder<GRPC_SERVICE>::mClientContext;
+    using GrpcAsyncForwarder<GRPC_SERVICE>::mStatus;
+    using GrpcAsyncForwarder<GRPC_SERVICE>::mRefs;
+
+    const gen::ClientStreamContext& mCtx;
+    std::unique_ptr<grpc::ClientAsyncWriter<REQ>> mWriter;
+    RESP mResp;                         // Target response
+
+    const REQ* mReq{nullptr};           // Request being forwarded
+    RESP* mDownstreamResp{nullptr};     // Response to the client
+    bool mHasMore{true};                // Are there more requests to forward?
+    enum : char { NONE=0, START, WRITE, WRITES_DONE, FINISH, DONE } mState{NONE};
+};
+
+// Response type of an asynchronous unary call reader
+template <typename READER>
+struct ResponseOf;
+
+template <typename RESP>
+struct ResponseOf<grpc::ClientAsyncResponseReader<RESP>> { using type = RESP; };
+
+//
+// Helper class of a probe call to a target (see GrpcRouter::SetProbe()).
+// Note: The probe holds the picker, so its outcome can be reported even if the
+// router is being destroyed while the probe is still in flight.
+//
+template <typename GRPC_SERVICE, typename RESP>
+class GrpcProbe final : public AsyncClientOp
+{
+public:
+    GrpcProbe(GrpcClient<GRPC_SERVICE>& target, size_t targetIndex, const std::shared_ptr<TargetPicker>& picker)
+        : mTarget(target), mTargetIndex(targetIndex), mPicker(picker) {}
+
+    // Call the target.
+    // Note: The probe deletes itself once it ends (whether it starts or not).
+    template <typename GRPC_STUB_FUNC, typename REQ>
+    void Call(GRPC_STUB_FUNC grpcStubFunc, const REQ& req, unsigned long timeout)
+    {
+        grpc::CompletionQueue* cq = mTarget.GetCompletionQueue();
+        if(mStub = mTarget.GetStub(); !mStub || !cq)
+            return End(false);
+
+        if(!mTarget.AllowCall(mTicket).ok())
+            return End(false);
+
+        mTarget.CreateContext(mClientContext, {}, timeout);
+        mReader = (mStub.get()->*grpcStubFunc)(&mClientContext, req, cq);
+        if(!mReader)
+        {
+            mTarget.OnCallDone({ ::grpc::CANCELLED, "Invalid (null) client response reader" }, mTicket);
+            return End(false);
+        }
+
+        mReader->StartCall();
+        mReader->Finish(&mResp, &mStatus, this);
+    }
+
+    // AsyncClientOp implementation
+    void OnEvent(bool /*ok*/) override
+    {
+        mTarget.OnCallDone(mStatus, mTicket);
+        End(mStatus.ok());
+    }
+
+private:
+    void End(bool ok)
+    {
+        mPicker->OnProbeDone(mTargetIndex, ok);
+        delete this;
+    }
+
+    GrpcClient<GRPC_SERVICE>& mTarget;
+    size_t mTargetIndex;
+    std::shared_ptr<TargetPicker> mPicker;
+
+    std::shared_ptr<typename GRPC_SERVICE::Stub> mStub;
+    grpc::ClientContext mClientContext;
+    std::unique_ptr<grpc::ClientAsyncResponseReader<RESP>> mReader;
+    RESP mResp;
+    ::grpc::Status mStatus;
+    CircuitBreaker::Ticket mTicket{0};
+};
+
+//
+// Helper class of a call mirrored to the shadow target (see GrpcRouter::SetShadowTarget()).
+// Note: The shadow call isn't tied to the client call (its cancellation isn't propagated),
+// so it goes on once the client call has ended.
+//
+template <typename GRPC_SERVICE, typename RESP>
+class GrpcShadowCall final : public AsyncClientOp
+{
+public:
+    GrpcShadowCall(GrpcRouter<GRPC_SERVICE>* router) : mRouter(router), mShadow(*router->mShadowClient) {}
+
+    // Call the shadow target.
+    // Note: The shadow call deletes itself once it completes, unless it fails to start.
+    template <typename PREPARE>
+    bool Call(const grpc::ServerContextBase& ctx, unsigned long timeout, const void* callParam, PREPARE&& prepare)
+    {
+        grpc::CompletionQueue* cq = mShadow.GetCompletionQueue();
+        if(mStub = mShadow.GetStub(); !mStub || !cq)
+            return false;
+
+        if(!mShadow.AllowCall(mTicket).ok())
+            return false;
+
+        MetadataView metadata;
+        mRouter->GetMetadata(ctx, metadata, callParam);
+        mShadow.CreateContext(mClientContext, metadata, timeout);
+        mReader = prepare(mStub.get(), &mClientContext, cq);
+        if(!mReader)
+        {
+            mShadow.OnCallDone({ ::grpc::CANCELLED, "Invalid (null) client response reader" }, mTicket);
+            return false;
+        }
+
+        mStartTime = std::chrono::steady_clock::now();
+        mReader->StartCall();
+        mReader->Finish(&mResp, &mStatus, this);
+        return true;
+    }
+
+    // AsyncClientOp implementation
+    void OnEvent(bool /*ok*/) override
+    {
+        mShadow.OnCallDone(mStatus, mTicket);
+        mRouter->mShadowInFlight--;
+        if(!mStatus.ok())
+            mRouter->mShadowFailures++;
+        mRouter->OnShadowCallEnd(mStatus, std::chrono::duration_cast<std::chrono::microseconds>(
+                                              std::chrono::steady_clock::now() - mStartTime));
+        delete this;
+    }
+
+private:
+    GrpcRouter<GRPC_SERVICE>* mRouter{nullptr};
+    GrpcClient<GRPC_SERVICE>& mShadow;
+
+    std::shared_ptr<typename GRPC_SERVICE::Stub> mStub;
+    grpc::ClientContext mClientContext;
+    std::unique_ptr<grpc::ClientAsyncResponseReader<RESP>> mReader;
+    RESP mResp;
+    ::grpc::Status mStatus;
+    CircuitBreaker::Ticket mTicket{0};
+    std::chrono::steady_clock::time_point mStartTime;
+};
+
+//
+// Set the shadow target the calls are mirrored to
+//
+template <typename GRPC_SERVICE>
+bool GrpcRouter<GRPC_SERVICE>::SetShadowTarget(const std::string& addressUri, double sampleRate, unsigned maxInFlight,
+                                               const std::shared_ptr<grpc::ChannelCredentials>& creds,
+                                               const grpc::ChannelArguments* channelArgs)
+{
+    auto shadowClient = std::make_unique<GrpcClient<GRPC_SERVICE>>();
+    if(!shadowClient->Init(addressUri, creds, channelArgs))
+        return false;
+
+    // Note: A shadow target that is down isn't called until it's back
+    shadowClient->SetCircuitBreaker(std::make_shared<CircuitBreaker>());
+    mShadowClient = std::move(shadowClient);
+    mShadowSampleRate = std::clamp(sampleRate, 0.0, 1.0);
+    mShadowMaxInFlight = maxInFlight;
+    return true;
+}
+
+//
+// Mirror a call to the shadow target
+//
+template <typename GRPC_SERVICE>
+template <typename PREPARE>
+void GrpcRouter<GRPC_SERVICE>::Mirror(const grpc::ServerContextBase& ctx, unsigned long timeout,
+                                      const void* callParam, PREPARE&& prepare)
+{
+    thread_local std::minstd_rand random(std::random_device{}());
+    if(std::uniform_real_distribution<double>(0, 1)(random) >= mShadowSampleRate)
+        return;
+
+    if(++mShadowInFlight > mShadowMaxInFlight)
+    {
+        mShadowInFlight--;
+        mShadowDropped++;
+        return;
+    }
+
+    // The response type of the RPC
+    using Reader = typename std::invoke_result_t<PREPARE, typename GRPC_SERVICE::Stub*,
+                                                 grpc::ClientContext*, grpc::CompletionQueue*>::element_type;
+    using ShadowCall = GrpcShadowCall<GRPC_SERVICE, typename ResponseOf<Reader>::type>;
+
+    ShadowCall* call = new (std::nothrow) ShadowCall(this);
+    if(call && call->Call(ctx, timeout, callParam, prepare))
+    {
+        mShadowCalls++;
+        return;
+    }
+
+    delete call;
+    mShadowInFlight--;
+    mShadowDropped++;
+}
+
+//
+// Send a probe call to the targets before they are readmitted
+//
+template <typename GRPC_SERVICE>
+template <typename GRPC_STUB_FUNC, typename REQ>
+void GrpcRouter<GRPC_SERVICE>::SetProbe(GRPC_STUB_FUNC grpcStubFunc, const REQ& req, unsigned long timeoutMs)
+{
+    static_assert(std::is_invocable_v<GRPC_STUB_FUNC, typename GRPC_SERVICE::Stub*,
+                                      grpc::ClientContext*, const REQ&, grpc::CompletionQueue*>,
+                  "Probe calls are made with the PrepareAsync stub function");
+
+    // The response type of the RPC
+    using Reader = typename std::invoke_result_t<GRPC_STUB_FUNC, typename GRPC_SERVICE::Stub*,
+                                                 grpc::ClientContext*, const REQ&, grpc::CompletionQueue*>::element_type;
+    using RESP = typename ResponseOf<Reader>::type;
+
+    mProber = [this, grpcStubFunc, req, timeoutMs](size_t target)
+    {
+        auto probe = new (std::nothrow) GrpcProbe<GRPC_SERVICE, RESP>(*mTargets[target], target, mPicker);
+        if(probe)
+            probe->Call(grpcStubFunc, req, timeoutMs);
+        else
+            mPicker->OnProbeDone(target, false);
+    };
+
+    if(mPicker)
+        mPicker->SetProber(mProber);
+}
+
+//
+// Forward unary request
+//
+template <typename GRPC_SERVICE>
+template <typename GRPC_STUB_FUNC, typename REQ, typename RESP>
+void GrpcRouter<GRPC_SERVICE>::ForwardUnary(const gen::Context& ctx,
+                                            const REQ& req, RESP& resp, GRPC_STUB_FUNC grpcStubFunc,
+                                            const std::shared_ptr<HedgingPolicy>& hedging,
+                                            const std::shared_ptr<RetryPolicy>& retry)
+{
+    // Send CallBegin notification.
+    const void* callParam = nullptr;
+    ::grpc::Status s = OnCallBegin(ctx, &callParam);
+    if(!s.ok())
+    {
+        ctx.SetStatus(s.error_code(), s.error_message());
+        std::string err = FormatStatusMsg(req, ctx.GetStatus(), callParam);
+        OnError(__FNAME__, __LINE__, err, callParam);
+        OnCallEnd(ctx, callParam);  // Send CallEnd notification
+        return;
+    }
+
+    // Check for Deadline Expiration.
+    // Get the Deadline (std::chrono::time_point) and calculate the remaining time.
+    std::chrono::time_point<std::chrono::system_clock> deadline = ctx.deadline();
+    auto remainingTime = deadline - std::chrono::system_clock::now();
+
+    if(remainingTime <= std::chrono::milliseconds(0))
+    {
+        ctx.SetStatus(::grpc::DEADLINE_EXCEEDED, "Request already past deadline");
+        std::string err = FormatStatusMsg(req, ctx.GetStatus(), callParam);
+        OnError(__FNAME__, __LINE__, err, callParam);
+        OnCallEnd(ctx, callParam);  // Send CallEnd notification
+        return;
+    }
+
+    // Limit forward timeout not to exceed mUnaryTimeoutMs
+    unsigned long timeout = std::chrono::duration_cast<std::chrono::milliseconds>(remainingTime).count();
+    if(timeout > mUnaryTimeoutMs)
+        timeout = mUnaryTimeoutMs;
+
+    if constexpr(std::is_invocable_v<GRPC_STUB_FUNC, typename GRPC_SERVICE::Stub*,
+                                     grpc::ClientContext*, const REQ&, grpc::CompletionQueue*>)
+    {
+        if(mShadowClient)
+        {
+            Mirror(ctx, timeout, callParam,
+                   [&](typename GRPC_SERVICE::Stub* stub, grpc::ClientContext* context, grpc::CompletionQueue* cq)
+                   {
+                       return (stub->*grpcStubFunc)(context, req, cq);
+                   });
+        }
+
+        // Call Grpc Service asynchronously.
+        // Note: The forwarder sends the response and CallEnd notification.
+        using Forwarder = GrpcUnaryForwarder<GRPC_SERVICE, GRPC_STUB_FUNC, REQ, RESP>;
+        Forwarder* forwarder = nullptr;
+        static const std::string method = FindUnaryMethod(GRPC_SERVICE::service_full_name(),
+                                                          REQ::descriptor(), RESP::descriptor());
+        if(mCoalesce && !method.empty())
+        {
+            // Note: The method tells the RPC (and so the forwarder type) apart
+            std::string key(1, 'U');
+            key.append(method).push_back('\0');
+            AppendCallKey(key, ctx, mCoalesceMetadataKeys);
+            AppendCallKey(key, req);
+
+            // Join an identical call in flight, or let identical calls join this one
+            std::unique_lock<std::mutex> lock(mFlightsMtx);
+            if(auto itr = mFlights.find(key); itr != mFlights.end())
+            {
+                static_cast<Forwarder*>(itr->second)->Join(ctx, resp, callParam);
+                return;
+            }
+
+            if(forwarder = new (std::nothrow) Forwarder(this, ctx, callParam); forwarder)
+                forwarder->StartFlight(std::move(key));
+            timeout = mUnaryTimeoutMs;
+        }
+        else
+        {
+            forwarder = new (std::nothrow) Forwarder(this, ctx, callParam);
+        }
+
+        s = (forwarder ? forwarder->Call(grpcStubFunc, req, resp, timeout, hedging, retry) :
+                         ::grpc::Status(::grpc::INTERNAL, "Out of memory while allocating GrpcUnaryForwarder"));
+        if(!s.ok())
+        {
+            if(forwarder)
+                forwarder->ResumeWaiters(s);
+            delete forwarder;
+            ctx.SetStatus(s.error_code(), s.error_message());
+            std::string err = FormatStatusMsg(req, ctx.GetStatus(), callParam);
+            OnError(__FNAME__, __LINE__, err, callParam);
+            OnCallEnd(ctx, callParam);  // Send CallEnd notification
+        }
+    }
+    else
+    {
+        // Get client metadata from a ServerContext
+        MetadataView metadata;
+        GetMetadata(ctx, metadata, callParam);
+
+        // Call Grpc Service
+        std::string errMsg;
+        size_t target = PickTarget(ctx);
+        OnTargetCallStart(target);
+        auto startTime = std::chrono::steady_clock::now();
+        s = mTargets[target]->Call(grpcStubFunc, req, resp, metadata, errMsg, timeout);
+        OnTargetCallEnd(target, s, std::chrono::duration_cast<std::chrono::microseconds>(
+                                       std::chrono::steady_clock::now() - startTime));
+        if(!s.ok())
+        {
+            ctx.SetStatus(GetErrorCode(s), errMsg);
+            std::string err = FormatStatusMsg(req, ctx.GetStatus(), callParam);
+            OnError(__FNAME__, __LINE__, err, callParam);
+        }
+        else if(mVerbose)
+        {
+            std::string info = FormatStatusMsg(req, ctx.GetStatus(), callParam);
+            OnInfo(__FNAME__, __LINE__, info, callParam);
+        }
+
+        OnCallEnd(ctx, callParam);  // Send CallEnd notification
+    }
+}
+
+//
+// Forward server-side stream of requests
+//
+template <typename GRPC_SERVICE>
+template <typename GRPC_STUB_FUNC, typename REQ, typename RESP>
+void GrpcRouter<GRPC_SERVICE>::Forward(const gen::ServerStreamContext& ctx,
+                                       const REQ& req, RESP& resp, GRPC_STUB_FUNC grpcStubFunc)
+{
+    if constexpr(std::is_invocable_v<GRPC_STUB_FUNC, typename GRPC_SERVICE::Stub*,
+                                     grpc::ClientContext*, const REQ&, grpc::CompletionQueue*>)
+        ForwardAsync(ctx, req, resp, grpcStubFunc);
+    else
+        ForwardSync(ctx, req, resp, grpcStubFunc);
+}
+
+//
+// Forward server-side stream of requests with a stream reader
+//
+template <typename GRPC_SERVICE>
+template <typename GRPC_STUB_FUNC, typename REQ, typename RESP>
+void GrpcRouter<GRPC_SERVICE>::ForwardSync(const gen::ServerStreamContext& ctx,
+                                           const REQ& req, RESP& resp, GRPC_STUB_FUNC grpcStubFunc)
+{
+    // Start or continue streaming
+    auto reader = (GrpcStreamReader<GRPC_SERVICE, GRPC_STUB_FUNC, REQ, RESP>*)ctx.GetParam();
+
+    // Are we done?
+    if(ctx.GetStreamStatus() == gen::StreamStatus::SUCCESS ||
+       ctx.GetStreamStatus() == gen::StreamStatus::ERROR)
+    {
+        // Clean up...
+        if(reader)
+        {
+            reader->Stop(); // Note: Stop() does nothing if the reader is already complete
+            OnCallEnd(ctx, reader->GetCallParam());  // Send CallEnd notification
+            delete reader;
+        }
+        reader = nullptr;
+        ctx.SetParam(nullptr);
+    }
+    else
+    {
+        // Start or continue streaming
+        if(!reader)
+        {
+            // Send CallBegin notification.
+            const void* callParam = nullptr;
+            ::grpc::Status s = OnCallBegin(ctx, &callParam);
+            if(s.ok())
+            {
+                // Create GrpcStreamReader.
+                if(mAsyncForward)
+                    reader = new (std::nothrow) GrpcAsyncStreamReader<GRPC_SERVICE, GRPC_STUB_FUNC, REQ, RESP>(this, callParam, mPipeCapacity);
+                else
+                    reader = new (std::nothrow) GrpcSyncStreamReader<GRPC_SERVICE, GRPC_STUB_FUNC, REQ, RESP>(this, callParam);
+
+                if(!reader)
+                    s = { ::grpc::INTERNAL, "Out of memory while allocating GrpcAsyncStreamReader" };
+            }
+
+            if(!s.ok())
+            {
+                ctx.EndOfStream(s.error_code(), s.error_message());
+                std::string err = FormatStatusMsg(req, ctx.GetStatus(), callParam);
+                OnError(__FNAME__, __LINE__, err, callParam);
+                OnEndOfStream(ctx, callParam);  // Send EndOfStream notification
+
+                // Since we don't have a reader, we have no place to keep callParam.
+                // Let's send CallEnd notification now while we still have callParam.
+                OnCallEnd(ctx, callParam);  // Send CallEnd notification
+                return;
+            }
+
+            ctx.SetParam(reader);
+            reader->Call(ctx, req, grpcStubFunc);
+        }
+
+        // Get data to send
+        if(reader->Read(resp))
+        {
+            // We read some data, send it and come back for more
+        }
+        else if(!reader->IsValid())
+        {
+            const ::grpc::Status& s = reader->GetStatus();
+            ctx.EndOfStream(s.error_code(), s.error_message());
+            OnEndOfStream(ctx, reader->GetCallParam());  // Send EndOfStream notification
+        }
+        else
+        {
+            ctx.EndOfStream(); // No more data to send
+            if(mVerbose)
+            {
+                std::string info = FormatStatusMsg(req, ctx.GetStatus(), reader->GetCallParam());
+                OnInfo(__FNAME__, __LINE__, info, reader->GetCallParam());
+            }
+            OnEndOfStream(ctx, reader->GetCallParam());  // Send EndOfStream notification
+        }
+    }
+}
+
+//
+// Forward server-side stream of requests asynchronously
+//
+template <typename GRPC_SERVICE>
+template <typename GRPC_STUB_FUNC, typename REQ, typename RESP>
+void GrpcRouter<GRPC_SERVICE>::ForwardAsync(const gen::ServerStreamContext& ctx,
+                                            const REQ& req, RESP& /*resp*/, GRPC_STUB_FUNC grpcStubFunc)
+{
+    using Forwarder = GrpcServerStreamForwarder<GRPC_SERVICE, GRPC_STUB_FUNC, REQ, RESP>;
+    auto forwarder = (Forwarder*)ctx.GetParam();
+
+    // Are we done? (The stream is in producer mode, so the process
+    // function is only called once more with the final stream status)
+    if(ctx.GetStreamStatus() != gen::StreamStatus::STREAMING)
+    {
+        if(forwarder)
+            forwarder->OnStreamEnd();   // Note: Sends CallEnd notification
+        ctx.SetParam(nullptr);
+        return;
+    }
+
+    // Send CallBegin notification.
+    const void* callParam = nullptr;
+    ::grpc::Status s = OnCallBegin(ctx, &callParam);
+    if(s.ok())
+    {
+        // Start the target stream
+        forwarder = new (std::nothrow) Forwarder(this, ctx, callParam);
+        if(!forwarder)
+        {
+            s = { ::grpc::INTERNAL, "Out of memory while allocating GrpcServerStreamForwarder" };
+        }
+        else if(s = forwarder->Call(grpcStubFunc, req); !s.ok())
+        {
+            delete forwarder;
+            forwarder = nullptr;
+        }
+    }
+
+    if(!s.ok())
+    {
+        ctx.EndOfStream(s.error_code(), s.error_message());
+        std::string err = FormatStatusMsg(req, ctx.GetStatus(), callParam);
+        OnError(__FNAME__, __LINE__, err, callParam);
+        OnEndOfStream(ctx, callParam);  // Send EndOfStream notification
+        OnCallEnd(ctx, callParam);      // Send CallEnd notification
+        return;
+    }
+
+    ctx.SetParam(forwarder);
+}
+
+//
+// Forward client-side stream of requests
+//
+template <typename GRPC_SERVICE>
+template <typename GRPC_STUB_FUNC, typename REQ, typename RESP>
+void GrpcRouter<GRPC_SERVICE>::Forward(const gen::ClientStreamContext& ctx,
+                                       const REQ& req, RESP& resp, GRPC_STUB_FUNC grpcStubFunc)
+{
+    static_assert(std::is_invocable_v<GRPC_STUB_FUNC, typename GRPC_SERVICE::Stub*,
+                                      grpc::ClientContext*, RESP*, grpc::CompletionQueue*>,
+                  "Client streams are forwarded with the PrepareAsync stub function");
+
+    using Forwarder = GrpcClientStreamForwarder<GRPC_SERVICE, GRPC_STUB_FUNC, REQ, RESP>;
+    auto forwarder = (Forwarder*)ctx.GetParam();
+
+    // Start streaming
+    if(!forwarder)
+    {
+        // Send CallBegin notification.
+        const void* callParam = nullptr;
+        ::grpc::Status s = OnCallBegin(ctx, &callParam);
+        if(s.ok())
+        {
+            // Create the target stream
+            forwarder = new (std::nothrow) Forwarder(this, ctx, callParam);
+            if(!forwarder)
+            {
+                s = { ::grpc::INTERNAL, "Out of memory while allocating GrpcClientStreamForwarder" };
+            }
+            else if(s = forwarder->Call(grpcStubFunc); !s.ok())
+            {
+                delete forwarder;
+                forwarder = nullptr;
+            }
+        }
+
+        if(!s.ok())
+        {
+            ctx.SetStatus(s.error_code(), s.error_message());
+            std::string err = FormatStatusMsg(req, ctx.GetStatus(), callParam);
+            OnError(__FNAME__, __LINE__, err, callParam);
+            OnCallEnd(ctx, callParam);  // Send CallEnd notification
+            return;
+        }
+
+        ctx.SetParam(forwarder);
+    }
+
+    // Forward the request (or the end of the stream)
+    forwarder->Forward(req, resp);
+}
+
+//
+// Forward a generic call with the raw messages (passthrough)
+//
+template <typename GRPC_SERVICE>
+void GrpcRouter<GRPC_SERVICE>::Forward(const gen::GenericContext& ctx,
+                                       const grpc::ByteBuffer& req, grpc::ByteBuffer& resp,
+                                       const std::shared_ptr<RetryPolicy>& retry /*= nullptr*/)
+{
+    static_assert(std::is_same_v<typename GRPC_SERVICE::Stub, grpc::GenericStub>,
+                  "Generic calls are forwarded by GrpcRouter<gen::AnyService>");
+
+    // Send CallBegin notification.
+    const void* callParam = nullptr;
+    ::grpc::Status s = OnCallBegin(ctx, req, &callParam);
+    if(!s.ok())
+    {
+        ctx.SetStatus(s.error_code(), s.error_message());
+        std::string err = FormatStatusMsg(ctx, ctx.GetStatus(), callParam);
+        OnError(__FNAME__, __LINE__, err, callParam);
+        OnCallEnd(ctx, callParam);  // Send CallEnd notification
+        return;
+    }
+
+    // Check for Deadline Expiration (see the unary Forward())
+    auto remainingTime = ctx.GetServerContext().deadline() - std::chrono::system_clock::now();
+    if(remainingTime <= std::chrono::milliseconds(0))
+    {
+        ctx.SetStatus(::grpc::DEADLINE_EXCEEDED, "Request already past deadline");
+        std::string err = FormatStatusMsg(ctx, ctx.GetStatus(), callParam);
+        OnError(__FNAME__, __LINE__, err, callParam);
+        OnCallEnd(ctx, callParam);  // Send CallEnd notification
+        return;
+    }
+
+    // Limit forward timeout not to exceed mUnaryTimeoutMs
+    unsigned long timeout = std::chrono::duration_cast<std::chrono::milliseconds>(remainingTime).count();
+    if(timeout > mUnaryTimeoutMs)
+        timeout = mUnaryTimeoutMs;
+
+    if(mShadowClient)
+    {
+        Mirror(ctx.GetServerContext(), timeout, callParam,
+               [&](grpc::GenericStub* stub, grpc::ClientContext* context, grpc::CompletionQueue* cq)
+               {
+                   return stub->PrepareUnaryCall(context, ctx.GetMethod(), req, cq);
+               });
+    }
+
+    // Call Grpc Service asynchronously.
+    // Note: The forwarder sends the response and CallEnd notification.
+    using Forwarder = GrpcGenericForwarder<GRPC_SERVICE>;
+    Forwarder* forwarder = nullptr;
+    if(mCoalesce)
+    {
+        std::string key(1, 'G');
+        key.append(ctx.GetMethod()).push_back('\0');
+        AppendCallKey(key, ctx.GetServerContext(), mCoalesceMetadataKeys);
+        AppendCallKey(key, req);
+
+        // Join an identical call in flight, or let identical calls join this one
+        std::unique_lock<std::mutex> lock(mFlightsMtx);
+        if(auto itr = mFlights.find(key); itr != mFlights.end())
+        {
+            static_cast<Forwarder*>(itr->second)->Join(ctx, resp, callParam);
+            return;
+        }
+
+        if(forwarder = new (std::nothrow) Forwarder(this, ctx, callParam); forwarder)
+            forwarder->StartFlight(std::move(key));
+        timeout = mUnaryTimeoutMs;
+    }
+    else
+    {
+        forwarder = new (std::nothrow) Forwarder(this, ctx, callParam);
+    }
+
+    s = (forwarder ? forwarder->Call(req, resp, timeout, retry) :
+                     ::grpc::Status(::grpc::INTERNAL, "Out of memory while allocating GrpcGenericForwarder"));
+    if(!s.ok())
+    {
+        if(forwarder)
+            forwarder->ResumeWaiters(s);
+        delete forwarder;
+        ctx.SetStatus(s.error_code(), s.error_message());
+        std::string err = FormatStatusMsg(ctx, ctx.GetStatus(), callParam);
+        OnError(__FNAME__, __LINE__, err, callParam);
+        OnCallEnd(ctx, callParam);  // Send CallEnd notification
+    }
+}
+
+//
+// Add another target to forward the calls to
+//
+template <typename GRPC_SERVICE>
+bool GrpcRouter<GRPC_SERVICE>::AddTarget(const std::string& addressUri,
+                                         const std::shared_ptr<grpc::ChannelCredentials>& creds,
+                                         const grpc::ChannelArguments* channelArgs)
+{
+    auto target = std::make_unique<GrpcClient<GRPC_SERVICE>>(addressUri, creds, channelArgs);
+    target->SetCircuitBreaker(std::make_shared<CircuitBreaker>());
+    bool isValid = target->IsValid();
+
+    mTargets.push_back(target.get());
+    mMoreTargets.push_back(std::move(target));
+    if(!mPicker)
+        mPicker = std::make_shared<RoundRobinPicker>();
+
+    UpdateTargets();
+    return isValid;
+}
+
+//
+// Let the picker know the addresses of the targets
+//
+template <typename GRPC_SERVICE>
+void GrpcRouter<GRPC_SERVICE>::UpdateTargets()
+{
+    std::vector<std::string> addressUris;
+    for(GrpcClient<GRPC_SERVICE>* target : mTargets)
+        addressUris.push_back(target->GetAddressUri());
+
+    mTargetsStr.clear();
+    for(const std::string& addressUri : addressUris)
+        mTargetsStr += (mTargetsStr.empty() ? "" : ",") + addressUri;
+
+    if(mPicker)
+        mPicker->SetTargets(addressUris);
+}
+
+//
+// For derived class to override (Error and Info reporting)
+//
+template <typename GRPC_SERVICE>
+void GrpcRouter<GRPC_SERVICE>::OnError(const char* fname, int lineNum, const std::string& err,
+                                       const void* /*callParam*/) const
+{
+    std::cout << "ERROR: " << fname << ":" << lineNum << " " << err << std::endl;
+}
+
+template <typename GRPC_SERVICE>
+void GrpcRouter<GRPC_SERVICE>::OnInfo(const char* fname, int lineNum, const std::string& info,
+                                      const void* /*callParam*/) const
+{
+    std::cout << "INFO: " << fname << ":" << lineNum << " " << info << std::endl;
+}
 
 //
 // Helper method to format errorcd
@@ -504,7 +2149,21 @@ std::string GrpcRouter<GRPC_SERVICE>::FormatStatusMsg(const google::protobuf::Me
     std::stringstream ss;
     ss << "req: " << req.GetTypeName()
        << ", status: " << gen::StatusToStr(status.error_code()) << " (" << status.error_code() << ")"
-       << ", to: " << mTargetClient.GetAddressUri();
+       << ", to: " << (mTargets.size() == 1 ? mTargetClient.GetAddressUri() : mTargetsStr);
+    if(!status.ok())
+        ss << ", err: '" << status.error_message() << "'";
+    return ss.str();
+}
+
+template <typename GRPC_SERVICE>
+std::string GrpcRouter<GRPC_SERVICE>::FormatStatusMsg(const gen::GenericContext& ctx,
+                                                      const ::grpc::Status& status,
+                                                      const void* /*callParam*/) const
+{
+    std::stringstream ss;
+    ss << "method: " << ctx.GetMethod()
+       << ", status: " << gen::StatusToStr(status.error_code()) << " (" << status.error_code() << ")"
+       << ", to: " << (mTargets.size() == 1 ? mTargetClient.GetAddressUri() : mTargetsStr);
     if(!status.ok())
         ss << ", err: '" << status.error_message() << "'";
     return ss.str();
@@ -514,13 +2173,14 @@ std::string GrpcRouter<GRPC_SERVICE>::FormatStatusMsg(const google::protobuf::Me
 // Helper method to get client metadata
 //
 template <typename GRPC_SERVICE>
-void GrpcRouter<GRPC_SERVICE>::GetMetadata(const grpc::ServerContext& ctx,
-                                           std::map<std::string, std::string>& metadata,
+void GrpcRouter<GRPC_SERVICE>::GetMetadata(const grpc::ServerContextBase& ctx,
+                                           MetadataView& metadata,
                                            const void* /*callParam*/) const
 {
     for(const auto& [key, value] : ctx.client_metadata())
     {
-        metadata[{ key.data(), key.size() }] = { value.data(), value.size() };
+        if(mMetadataFilter.IsAllowed(key))
+            metadata.Add(key, value);
     }
 }
 
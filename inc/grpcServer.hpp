@@ -12,11 +12,19 @@
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Wunused-parameter"
 #include <grpcpp/grpcpp.h>
+#include <grpcpp/alarm.h>
 #include <grpcpp/impl/service_type.h>
+#include <google/protobuf/arena.h>
 #pragma GCC diagnostic pop
 
 #include "grpcContext.hpp"  // Context
-#include "grpcUtils.hpp"    // FormatDnsAddressUri
+#include "grpcUtils.hpp"    // FormatDnsAddressUri, FindUnaryMethod
+#include "responseCache.hpp" // ResponseCache
+#include "threadPool.hpp"   // ThreadPool
+#include <algorithm>        // std::max
+#include <deque>            // std::deque
+#include <mutex>            // std::mutex
+#include <optional>         // std::optional
 #include <sstream>          // stringstream
 #include <thread>           // std::thread
 #include <signal.h>         // pthread_sigmask
@@ -33,12 +41,80 @@ do{ \
 }while(0)
 #endif
 
+//
+// Where RPC process functions are executed:
+// INLINE - on the completion queue thread that received the event
+// WORKER - on the GrpcServer worker pool (see SetWorkerThreads()), so
+//          completion queue threads only poll and dispatch events
+// DEFAULT - use the GrpcServer-wide mode set by SetExecMode()
+//
+enum class ExecMode : char { DEFAULT=0, INLINE, WORKER };
+
+//
+// Per-RPC options set by GrpcService::Bind()
+//
+struct BindOptions
+{
+    // Number of request slots kept armed (pre-posted) on every completion queue,
+    // and the ceiling the per-queue pool of slots is allowed to grow to under load.
+    // Zero means use the GrpcServer-wide default set by SetRpcSlots().
+    int slots{0};
+    int maxSlots{0};
+
+    // Where the process function is executed
+    ExecMode execMode{ExecMode::DEFAULT};
+
+    // Arena mode (unary RPCs only): When not zero, every request slot owns
+    // a protobuf Arena with an initial block of this size, and the request
+    // and response messages of each call are created on that arena.
+    size_t arenaBlockSize{0};
+
+    // Max number of responses queued by a StreamWriter (server-stream producer
+    // mode and bidirectional streams) before Write() fails and the producer
+    // has to wait for the queue to drain.
+    // Zero means use the GrpcServer-wide default set by SetWriteHighWater().
+    size_t writeHighWater{0};
+
+    // Server streams: Call the process function one response ahead, so the last
+    // response is known and written together with the stream status (one
+    // WriteAndFinish() instead of a Write() and a Finish()), as a StreamWriter
+    // always does.
+    bool writeAhead{false};
+
+    // Unary and generic RPCs: Cache of the serialized responses. A call with the
+    // same request (and metadata, see ResponseCache) as a cached one is served from
+    // the cache right away on the completion queue thread, and the process function
+    // isn't called. Only set it for RPCs whose response depends on the request alone.
+    std::shared_ptr<ResponseCache> cache;
+
+    // Unary RPCs with a cache: Name of the RPC in the service (e.g. "Ping"), which the
+    // cached responses are keyed by. It can be left empty if the RPC is the only unary
+    // RPC of the service with its request and response types.
+    std::string method;
+};
+
+struct RequestSlotPool;
+
+//
+// Deferred calls of a server that are resumed (see Context::Defer())
+//
+struct ResumeGate
+{
+    std::atomic<int> deferred{0};       // Number of Defer() calls not resumed yet
+    std::atomic<bool> isClosed{false};  // The server has stopped waiting for them
+    std::atomic<int> resuming{0};       // Number of Resume() calls in progress
+    std::atomic<int> waiting{0};        // Number of threads waiting for them to be resumed
+    std::vector<::grpc::Alarm*> alarms; // Alarms of the waiting threads, cancelled once none is deferred
+    std::mutex mtx;                     // Guards the alarms, and the calls dropped once it's closed
+};
+
 //
 // Base request context class
 //
-struct RequestContext
+struct RequestContext : public DeferredCall
 {
     RequestContext() = default;
+    RequestContext(const RequestContext& req) : options(req.options) {}
     virtual ~RequestContext() = default;
 
     enum : char { UNKNOWN=0, REQUEST, READ, READEND, WRITE, FINISH } state = UNKNOWN;
@@ -54,10 +130,105 @@ struct RequestContext
 
     virtual void Process() = 0;
     virtual void StartProcessing(::grpc::ServerCompletionQueue* cq) = 0;
+
+    // Process the event on the completion queue thread, when it takes no time
+    // (e.g. the response is cached). Return false to dispatch it as usual.
+    virtual bool ProcessInline() { return false; }
     virtual void EndProcessing(::grpc::ServerCompletionQueue* cq, bool isError) = 0;
 
     virtual RequestContext* Clone() = 0;
     virtual std::string_view GetRequestName() const = 0;
+
+    // Tags of the operations a context can have in flight at the same time.
+    // Note: A tag is the context address with the operation in its low bits,
+    // so a context with one operation in flight at a time uses its address as is.
+    enum : uintptr_t { TAG_MAIN=0, TAG_READ, TAG_WRITE, TAG_FINISH, TAG_MASK=3 };
+
+    void* GetTag(uintptr_t op) { return reinterpret_cast<void*>(reinterpret_cast<uintptr_t>(this) | op); }
+
+    static RequestContext* FromTag(void* tag, uintptr_t& op)
+    {
+        op = reinterpret_cast<uintptr_t>(tag) & TAG_MASK;
+        return reinterpret_cast<RequestContext*>(reinterpret_cast<uintptr_t>(tag) & ~TAG_MASK);
+    }
+
+    // Handle completion of an operation tagged with GetTag(op) other than TAG_MAIN.
+    // Return what the completion queue thread should do next with the context:
+    // NONE - nothing, other operations are still in flight
+    // DISPATCH - call Process() to process the event
+    // END - nothing is in flight anymore, end processing and re-arm the slot
+    // Note: No operations can be started once the completion queue is shut down.
+    enum class TagAction : char { NONE=0, DISPATCH, END };
+    virtual TagAction OnTagEvent(uintptr_t op, bool ok, bool isShutdown) { return TagAction::NONE; }
+
+    // The completion queue is about to shut down: Return true if the call has nothing
+    // in flight, so no event would end it (e.g. the stream of an idle producer), and
+    // it must be ended right away. Note: No process function is running at this point.
+    virtual bool OnShutdown() { return false; }
+
+    // Deferred processing (see Context::Defer()): The process function holds the
+    // call while it runs, and so does every Defer() until it's resumed. Whoever
+    // releases the last hold calls Continue() to start the next operation.
+    void Defer() override
+    {
+        holds++;
+        resumeGate->deferred++;
+    }
+
+    void Resume() override
+    {
+        ResumeGate& gate = *resumeGate;
+        gate.resuming++;
+        if(!gate.isClosed)
+        {
+            if(--holds == 0)
+                Continue();
+        }
+        else
+        {
+            // The server has stopped waiting for the call, so its completion queue
+            // may be shut down: drop the call (see GrpcServer::ProcessEvents())
+            std::unique_lock<std::mutex> lock(gate.mtx);
+            if(--holds == 0)
+                EndProcessing(nullptr, true /*isError*/);
+        }
+
+        // Note: Only once the next operation is started. The last call resumed wakes up
+        // the threads waiting to shut down their queue (see GrpcServer::ProcessEvents()).
+        if(--gate.deferred == 0 && gate.waiting > 0)
+        {
+            std::unique_lock<std::mutex> lock(gate.mtx);
+            for(::grpc::Alarm* alarm : gate.alarms)
+                alarm->Cancel();
+        }
+        gate.resuming--;
+    }
+
+    virtual void Continue() {}
+
+    std::atomic<int> holds{0};
+
+    BindOptions options;                // Options this RPC was bound with
+    RequestSlotPool* pool{nullptr};     // Per-thread pool of slots this context belongs to
+    ResumeGate* resumeGate{nullptr};    // Deferred calls of the server
+
+    // Number of request slots and arena blocks allocated (see GrpcServer::GetSlotAllocCount())
+    static inline std::atomic<uint64_t> slotAllocCount{0};
+};
+
+static_assert(alignof(RequestContext) > RequestContext::TAG_MASK, "RequestContext tags need spare low bits");
+
+//
+// Per-thread pool of request contexts (slots) armed for the same RPC.
+// Only accessed by the thread that owns the completion queue.
+//
+struct RequestSlotPool
+{
+    RequestContext* prototype{nullptr};                     // Context registered by Bind()
+    std::vector<std::unique_ptr<RequestContext>> contexts;  // All slots owned by the pool
+    int armed{0};       // Number of slots waiting for a new call
+    int slots{1};       // Number of slots to keep armed
+    int maxSlots{1};    // Ceiling the pool can grow to
 };
 
 //
@@ -69,6 +240,7 @@ struct GrpcServiceBase
     virtual bool OnInit() = 0;
     virtual const char* GetName() = 0;
     virtual ::grpc::Service* GetService() = 0;
+    virtual ::grpc::AsyncGenericService* GetGenericService() { return nullptr; }
     virtual bool IsServing() { return true; }
     virtual ~GrpcServiceBase() = default;
 };
@@ -159,6 +331,39 @@ public:
     // Set OnRun() call interval in milliseconds
     void SetRunInterval(int milliseconds) { runIntervalMicroseconds = milliseconds * 1000; }
 
+    // Set the default number of request slots kept armed per RPC on every
+    // completion queue, and the ceiling each pool of slots can grow to when
+    // all armed slots are busy. Bind() options override these defaults.
+    void SetRpcSlots(int slots, int maxSlots)
+    {
+        rpcSlots = std::max(slots, 1);
+        rpcMaxSlots = std::max(maxSlots, rpcSlots);
+    }
+
+    // Set the number of worker threads used to execute the process functions of
+    // RPCs running in ExecMode::WORKER mode, and the max number of pending calls
+    // the workers can queue. When the workers are full, the call is processed
+    // on the completion queue thread that received it.
+    void SetWorkerThreads(int threadCount, size_t queueCapacity = 4096)
+    {
+        workerThreadCount = threadCount;
+        workerQueueCapacity = queueCapacity;
+    }
+
+    // Get the number of request slots (request contexts) and arena blocks the library
+    // has allocated. They are only allocated when a pool of slots grows: every call then
+    // reuses its slot, re-constructing the Context and the reader/writer objects in place,
+    // so the count doesn't change while the load is steady.
+    // Note: This isn't a count of all the heap allocations of a call (e.g. the messages
+    // off the arena, the std::function captures or the queued stream responses).
+    static uint64_t GetSlotAllocCount() { return RequestContext::slotAllocCount; }
+
+    // Set the default execution mode for RPCs that don't specify it with Bind()
+    void SetExecMode(ExecMode mode) { execMode = (mode == ExecMode::DEFAULT ? ExecMode::INLINE : mode); }
+
+    // Set the default max number of responses a stream queues (see StreamWriter)
+    void SetWriteHighWater(size_t count) { writeHighWater = std::max<size_t>(count, 1); }
+
     // For derived class to override (Error and Info reporting)
     virtual void OnError(const std::string& err) const { std::cerr << err << std::endl; }
     virtual void OnInfo(const std::string& info) const { std::cout << info << std::endl; }
@@ -206,6 +411,24 @@ private:
                 break;
             }
 
+            // Resolve per-RPC options that are left to the server-wide defaults
+            bool useWorkers = false;
+            for(const std::unique_ptr<RequestContext>& ctx : requestContextList)
+            {
+                BindOptions& options = ctx->options;
+                options.slots = (options.slots > 0 ? options.slots : rpcSlots);
+                options.maxSlots = std::max(options.maxSlots > 0 ? options.maxSlots : rpcMaxSlots, options.slots);
+
+                if(options.writeHighWater == 0)
+                    options.writeHighWater = writeHighWater;
+
+                if(options.execMode == ExecMode::DEFAULT)
+                    options.execMode = execMode;
+                if(options.execMode == ExecMode::WORKER && workerThreadCount <= 0)
+                    options.execMode = ExecMode::INLINE;   // No workers to run on
+                useWorkers |= (options.execMode == ExecMode::WORKER);
+            }
+
             // Setup server
             for(const AddressUri& addressUri : addressUriArr)
             {
@@ -214,12 +437,27 @@ private:
             }
 
             // Register services
+            int genericCount = 0;
             for(const auto& pair : serviceMap)
             {
                 // Note: Only register service once. This would be the case
                 // when gRpc server stopped and then started again.
-                ::grpc::Service* service = pair.second->GetService();
-                builder.RegisterService(service);
+                if(::grpc::Service* service = pair.second->GetService())
+                {
+                    builder.RegisterService(service);
+                }
+                else if(::grpc::AsyncGenericService* service = pair.second->GetGenericService())
+                {
+                    builder.RegisterAsyncGenericService(service);
+                    genericCount++;
+                }
+            }
+
+            // Note: gRpc supports a single generic service per server
+            if(genericCount > 1)
+            {
+                OnError("Server inialization failed: more than one generic service registered");
+                break;
             }
 
             // Add Completion Queues - one queue per a thread for a best performance
@@ -245,14 +483,25 @@ private:
                 break;
             }
 
+            // Start worker threads (if any RPC needs them)
+            if(useWorkers && !workers.Start(workerThreadCount, workerQueueCapacity))
+            {
+                OnError("Failed to start worker threads");
+                server->Shutdown();
+                break;
+            }
+
             // Start threads
+            // Note: The deferred calls of the last run (if any) are dropped until now
+            resumeGate.isClosed = false;
             std::vector<std::thread> threads;
             for(int i = 0; i < threadCount; i++)
             {
                 threads.emplace_back(&GrpcServer::ProcessEvents, this, cqueues[i].get(), i);
             }
 
-            OnInfo("GrpcServer is running with " + std::to_string(threads.size()) + " threads");
+            OnInfo("GrpcServer is running with " + std::to_string(threads.size()) + " threads" +
+                   (useWorkers ? " and " + std::to_string(workers.GetThreadCount()) + " worker threads" : ""));
 
             // Loop until runServer is true
             isRunning = true;
@@ -264,15 +513,30 @@ private:
 
             OnInfo("Stopping GrpcServer ...");
 
-            // Shutdown the server
+            // Stop re-arming request slots, then shutdown the server.
+            // Note: Shutdown() cancels all calls that are still in progress
+            // once the deadline expires, so their pending events fail.
+            runThreads = false;
             std::chrono::time_point<std::chrono::system_clock> deadline =
                     std::chrono::system_clock::now() + std::chrono::milliseconds(200);
             server->Shutdown(deadline);
             server->Wait();  // Important: Wait for shutdown to complete
 
+            // Let the workers complete all the calls they have started
+            workers.Stop();
+
             OnInfo("Waiting for server threads to complete...");
 
-            runThreads = false;
+            // Wake up every thread to shutdown and drain its completion queue.
+            // Note: A completion queue must not be used to start new operations
+            // once it is shut down, so let the only thread that still starts
+            // them on that queue (the one that owns it) shut it down.
+            std::vector<::grpc::Alarm> alarms(threads.size());
+            for(size_t i = 0; i < threads.size(); i++)
+            {
+                alarms[i].Set(cqueues[i].get(), std::chrono::system_clock::now(), GetShutdownTag());
+            }
+
             for(std::thread& thread : threads)
             {
                 thread.join();
@@ -303,66 +567,154 @@ private:
         pthread_sigmask(SIG_BLOCK, &set, nullptr);
 
         // Ask the system start processing requests
-        std::list<std::unique_ptr<RequestContext>> threadRequestContextList;
+        std::list<RequestSlotPool> pools;
         for(const std::unique_ptr<RequestContext>& ctx : requestContextList)
         {
-            RequestContext* threadRequestContext = ctx->Clone();
-            if(!threadRequestContext)
+            RequestSlotPool& pool = pools.emplace_back();
+            pool.prototype = ctx.get();
+            pool.slots = ctx->options.slots;
+            pool.maxSlots = ctx->options.maxSlots;
+
+            for(int i = 0; i < pool.slots; i++)
             {
-                OnError("Thread " + std::to_string(threadIndex) + " failed to start");
-                return;
+                if(!AddSlot(pool, cq))
+                {
+                    // Note: Keep processing events until the server shuts down,
+                    // so the completion queue gets drained
+                    OnError("Thread " + std::to_string(threadIndex) + " failed to start");
+                    Shutdown();
+                    break;
+                }
             }
-            threadRequestContextList.emplace_back(threadRequestContext);
-            threadRequestContext->StartProcessing(cq);
         }
 
-        // Enter event loop to process events
+        // Enter event loop to process events.
+        // Note: Next() blocks until there is an event to process. It returns
+        // false once the queue is shut down and all its events are drained.
         void* tag = nullptr;
         bool eventReadSuccess = false;
+        bool isShutdown = false;
+        ::grpc::Alarm deferAlarm;
+        bool isWaitingDeferred = false;
 
-        const std::chrono::milliseconds timeout(200);
-        std::chrono::time_point<std::chrono::system_clock> deadline;
+        while(cq->Next(&tag, &eventReadSuccess))
+        {
+            if(tag == GetShutdownTag())
+            {
+                // Deferred calls (see Context::Defer()) start their next operation
+                // once they are resumed, so let them do it before the completion
+                // queue is shut down: The last call resumed cancels the alarm, and
+                // the shutdown tag comes back. Note: The calls are cancelled by now,
+                // so they are expected to resume soon, but don't wait for them forever.
+                {
+                    std::unique_lock<std::mutex> lock(resumeGate.mtx);
+                    if(!isWaitingDeferred)
+                    {
+                        resumeGate.waiting++;
+                        if(resumeGate.deferred > 0)
+                        {
+                            resumeGate.alarms.push_back(&deferAlarm);
+                            deferAlarm.Set(cq, std::chrono::system_clock::now() + std::chrono::seconds(5), GetShutdownTag());
+                            isWaitingDeferred = true;
+                            continue;
+                        }
+                    }
+                    else
+                    {
+                        resumeGate.alarms.erase(std::find(resumeGate.alarms.begin(), resumeGate.alarms.end(), &deferAlarm));
+                    }
+                    resumeGate.waiting--;
+                }
 
-        // Note: Reading events's with blocking Next() doesn't work well
-        // when server is being shutting down while some PRPs are still
-        // in progress (grpc asserts). Non-blocking AsyncNext() works fine.
-        // while(cq->Next(&tag, &eventReadSuccess))
+                if(resumeGate.deferred > 0)
+                {
+                    OnError("Thread " + std::to_string(threadIndex) + " is shutting down with " +
+                            std::to_string(resumeGate.deferred) + " calls still deferred");
+
+                    // Let the calls resumed from now on be dropped, and wait for
+                    // the ones that are starting an operation right now. The calls
+                    // still deferred are left behind (not freed), since they can be
+                    // resumed after this thread is done.
+                    resumeGate.isClosed = true;
+                    while(resumeGate.resuming > 0)
+                        std::this_thread::yield();
+
+                    std::unique_lock<std::mutex> lock(resumeGate.mtx);
+                    for(RequestSlotPool& pool : pools)
+                    {
+                        for(std::unique_ptr<RequestContext>& ctx : pool.contexts)
+                        {
+                            if(ctx && ctx->holds > 0)
+                                ctx.release();
+                        }
+                    }
+                }
 
-        while(runThreads)
-        {
-            deadline = std::chrono::system_clock::now() + timeout;
-            const grpc::CompletionQueue::NextStatus status = cq->AsyncNext(&tag, &eventReadSuccess, deadline);
+                // End the calls that no event would end, since no operation can be
+                // started once the completion queue is shut down (e.g. the streams
+                // of idle producers). Note: The workers are stopped by now.
+                for(RequestSlotPool& pool : pools)
+                {
+                    for(const std::unique_ptr<RequestContext>& ctx : pool.contexts)
+                    {
+                        if(ctx && ctx->OnShutdown())
+                            ctx->EndProcessing(cq, true /*isError*/);
+                    }
+                }
 
-            if(status == grpc::CompletionQueue::NextStatus::GOT_EVENT)
-            {
-                // We have event to process
-            }
-            else if(status == grpc::CompletionQueue::NextStatus::TIMEOUT)
-            {
+                // The server is shut down: shutdown the completion queue
+                // and keep draining it until there are no more events
+                cq->Shutdown();
+                isShutdown = true;
                 continue;
             }
-            else if(status == grpc::CompletionQueue::NextStatus::SHUTDOWN)
+            else if(tag == nullptr)
             {
-                break; // The server is being shutting down
-            }
-            else
-            {
-                OnError("Server Completion Queue returned invalid status" );
+                OnError("Server Completion Queue returned empty tag");
                 continue;
             }
 
-            if(tag == nullptr)
+            // Get the request context for the specific tag
+            uintptr_t op = RequestContext::TAG_MAIN;
+            RequestContext* ctx = RequestContext::FromTag(tag, op);
+
+            // Is it one of the operations a stream keeps in flight at the same time?
+            if(op != RequestContext::TAG_MAIN)
             {
-                OnError("Server Completion Queue returned empty tag");
+                switch(ctx->OnTagEvent(op, eventReadSuccess, isShutdown))
+                {
+                case RequestContext::TagAction::DISPATCH:
+                    Dispatch(ctx);
+                    break;
+
+                case RequestContext::TagAction::END:
+                    ctx->EndProcessing(cq, false /*isError*/);
+                    RearmSlot(ctx, cq);
+                    break;
+
+                default:
+                    break;
+                }
                 continue;
             }
 
-            // Get the request context for the specific tag
-            RequestContext* ctx = static_cast<RequestContext*>(tag);
-
             // victor test
 //            TRACE("Next Event: tag=" << tag << ", eventReadSuccess=" << eventReadSuccess << ", state=" << GetStateStr());
 
+            // Is the completion queue being drained?
+            if(isShutdown)
+            {
+                // No new operations can be started anymore. Let the calls
+                // that are still in progress know they are done.
+                // Note: Slots waiting for a new call have nothing to end.
+                if(ctx->state != RequestContext::REQUEST)
+                {
+                    bool isError = (!eventReadSuccess || ctx->state != RequestContext::FINISH);
+                    ctx->EndProcessing(cq, isError);
+                }
+                continue;
+            }
+
             // Have we successfully read event?
             if(!eventReadSuccess)
             {
@@ -372,10 +724,9 @@ private:
                 {
                     // Done reading client-streaming messages
                     ctx->state = RequestContext::READEND;
-                    ctx->Process();
-                    continue;
+                    Dispatch(ctx);
                 }
-                // Ignore events that failed to read due to shutting down
+                // Ignore requests that failed due to shutting down
                 else if(ctx->state != RequestContext::REQUEST)
                 {
                     // Abort processing if we failed reading event
@@ -385,6 +736,7 @@ private:
                        << ", ctx=" << ctx << ", " << "req=" << ctx->GetRequestName();
                     OnError(ss.str());
                     ctx->EndProcessing(cq, true /*isError*/);
+                    RearmSlot(ctx, cq);
                 }
                 continue;
             }
@@ -393,15 +745,26 @@ private:
             switch(ctx->state)
             {
             case RequestContext::REQUEST:  // Completion of fRequestPtr()
+                // The slot is taken by a new call. If the pool is running
+                // out of armed slots, then grow it (up to the ceiling).
+                if(RequestSlotPool& pool = *ctx->pool; --pool.armed < pool.slots &&
+                   (int)pool.contexts.size() < pool.maxSlots)
+                {
+                    AddSlot(pool, cq);
+                }
+                Dispatch(ctx);
+                break;
+
             case RequestContext::READ:     // Completion of Read()
             case RequestContext::WRITE:    // Completion of Write()
                 // Process request
-                ctx->Process();
+                Dispatch(ctx);
                 break;
 
             case RequestContext::FINISH:    // Completion of Finish()
                 // Process post-Finish() event
                 ctx->EndProcessing(cq, false /*isError*/);
+                RearmSlot(ctx, cq);
                 break;
 
             default:
@@ -414,16 +777,54 @@ private:
             } // end of switch
         } // end of while
 
-        // Shutdown and drain the completion queue
-        cq->Shutdown();
-        while(cq->Next(&tag, &eventReadSuccess))
-            ; // Ignore all remaining events
-
         OnInfo("Thread " + std::to_string(threadIndex) + " is completed");
     }
 
+    // Process the event on this thread or pass it to the worker threads.
+    // Note: A request context has no other events pending while it's being
+    // processed, so the worker owns it until Process() starts the next
+    // gRpc operation (Read, Write or Finish) that brings it back to the queue.
+    void Dispatch(RequestContext* ctx)
+    {
+        if(ctx->ProcessInline())
+            return;
+
+        if(ctx->options.execMode != ExecMode::WORKER || !workers.Submit([ctx]() { ctx->Process(); }))
+            ctx->Process();
+    }
+
+    // Add a new slot to the pool and ask the system to start processing requests
+    bool AddSlot(RequestSlotPool& pool, ::grpc::ServerCompletionQueue* cq)
+    {
+        RequestContext* ctx = pool.prototype->Clone();
+        if(!ctx)
+            return false;
+
+        pool.contexts.emplace_back(ctx);
+        ctx->pool = &pool;
+        ctx->resumeGate = &resumeGate;
+        RearmSlot(ctx, cq);
+        return true;
+    }
+
+    // Ask the system to start processing requests with the given slot
+    void RearmSlot(RequestContext* ctx, ::grpc::ServerCompletionQueue* cq)
+    {
+        // Note: Don't ask for new requests once the server is stopping
+        if(runThreads)
+        {
+            ctx->pool->armed++;
+            ctx->StartProcessing(cq);
+        }
+    }
+
+    // Tag that wakes up a thread to shutdown its completion queue.
+    // Note: It can't be mistaken for any RequestContext tag.
+    void* GetShutdownTag() { return this; }
+
     void Cleanup()
     {
+        workers.Stop();
         serviceMap.clear();
         requestContextList.clear();
         isRunning = false;
@@ -432,7 +833,11 @@ private:
     }
 
     // Helpers
-    void AddRpcRequest(RequestContext* ctx) { requestContextList.emplace_back(ctx); }
+    void AddRpcRequest(RequestContext* ctx, const BindOptions& options)
+    {
+        ctx->options = options;
+        requestContextList.emplace_back(ctx);
+    }
 
     // For derived class to override
     virtual bool OnInit(::grpc::ServerBuilder& builder) = 0;
@@ -445,9 +850,25 @@ private:
     std::atomic<bool> runServer{true};              // Initially, since we intend to run the server
     std::atomic<bool> runThreads{true};             // Initially, since we intend to run threads
     unsigned int runIntervalMicroseconds{1000000};  // 1 secs default
+    int rpcSlots{1};                                // Request slots armed per RPC per thread
+    int rpcMaxSlots{1};                             // Ceiling of request slots per RPC per thread
+    ExecMode execMode{ExecMode::INLINE};            // Default execution mode for all RPCs
+    size_t writeHighWater{256};                     // Default max number of responses a stream queues
+    int workerThreadCount{0};                       // No worker threads by default
+    size_t workerQueueCapacity{0};                  // Max number of calls pending for workers
+    ThreadPool workers;                             // Worker threads to execute process functions
+    ResumeGate resumeGate;                          // Deferred calls resumed after the process functions
 
     template<typename RPC_SERVICE>
     friend class GrpcService;
+
+    friend class GrpcGenericService;
+
+    template<typename RPC_SERVICE, typename REQ, typename RESP>
+    friend struct ServerStreamRequestContext;
+
+    template<typename RPC_SERVICE, typename REQ, typename RESP>
+    friend struct BidiStreamRequestContext;
 };
 
 template<typename RPC_SERVICE>
@@ -465,6 +886,12 @@ using ServerStreamProcessFunc = void (GrpcService<RPC_SERVICE>::*)(const ServerS
 template<typename RPC_SERVICE, typename REQ, typename RESP>
 using ClientStreamProcessFunc = void (GrpcService<RPC_SERVICE>::*)(const ClientStreamContext&, const REQ&, RESP&);
 
+template<typename RPC_SERVICE, typename REQ, typename RESP>
+using BidiStreamProcessFunc = void (GrpcService<RPC_SERVICE>::*)(const BidiStreamContext&, const REQ&, RESP&);
+
+class GrpcGenericService;
+using GenericProcessFunc = void (GrpcGenericService::*)(const GenericContext&, const ::grpc::ByteBuffer&, ::grpc::ByteBuffer&);
+
 //
 // Template pointer to function that *request* the system to start processing unary/strean requests
 //
@@ -483,6 +910,195 @@ using ClientStreamRequestFunc = void (RPC_SERVICE::AsyncService::*)(::grpc::Serv
         ::grpc::ServerAsyncReader<RESP, REQ>*,
         ::grpc::CompletionQueue*, ::grpc::ServerCompletionQueue*, void*);
 
+template<typename RPC_SERVICE, typename REQ, typename RESP>
+using BidiStreamRequestFunc = void (RPC_SERVICE::AsyncService::*)(::grpc::ServerContext*,
+        ::grpc::ServerAsyncReaderWriter<RESP, REQ>*,
+        ::grpc::CompletionQueue*, ::grpc::ServerCompletionQueue*, void*);
+
+//
+// Template class to queue responses written to a stream from any thread
+// (see StreamWriter). The completion queue thread drains the queue with one
+// Write() in flight at a time, and finishes the stream once it's empty.
+// Note: Writes and Finish() use their own tags (see RequestContext::GetTag()),
+// and everything is guarded by the mutex.
+//
+template<typename RESP, typename STREAM>
+struct StreamWriteQueue : public AsyncStreamWriter
+{
+    // Start serving a new call (called before the call is requested)
+    void Reset(RequestContext* owner_, const BindOptions& options, const std::atomic<bool>& isRunning_)
+    {
+        std::unique_lock<std::mutex> lock(mtx);
+        owner = owner_;
+        highWater = std::max<size_t>(options.writeHighWater, 1);
+        isRunning = &isRunning_;
+        generation++;
+        queue.clear();
+        status = ::grpc::Status::OK;
+        onDrain = nullptr;
+        isBusy = isFull = writing = finishing = false;
+        finishRequested = finished = isBroken = isShutdown = false;
+    }
+
+    // AsyncStreamWriter implementation (called from any thread)
+    bool Write(uint64_t generation_, const google::protobuf::Message& msg, bool isLast) override
+    {
+        if(msg.GetDescriptor() != RESP::descriptor())
+            return false;
+
+        std::unique_lock<std::mutex> lock(mtx);
+        if(generation_ != generation || finishRequested || isShutdown || !*isRunning)
+            return false;
+
+        // Is the queue above the high-water mark?
+        if(queue.size() >= highWater)
+        {
+            isFull = true;
+            return false;
+        }
+
+        queue.emplace_back().CopyFrom(msg);
+        finishRequested = isLast;
+        if(!writing)
+            StartWrite();
+        return true;
+    }
+
+    bool Finish(uint64_t generation_, const ::grpc::Status& status_) override
+    {
+        std::unique_lock<std::mutex> lock(mtx);
+        if(generation_ != generation || finishRequested || isShutdown || !*isRunning)
+            return false;
+
+        status = status_;
+        finishRequested = true;
+        StartFinish();
+        return true;
+    }
+
+    void SetOnDrain(uint64_t generation_, std::function<void()>&& onDrain_) override
+    {
+        std::unique_lock<std::mutex> lock(mtx);
+        if(generation_ == generation)
+            onDrain = std::move(onDrain_);
+    }
+
+    bool IsClosed(uint64_t generation_) override
+    {
+        std::unique_lock<std::mutex> lock(mtx);
+        return (generation_ != generation || finishRequested || isShutdown);
+    }
+
+    // Helpers (called with the mutex locked)
+    void StartWrite()
+    {
+        // Is it the last response? Then write it together with the status.
+        if(queue.size() == 1 && finishRequested && !isBusy)
+        {
+            writing = finishing = true;
+            owner->state = RequestContext::FINISH;
+            stream->WriteAndFinish(queue.front(), ::grpc::WriteOptions(), status, owner->GetTag(RequestContext::TAG_FINISH));
+            return;
+        }
+
+        // Note: Don't use WriteOptions::set_buffer_hint() for other responses.
+        // A buffered write doesn't complete until a later write flushes it,
+        // and only one write can be in flight, so the stream would stall.
+        writing = true;
+        stream->Write(queue.front(), owner->GetTag(RequestContext::TAG_WRITE));
+    }
+
+    void StartFinish()
+    {
+        // Finish once all the queued responses are written.
+        // Note: Don't finish while the owner is busy (e.g. its process function
+        // is running), so the stream can't end before it's done.
+        if(!finishRequested || finishing || finished || isBusy || writing ||
+           isShutdown || !queue.empty())
+        {
+            return;
+        }
+
+        finishing = true;
+        owner->state = RequestContext::FINISH;
+        stream->Finish(status, owner->GetTag(RequestContext::TAG_FINISH));
+    }
+
+    // Completion of Write()
+    void OnWriteDone(bool ok, std::unique_lock<std::mutex>& lock)
+    {
+        writing = false;
+        queue.pop_front();
+        if(!ok || isShutdown)
+        {
+            // The stream is broken, drop all the pending responses
+            isBroken |= !ok;
+            finishRequested = true;
+            queue.clear();
+        }
+        else if(!queue.empty())
+        {
+            StartWrite();
+        }
+
+        StartFinish();
+
+        // Let the producer know it can write again.
+        // Note: Call onDrain unlocked, since it's likely to write.
+        if(isFull && queue.empty() && !finishRequested)
+        {
+            isFull = false;
+            if(std::function<void()> callback = onDrain; callback)
+            {
+                lock.unlock();
+                callback();
+                lock.lock();
+            }
+        }
+    }
+
+    // Completion of Finish() or WriteAndFinish()
+    void OnFinishDone(bool ok)
+    {
+        writing = finishing = false;
+        queue.clear();
+        finished = true;
+        isBroken |= !ok;
+    }
+
+    // The completion queue is about to shut down: Is nothing in flight, so no event
+    // would end the stream? Then it's shut down, so it's only ended once.
+    bool ShutdownIfIdle()
+    {
+        if(isBusy || writing || finishing || finished || isShutdown)
+            return false;
+        isShutdown = true;
+        return true;
+    }
+
+    // Is nothing in flight anymore?
+    bool IsDone() const { return (!isBusy && !writing && !finishing && (finished || isShutdown)); }
+
+    RequestContext* owner{nullptr};             // Context to tag the operations with
+    STREAM* stream{nullptr};                    // Stream to write to
+    const std::atomic<bool>* isRunning{nullptr};// Writes are rejected once the server is stopping
+    size_t highWater{1};                        // Max number of queued responses
+    uint64_t generation{0};                     // Generation of the call being served
+
+    std::mutex mtx;
+    std::deque<RESP> queue;             // Responses to write. The front one is being written.
+    ::grpc::Status status;              // Status to finish the stream with
+    std::function<void()> onDrain;      // Called once the full queue drains
+    bool isBusy{false};                 // Don't finish, the owner is busy
+    bool isFull{false};                 // Write() failed because the queue is full
+    bool writing{false};                // Write() is in flight
+    bool finishing{false};              // Finish() is in flight
+    bool finishRequested{false};        // Finish is requested or the stream is broken
+    bool finished{false};               // Finish() is completed
+    bool isBroken{false};               // Write() or Finish() failed
+    bool isShutdown{false};             // No more operations can be started
+};
+
 //
 // Template class to handle unary respone
 //
@@ -496,7 +1112,23 @@ struct UnaryRequestContext : public RequestContext
         : service(service_), requestFunc(requestFunc_), processFunc(processFunc_), processParam(processParam_) {}
 
     UnaryRequestContext(const UnaryRequestContext& req)
-        : service(req.service), requestFunc(req.requestFunc), processFunc(req.processFunc), processParam(req.processParam) {}
+        : RequestContext(req), service(req.service), requestFunc(req.requestFunc), processFunc(req.processFunc), processParam(req.processParam),
+          method(req.method)
+    {
+        // Arena mode: Allocate the arena initial block once, for all the calls
+        // served by this context. Fall back to the heap if it can't be allocated.
+        if(size_t blockSize = options.arenaBlockSize; blockSize > 0)
+        {
+            if(arenaBlock.reset(new (std::nothrow) char[blockSize]); arenaBlock)
+            {
+                google::protobuf::ArenaOptions arenaOptions;
+                arenaOptions.initial_block = arenaBlock.get();
+                arenaOptions.initial_block_size = blockSize;
+                arena.emplace(arenaOptions);
+                slotAllocCount++;
+            }
+        }
+    }
 
     virtual ~UnaryRequestContext() = default;
 
@@ -512,36 +1144,121 @@ struct UnaryRequestContext : public RequestContext
     const void* processParam{nullptr};
 
     REQ req;
-    std::unique_ptr<::grpc::ServerAsyncResponseWriter<RESP>> resp_writer;
-    std::unique_ptr<Context> ctx;
+    REQ* reqPtr{&req};  // Points to req, or to the request created on the arena
+    RESP resp;
+    RESP* respPtr{&resp};   // Points to resp, or to the response created on the arena
+
+    // Response cache key of the call, if the response isn't cached yet (see BindOptions::cache)
+    std::string method;     // Full name of the RPC the responses are cached for
+    std::string cacheKey;
+    bool isCacheMiss{false};
+
+    // Note: The context and the response writer are re-constructed in place
+    // for every call, so serving a call doesn't allocate them on the heap.
+    std::optional<Context> ctx;
+    std::optional<::grpc::ServerAsyncResponseWriter<RESP>> resp_writer;
+
+    // Arena mode: Request and response messages are created on the arena,
+    // and freed all at once when the arena is reset for the next call.
+    // Note: The initial block of the arena is never freed by Reset().
+    std::unique_ptr<char[]> arenaBlock;
+    std::optional<google::protobuf::Arena> arena;
 
     void StartProcessing(::grpc::ServerCompletionQueue* cq) override
     {
         state = RequestContext::REQUEST;
-        ctx.reset(new Context(processParam));
-        resp_writer.reset(new ::grpc::ServerAsyncResponseWriter<RESP>(ctx.get()));
-        req.Clear();
+        resp_writer.reset();    // Note: The writer must not outlive its context
+        ctx.emplace(processParam, this);
+        resp_writer.emplace(&*ctx);
+        isCacheMiss = false;
+
+        if(arena)
+        {
+            arena->Reset();
+            reqPtr = google::protobuf::Arena::Create<REQ>(&*arena);
+        }
+        else
+        {
+            req.Clear();
+        }
 
         // *Request* that the system start processing given requests.
         // In this request, "this" acts as the tag uniquely identifying
         // the request (so that different context instances can serve
         // different requests concurrently), in this case the memory address
         // of this context instance.
-        (service->async.*requestFunc)(ctx.get(), &req, resp_writer.get(), cq, cq, this);
+        (service->async.*requestFunc)(&*ctx, reqPtr, &*resp_writer, cq, cq, this);
+    }
+
+    // Send the cached response (if any) right away
+    bool ProcessInline() override
+    {
+        ResponseCache* cache = options.cache.get();
+        if(!cache)
+            return false;
+
+        ::grpc::ByteBuffer cached;
+        cache->MakeKey(method, *reqPtr, *ctx, cacheKey);
+        if(!cache->Get(cacheKey, cached))
+        {
+            isCacheMiss = true;
+            return false;
+        }
+
+        // Note: The typed response writer serializes the response itself
+        if(PrepareResponse(); !ParseMessage(cached, *respPtr))
+            return false;
+
+        state = RequestContext::FINISH;
+        resp_writer->Finish(*respPtr, ::grpc::Status::OK, this);
+        return true;
+    }
+
+    void PrepareResponse()
+    {
+        if(arena)
+        {
+            respPtr = google::protobuf::Arena::Create<RESP>(&*arena);
+        }
+        else
+        {
+            resp.Clear();
+            respPtr = &resp;
+        }
     }
 
     void Process() override
     {
+        PrepareResponse();
+
         // The actual processing
-        RESP resp;
-        (service->*processFunc)(*ctx, req, resp);
+        // Note: The process function can defer the response until it's
+        // produced asynchronously (see Context::Defer())
+        holds = 1;
+        (service->*processFunc)(*ctx, *reqPtr, *respPtr);
+        if(--holds == 0)
+            Continue();
+    }
 
+    // Send the response.
+    // Note: Called on any thread if the process function has deferred it.
+    void Continue() override
+    {
         // And we are done!
         // Let the gRPC runtime know we've finished, using the memory address 
         // of this instance as the uniquely identifying tag for the event.
         state = RequestContext::FINISH;
 
-        resp_writer->Finish(resp, ctx->GetStatus(), this);
+        // Cache the response for the next calls with the same request
+        if(isCacheMiss && ctx->GetStatus().ok())
+        {
+            ::grpc::ByteBuffer buffer;
+            bool ownBuffer = false;
+            if(::grpc::SerializationTraits<RESP>::Serialize(*respPtr, &buffer, &ownBuffer).ok())
+                options.cache->Put(cacheKey, buffer);
+        }
+
+        resp_writer->Finish(*respPtr, ctx->GetStatus(), this);
     }
 
     void EndProcessing(::grpc::ServerCompletionQueue* cq, bool isError) override
@@ -555,9 +1272,6 @@ struct UnaryRequestContext : public RequestContext
 //                resp_writer->FinishWithError(grpcStatus, this);
             }
         }
-
-        // Ask the system start processing requests
-        StartProcessing(cq);
     }
 
     virtual RequestContext* Clone() override
@@ -565,6 +1279,8 @@ struct UnaryRequestContext : public RequestContext
         auto reqCtx = new (std::nothrow) UnaryRequestContext<RPC_SERVICE, REQ, RESP>(*this);
         if(!reqCtx)
             service->srv->OnError("Clone() out of memory allocating UnaryRequestContext");
+        else
+            slotAllocCount++;
         return reqCtx;
     }
 
@@ -573,10 +1289,15 @@ struct UnaryRequestContext : public RequestContext
 
 //
 // Template class to handle streaming respone
+// Note: In producer mode (see ServerStreamContext::GetWriter()) responses are
+// written from any thread through the write queue, and writes use their own
+// tags instead of the context address (see RequestContext::GetTag()).
 //
 template<typename RPC_SERVICE, typename REQ, typename RESP>
-struct ServerStreamRequestContext : public RequestContext
+struct ServerStreamRequestContext : public RequestContext, public StreamWriteQueue<RESP, ::grpc::ServerAsyncWriter<RESP>>
 {
+    using WriteQueue = StreamWriteQueue<RESP, ::grpc::ServerAsyncWriter<RESP>>;
+
     ServerStreamRequestContext(GrpcService<RPC_SERVICE>* service_,
                                ServerStreamRequestFunc<RPC_SERVICE, REQ, RESP> requestFunc_,
                                ServerStreamProcessFunc<RPC_SERVICE, REQ, RESP> processFunc_,
@@ -584,7 +1305,7 @@ struct ServerStreamRequestContext : public RequestContext
         : service(service_), requestFunc(requestFunc_), processFunc(processFunc_), processParam(processParam_) {}
 
     ServerStreamRequestContext(const ServerStreamRequestContext& req)
-        : service(req.service), requestFunc(req.requestFunc), processFunc(req.processFunc), processParam(req.processParam) {}
+        : RequestContext(req), service(req.service), requestFunc(req.requestFunc), processFunc(req.processFunc), processParam(req.processParam) {}
 
     ~ServerStreamRequestContext() = default;
 
@@ -600,15 +1321,25 @@ struct ServerStreamRequestContext : public RequestContext
     const void* processParam{nullptr};
 
     REQ req;
-    std::unique_ptr<::grpc::ServerAsyncWriter<RESP>> resp_writer;
-    std::unique_ptr<ServerStreamContext> ctx;
+    // Note: Re-constructed in place for every call (see UnaryRequestContext)
+    std::optional<ServerStreamContext> ctx;
+    std::optional<::grpc::ServerAsyncWriter<RESP>> resp_writer;
+
+    // Write-ahead mode: The response to write next, produced one call ahead
+    RESP pendingResp;
+    bool hasResp{false};
 
     void StartProcessing(::grpc::ServerCompletionQueue* cq) override
     {
         state = RequestContext::REQUEST;
-        ctx.reset(new ServerStreamContext(processParam));
-        resp_writer.reset(new ::grpc::ServerAsyncWriter<RESP>(ctx.get()));
+        resp_writer.reset();    // Note: The writer must not outlive its context
+        WriteQueue::Reset(this, options, service->srv->runThreads);
+        WriteQueue::isBusy = true;  // Until the process function switches to producer mode
+        ctx.emplace(processParam, this, WriteQueue::generation);
+        resp_writer.emplace(&*ctx);
+        WriteQueue::stream = &*resp_writer;
         req.Clear();
+        hasResp = false;
 
 //        // victor test
 //        TRACE("Calling requestFunc(), tag=" << this << ", state=" << GetStateStr());
@@ -618,7 +1349,7 @@ struct ServerStreamRequestContext : public RequestContext
         // the request (so that different context instances can serve
         // different requests concurrently), in this case the memory address
         // of this context instance.
-        (service->async.*requestFunc)(ctx.get(), &req, resp_writer.get(), cq, cq, this);
+        (service->async.*requestFunc)(&*ctx, &req, &*resp_writer, cq, cq, this);
     }
 
     void Process() override
@@ -629,10 +1360,23 @@ struct ServerStreamRequestContext : public RequestContext
             state = RequestContext::WRITE;
         }
 
+        if(options.writeAhead)
+        {
+            ProcessAhead();
+            return;
+        }
+
         // The actual processing
         RESP resp;
         (service->*processFunc)(*ctx, req, resp);
 
+        // Has the process function switched to producer mode?
+        if(ctx->isProducer)
+        {
+            StartProducer();
+            return;
+        }
+
         // Are there more responses to stream?
         if(ctx->streamHasMore)
         {
@@ -656,8 +1400,104 @@ struct ServerStreamRequestContext : public RequestContext
         }
     }
 
-    void EndProcessing(::grpc::ServerCompletionQueue* cq, bool isError) override
+    // Write-ahead mode: Call the process function one response ahead,
+    // so the last response can be written together with the status
+    void ProcessAhead()
     {
+        if(!hasResp)
+        {
+            // This is very first response
+            pendingResp.Clear();
+            (service->*processFunc)(*ctx, req, pendingResp);
+            if(ctx->isProducer)
+            {
+                StartProducer();
+                return;
+            }
+            else if(!ctx->streamHasMore)
+            {
+                // There are no responses at all
+                state = RequestContext::FINISH;
+                resp_writer->Finish(ctx->GetStatus(), this);
+                return;
+            }
+            hasResp = true;
+        }
+
+        RESP nextResp;
+        (service->*processFunc)(*ctx, req, nextResp);
+
+        if(ctx->isProducer)
+        {
+            // Note: The response we already have is queued by SetProducer()
+            StartProducer();
+        }
+        else if(!ctx->streamHasMore)
+        {
+            // It's the last response: write it together with the status
+            hasResp = false;
+            state = RequestContext::FINISH;
+            resp_writer->WriteAndFinish(pendingResp, ::grpc::WriteOptions(), ctx->GetStatus(), this);
+        }
+        else
+        {
+            // Note: The response is serialized by Write(), so it can be reused
+            resp_writer->Write(pendingResp, this);
+            pendingResp.Swap(&nextResp);
+        }
+    }
+
+    // AsyncStreamWriter implementation: The process function switches to producer mode.
+    // In write-ahead mode, queue the response we already have before the StreamWriter
+    // is handed out, so it's written first (even if the high-water mark is 1).
+    void SetProducer(uint64_t generation_) override
+    {
+        std::unique_lock<std::mutex> lock(WriteQueue::mtx);
+        if(generation_ != WriteQueue::generation || !hasResp)
+            return;
+
+        hasResp = false;
+        WriteQueue::queue.emplace_back().Swap(&pendingResp);
+        if(!WriteQueue::writing)
+            WriteQueue::StartWrite();
+    }
+
+    // Switch to producer mode.
+    // Note: No write is in flight at this point, so from now on
+    // the StreamWriter writes all the responses.
+    void StartProducer()
+    {
+        std::unique_lock<std::mutex> lock(WriteQueue::mtx);
+        WriteQueue::isBusy = false;
+        WriteQueue::StartFinish();
+    }
+
+    TagAction OnTagEvent(uintptr_t op, bool ok, bool isShutdown) override
+    {
+        // Completion of producer mode Write() or Finish()
+        std::unique_lock<std::mutex> lock(WriteQueue::mtx);
+        WriteQueue::isShutdown |= isShutdown;
+
+        if(op == TAG_WRITE)
+            WriteQueue::OnWriteDone(ok, lock);
+        else if(op == TAG_FINISH)
+            WriteQueue::OnFinishDone(ok);
+
+        return (WriteQueue::IsDone() ? TagAction::END : TagAction::NONE);
+    }
+
+    bool OnShutdown() override
+    {
+        // Is it an idle producer? (the stream is busy until it switches to producer mode)
+        std::unique_lock<std::mutex> lock(WriteQueue::mtx);
+        return (state != RequestContext::REQUEST && WriteQueue::ShutdownIfIdle());
+    }
+
+    void EndProcessing(::grpc::ServerCompletionQueue* cq, bool isError) override
+    {
+        if(ctx->isProducer)
+            isError |= (WriteQueue::isBroken || !WriteQueue::finished);
+
         if(isError)
         {
 //            const char* stateStr =
@@ -699,9 +1539,6 @@ struct ServerStreamRequestContext : public RequestContext
                << ", stream='Not Started', state=" << GetStateStr();
             service->srv->OnError(ss.str());
         }
-
-        // Ask the system start processing requests
-        StartProcessing(cq);
     }
 
     virtual RequestContext* Clone() override
@@ -709,6 +1546,8 @@ struct ServerStreamRequestContext : public RequestContext
         auto reqCtx = new (std::nothrow) ServerStreamRequestContext<RPC_SERVICE, REQ, RESP>(*this);
         if(!reqCtx)
             service->srv->OnError("Clone() out of memory allocating ServerStreamRequestContext");
+        else
+            slotAllocCount++;
         return reqCtx;
     }
 
@@ -728,7 +1567,7 @@ struct ClientStreamRequestContext : public RequestContext
         : service(service_), requestFunc(requestFunc_), processFunc(processFunc_), processParam(processParam_) {}
 
     ClientStreamRequestContext(const ClientStreamRequestContext& req)
-        : service(req.service), requestFunc(req.requestFunc), processFunc(req.processFunc), processParam(req.processParam) {}
+        : RequestContext(req), service(req.service), requestFunc(req.requestFunc), processFunc(req.processFunc), processParam(req.processParam) {}
 
     ~ClientStreamRequestContext() = default;
 
@@ -745,21 +1584,23 @@ struct ClientStreamRequestContext : public RequestContext
 
     REQ req;
     RESP resp;
-    std::unique_ptr<::grpc::ServerAsyncReader<RESP, REQ>> req_reader;
-    std::unique_ptr<ClientStreamContext> ctx;
+    // Note: Re-constructed in place for every call (see UnaryRequestContext)
+    std::optional<ClientStreamContext> ctx;
+    std::optional<::grpc::ServerAsyncReader<RESP, REQ>> req_reader;
 
     void StartProcessing(::grpc::ServerCompletionQueue* cq) override
     {
         state = RequestContext::REQUEST;
-        ctx.reset(new ClientStreamContext(processParam));
-        req_reader.reset(new ::grpc::ServerAsyncReader<RESP, REQ>(ctx.get()));
+        req_reader.reset();     // Note: The reader must not outlive its context
+        ctx.emplace(processParam, this);
+        req_reader.emplace(&*ctx);
 
         // *Request* that the system start processing given requests.
         // In this request, "this" acts as the tag uniquely identifying
         // the request (so that different context instances can serve
         // different requests concurrently), in this case the memory address
         // of this context instance.
-        (service->async.*requestFunc)(ctx.get(), req_reader.get(), cq, cq, this);
+        (service->async.*requestFunc)(&*ctx, &*req_reader, cq, cq, this);
     }
 
     void Process() override
@@ -776,12 +1617,39 @@ struct ClientStreamRequestContext : public RequestContext
             req.Clear();
             req_reader->Read(&req, this);
         }
-        else if(state == RequestContext::READ)
+        else if(state == RequestContext::READ || state == RequestContext::READEND)
         {
             //TRACE("this=" << this << ", READ COMPLETE");    // victor test
 
+            if(state == RequestContext::READEND)
+            {
+                req.Clear();
+                resp.Clear();
+                ctx->streamHasMore = false;
+            }
+
+            // Note: The process function can defer the next operation until
+            // the request is processed asynchronously (see Context::Defer())
+            holds = 1;
             (service->*processFunc)(*ctx, req, resp);
+            if(--holds == 0)
+                Continue();
+        }
+        else
+        {
+            //ERRORMSG("Invalid ClientStreamRequestContext::Process state() " << state); // victor test
 
+//            // TODO - handle errors
+//            serv->OnError("Invalid ClientStreamRequestContext::Process state() " + std::to_string(state));
+        }
+    }
+
+    // Start the operation that follows the process function.
+    // Note: Called on any thread if the process function has deferred it.
+    void Continue() override
+    {
+        if(state == RequestContext::READ)
+        {
             // Is processing failed?
             if(!ctx->GetStatus().ok())
             {
@@ -804,48 +1672,326 @@ struct ClientStreamRequestContext : public RequestContext
             //TRACE("this=" << this << ", READ END");     // victor test
 
             // And we are done!
-            req.Clear();
-            resp.Clear();
-            state = RequestContext::FINISH;
-            ctx->streamHasMore = false;
-            (service->*processFunc)(*ctx, req, resp);
-
             // Let the gRPC runtime know we've finished, using the
             // memory address of this instance as the uniquely identifying tag for
             // the event.
+            state = RequestContext::FINISH;
             req_reader->Finish(resp, ctx->GetStatus(), this);
         }
+    }
+
+    void EndProcessing(::grpc::ServerCompletionQueue* cq, bool isError) override
+    {
+        if(isError)
+        {
+            // TODO: Handle processing errors ...
+        }
+    }
+
+    virtual RequestContext* Clone() override
+    {
+        auto reqCtx = new (std::nothrow) ClientStreamRequestContext<RPC_SERVICE, REQ, RESP>(*this);
+        if(!reqCtx)
+            service->srv->OnError("Clone() out of memory allocating ClientStreamRequestContext");
         else
+            slotAllocCount++;
+        return reqCtx;
+    }
+
+    std::string_view GetRequestName() const override { return req.GetTypeName(); }
+};
+
+//
+// Template class to handle bidirectional streaming
+// Note: Unlike other contexts, it keeps a read and a write in flight at the same
+// time, so every operation has its own tag (see RequestContext::GetTag()), and
+// the slot is re-armed once none of them is in flight anymore.
+//
+template<typename RPC_SERVICE, typename REQ, typename RESP>
+struct BidiStreamRequestContext : public RequestContext, public StreamWriteQueue<RESP, ::grpc::ServerAsyncReaderWriter<RESP, REQ>>
+{
+    using WriteQueue = StreamWriteQueue<RESP, ::grpc::ServerAsyncReaderWriter<RESP, REQ>>;
+
+    BidiStreamRequestContext(GrpcService<RPC_SERVICE>* service_,
+                             BidiStreamRequestFunc<RPC_SERVICE, REQ, RESP> requestFunc_,
+                             BidiStreamProcessFunc<RPC_SERVICE, REQ, RESP> processFunc_,
+                             const void* processParam_)
+        : service(service_), requestFunc(requestFunc_), processFunc(processFunc_), processParam(processParam_) {}
+
+    BidiStreamRequestContext(const BidiStreamRequestContext& req)
+        : RequestContext(req), service(req.service), requestFunc(req.requestFunc), processFunc(req.processFunc), processParam(req.processParam) {}
+
+    ~BidiStreamRequestContext() = default;
+
+    GrpcService<RPC_SERVICE>* service{nullptr};
+
+    // Pointer to function that *request* the system to start processing given requests
+    BidiStreamRequestFunc<RPC_SERVICE, REQ, RESP> requestFunc{nullptr};
+
+    // Pointer to function that does actual processing
+    BidiStreamProcessFunc<RPC_SERVICE, REQ, RESP> processFunc{nullptr};
+
+    // Any application-level data assigned by AddRpcRequest.
+    const void* processParam{nullptr};
+
+    REQ req;
+    RESP resp;  // Scratch response for the process function to fill and Write()
+    // Note: Re-constructed in place for every call (see UnaryRequestContext)
+    std::optional<BidiStreamContext> ctx;
+    std::optional<::grpc::ServerAsyncReaderWriter<RESP, REQ>> stream;
+
+    // Note: Guarded by the write queue mutex. The write queue is busy
+    // while the process function is processing the last Read().
+    bool readOk{false};         // Result of the last Read()
+    bool reading{false};        // Read() is in flight
+
+    void StartProcessing(::grpc::ServerCompletionQueue* cq) override
+    {
+        state = RequestContext::REQUEST;
+        stream.reset();     // Note: The stream must not outlive its context
+        WriteQueue::Reset(this, options, service->srv->runThreads);
+        ctx.emplace(processParam, this, WriteQueue::generation);
+        stream.emplace(&*ctx);
+        WriteQueue::stream = &*stream;
+        req.Clear();
+        readOk = reading = false;
+
+        // *Request* that the system start processing given requests.
+        // In this request, "this" acts as the tag uniquely identifying
+        // the request (so that different context instances can serve
+        // different requests concurrently), in this case the memory address
+        // of this context instance.
+        (service->async.*requestFunc)(&*ctx, &*stream, cq, cq, GetTag(TAG_MAIN));
+    }
+
+    void Process() override
+    {
+        if(state == RequestContext::REQUEST)
         {
-            //ERRORMSG("Invalid ClientStreamRequestContext::Process state() " << state); // victor test
+            // This is very first Process call for the given request: start reading
+            state = RequestContext::READ;
+            std::unique_lock<std::mutex> lock(WriteQueue::mtx);
+            StartRead();
+            return;
+        }
 
-//            // TODO - handle errors
-//            serv->OnError("Invalid ClientStreamRequestContext::Process state() " + std::to_string(state));
+        // Completion of Read()
+        // Note: The next Read() isn't started until the process function
+        // returns, so it's never called concurrently for the same stream.
+        ctx->streamHasMore = readOk;
+        if(!readOk)
+            req.Clear();
+        resp.Clear();
+        (service->*processFunc)(*ctx, req, resp);
+
+        std::unique_lock<std::mutex> lock(WriteQueue::mtx);
+        if(readOk && !WriteQueue::finishRequested)
+            StartRead();
+        WriteQueue::isBusy = false;
+        WriteQueue::StartFinish();
+    }
+
+    TagAction OnTagEvent(uintptr_t op, bool ok, bool isShutdown) override
+    {
+        std::unique_lock<std::mutex> lock(WriteQueue::mtx);
+        WriteQueue::isShutdown |= isShutdown;
+
+        switch(op)
+        {
+        case TAG_READ:
+            // Process the request unless the stream is already ending
+            reading = false;
+            if(readOk = ok; !WriteQueue::isShutdown && !WriteQueue::finishRequested)
+            {
+                WriteQueue::isBusy = true;
+                return TagAction::DISPATCH;
+            }
+            break;
+
+        case TAG_WRITE:
+            WriteQueue::OnWriteDone(ok, lock);
+            break;
+
+        case TAG_FINISH:
+            WriteQueue::OnFinishDone(ok);
+            break;
+
+        default:
+            break;
         }
+
+        // Is the stream done?
+        return (!reading && WriteQueue::IsDone() ? TagAction::END : TagAction::NONE);
+    }
+
+    bool OnShutdown() override
+    {
+        // Is the stream done reading, and its writer idle?
+        std::unique_lock<std::mutex> lock(WriteQueue::mtx);
+        return (state != RequestContext::REQUEST && !reading && WriteQueue::ShutdownIfIdle());
     }
 
     void EndProcessing(::grpc::ServerCompletionQueue* cq, bool isError) override
     {
+        if(state == RequestContext::REQUEST)
+            return;     // The stream has never started
+
+        isError |= (WriteQueue::isBroken || !WriteQueue::finished);
         if(isError)
         {
-            // TODO: Handle processing errors ...
+            std::stringstream ss;
+            ss << __func__ << ':' << __LINE__ << ' '
+               << "Bidirectional streaming failed for tag=" << this << ", req=" << GetRequestName()
+               << ", streamParam=" << ctx->streamParam << ", state=" << GetStateStr();
+            service->srv->OnError(ss.str());
         }
 
-        // Ask the system start processing requests
-        StartProcessing(cq);
+        // End processing
+        ctx->streamStatus = (isError ? StreamStatus::ERROR : StreamStatus::SUCCESS);
+        ctx->streamHasMore = false;
+        req.Clear();
+        RESP respDummy;
+        (service->*processFunc)(*ctx, req, respDummy);
+    }
+
+    // Start reading (called with the write queue mutex locked)
+    void StartRead()
+    {
+        reading = true;
+        req.Clear();
+        stream->Read(&req, GetTag(TAG_READ));
     }
 
     virtual RequestContext* Clone() override
     {
-        auto reqCtx = new (std::nothrow) ClientStreamRequestContext<RPC_SERVICE, REQ, RESP>(*this);
+        auto reqCtx = new (std::nothrow) BidiStreamRequestContext<RPC_SERVICE, REQ, RESP>(*this);
         if(!reqCtx)
-            service->srv->OnError("Clone() out of memory allocating ClientStreamRequestContext");
+            service->srv->OnError("Clone() out of memory allocating BidiStreamRequestContext");
+        else
+            slotAllocCount++;
         return reqCtx;
     }
 
     std::string_view GetRequestName() const override { return req.GetTypeName(); }
 };
 
+//
+// Class to handle generic calls: any method that isn't bound by a GrpcService,
+// with the raw request and response messages (see GrpcGenericService).
+// Note: gRpc serves generic calls as bidirectional streams. They are handled
+// as unary calls here: one request is read, and one response is written
+// together with the status.
+//
+struct GenericRequestContext : public RequestContext
+{
+    GenericRequestContext(GrpcGenericService* service_, GenericProcessFunc processFunc_, const void* processParam_)
+        : service(service_), processFunc(processFunc_), processParam(processParam_) {}
+
+    GenericRequestContext(const GenericRequestContext& req)
+        : RequestContext(req), service(req.service), processFunc(req.processFunc), processParam(req.processParam) {}
+
+    virtual ~GenericRequestContext() = default;
+
+    GrpcGenericService* service{nullptr};
+
+    // Pointer to function that does actual processing
+    GenericProcessFunc processFunc{nullptr};
+
+    // Any application-level data assigned by Bind()
+    const void* processParam{nullptr};
+
+    ::grpc::ByteBuffer req;
+    ::grpc::ByteBuffer resp;
+
+    // Response cache key of the call, if the response isn't cached yet (see BindOptions::cache)
+    std::string cacheKey;
+    bool isCacheMiss{false};
+
+    // Note: The context and the stream are re-constructed in place for every call
+    std::optional<GenericContext> ctx;
+    std::optional<::grpc::GenericServerAsyncReaderWriter> stream;
+
+    void StartProcessing(::grpc::ServerCompletionQueue* cq) override;
+
+    // Send the cached response (if any) as soon as the request is read
+    bool ProcessInline() override
+    {
+        ResponseCache* cache = options.cache.get();
+        if(!cache || state != RequestContext::READ)
+            return false;
+
+        cache->MakeKey(ctx->GetMethod(), req, ctx->serverContext, cacheKey);
+        if(!cache->Get(cacheKey, resp))
+        {
+            isCacheMiss = true;
+            return false;
+        }
+
+        state = RequestContext::FINISH;
+        stream->WriteAndFinish(resp, ::grpc::WriteOptions(), ::grpc::Status::OK, this);
+        return true;
+    }
+
+    void Process() override
+    {
+        switch(state)
+        {
+        case RequestContext::REQUEST:
+            // The call has started: read the request
+            state = RequestContext::READ;
+            stream->Read(&req, this);
+            break;
+
+        case RequestContext::READ:
+            // The actual processing
+            // Note: The process function can defer the response until it's
+            // produced asynchronously (see GenericContext::Defer())
+            resp.Clear();
+            holds = 1;
+            (service->*processFunc)(*ctx, req, resp);
+            if(--holds == 0)
+                Continue();
+            break;
+
+        default:
+            // The client is done writing without sending a request
+            state = RequestContext::FINISH;
+            stream->Finish(::grpc::Status(grpc::StatusCode::INTERNAL, "No request message"), this);
+            break;
+        }
+    }
+
+    // Send the response.
+    // Note: Called on any thread if the process function has deferred it.
+    void Continue() override
+    {
+        state = RequestContext::FINISH;
+
+        if(const ::grpc::Status& status = ctx->GetStatus(); !status.ok())
+        {
+            stream->Finish(status, this);
+        }
+        else
+        {
+            // Note: An empty message is a valid response, a null buffer is not
+            if(!resp.Valid())
+                resp = ::grpc::ByteBuffer(nullptr, 0);
+
+            // Cache the response for the next calls with the same request
+            if(isCacheMiss)
+                options.cache->Put(cacheKey, resp);
+
+            stream->WriteAndFinish(resp, ::grpc::WriteOptions(), status, this);
+        }
+    }
+
+    void EndProcessing(::grpc::ServerCompletionQueue* cq, bool isError) override {}
+
+    RequestContext* Clone() override;
+
+    std::string_view GetRequestName() const override { return ctx ? std::string_view(ctx->GetMethod()) : "GenericCall"; }
+};
+
 //
 // Template implementation of service-specific GrpcService class
 //
@@ -870,27 +2016,45 @@ public:
     // Add request for unary RPC
     template<typename REQ, typename RESP, typename SERVICE_IMPL, typename REQUEST_FUNC>
     void Bind(void (SERVICE_IMPL::*processFunc)(const Context&, const REQ&, RESP&),
-              REQUEST_FUNC requestFunc, const void* processParam = nullptr)
+              REQUEST_FUNC requestFunc, const void* processParam = nullptr,
+              const BindOptions& options = BindOptions())
     {
         // Bind RPC-specific grpc service with the corresponding processing function.
         auto ctx = new (std::nothrow) UnaryRequestContext<RPC_SERVICE, REQ, RESP>(
             this, requestFunc, (UnaryProcessFunc<RPC_SERVICE, REQ, RESP>)processFunc, processParam);
-        if(ctx)
-            srv->AddRpcRequest(ctx);
-        else
+        if(!ctx)
+        {
             srv->OnError("Bind() out of memory allocating UnaryRequestContext");
+            return;
+        }
+
+        if(options.cache)
+        {
+            // Note: The cached responses of the RPCs with the same request must not mix
+            ctx->method = FindUnaryMethod(service_full_name(), REQ::descriptor(), RESP::descriptor(), options.method);
+            if(ctx->method.empty())
+            {
+                srv->OnError(options.method.empty() ?
+                    std::string("Bind() can't tell which unary RPC of ") + service_full_name() + " is cached (set BindOptions::method)" :
+                    std::string("Bind() can't find the unary RPC ") + service_full_name() + "/" + options.method + " to cache");
+                delete ctx;
+                return;
+            }
+        }
+        srv->AddRpcRequest(ctx, options);
     }
 
     // Add request for server-stream RPC
     template<typename REQ, typename RESP, typename SERVICE_IMPL, typename REQUEST_FUNC>
     void Bind(void (SERVICE_IMPL::*processFunc)(const ServerStreamContext&, const REQ&, RESP&),
-              REQUEST_FUNC requestFunc, const void* processParam = nullptr)
+              REQUEST_FUNC requestFunc, const void* processParam = nullptr,
+              const BindOptions& options = BindOptions())
     {
         // Bind RPC-specific grpc service with the corresponding processing function.
         auto ctx = new (std::nothrow) ServerStreamRequestContext<RPC_SERVICE, REQ, RESP>
             (this, requestFunc, (ServerStreamProcessFunc<RPC_SERVICE, REQ, RESP>)processFunc, processParam);
         if(ctx)
-            srv->AddRpcRequest(ctx);
+            srv->AddRpcRequest(ctx, options);
         else
             srv->OnError("Bind() out of memory allocating ServerStreamRequestContext");
     }
@@ -898,17 +2062,33 @@ public:
     // Add request for client-stream RPC
     template<typename REQ, typename RESP, typename SERVICE_IMPL, typename REQUEST_FUNC>
     void Bind(void (SERVICE_IMPL::*processFunc)(const ClientStreamContext&, const REQ&, RESP&),
-              REQUEST_FUNC requestFunc, const void* processParam = nullptr)
+              REQUEST_FUNC requestFunc, const void* processParam = nullptr,
+              const BindOptions& options = BindOptions())
     {
         // Bind RPC-specific grpc service with the corresponding processing function.
         auto ctx = new (std::nothrow) ClientStreamRequestContext<RPC_SERVICE, REQ, RESP>
             (this, requestFunc, (ClientStreamProcessFunc<RPC_SERVICE, REQ, RESP>)processFunc, processParam);
         if(ctx)
-            srv->AddRpcRequest(ctx);
+            srv->AddRpcRequest(ctx, options);
         else
             srv->OnError("Bind() out of memory allocating ClientStreamRequestContext");
     }
 
+    // Add request for bidirectional-stream RPC
+    template<typename REQ, typename RESP, typename SERVICE_IMPL, typename REQUEST_FUNC>
+    void Bind(void (SERVICE_IMPL::*processFunc)(const BidiStreamContext&, const REQ&, RESP&),
+              REQUEST_FUNC requestFunc, const void* processParam = nullptr,
+              const BindOptions& options = BindOptions())
+    {
+        // Bind RPC-specific grpc service with the corresponding processing function.
+        auto ctx = new (std::nothrow) BidiStreamRequestContext<RPC_SERVICE, REQ, RESP>
+            (this, requestFunc, (BidiStreamProcessFunc<RPC_SERVICE, REQ, RESP>)processFunc, processParam);
+        if(ctx)
+            srv->AddRpcRequest(ctx, options);
+        else
+            srv->OnError("Bind() out of memory allocating BidiStreamRequestContext");
+    }
+
 protected:
     typename RPC_SERVICE::AsyncService async;
     GrpcServer* srv{nullptr};
@@ -923,8 +2103,93 @@ protected:
 
     template<typename RPC_SERVICE_, typename REQ, typename RESP>
     friend struct ClientStreamRequestContext;
+
+    template<typename RPC_SERVICE_, typename REQ, typename RESP>
+    friend struct BidiStreamRequestContext;
 };
 
+//
+// Generic service: serves the calls of all the methods that aren't bound by
+// any GrpcService (catch-all), with the raw request and response messages,
+// so there is no protobuf parsing and serializing (e.g. to serve responses
+// serialized in advance). The process function gets the method called with
+// GenericContext::GetMethod().
+// Note: A server can have only one generic service.
+//
+class GrpcGenericService : public GrpcServiceBase
+{
+public:
+    GrpcGenericService() = default;
+    virtual ~GrpcGenericService() = default;
+
+    static constexpr char const* service_full_name() { return "GenericService"; }
+
+    const char* GetName() override { return service_full_name(); }
+
+    ::grpc::Service* GetService() override { return nullptr; }
+
+    // Get the actual AsyncGenericService
+    ::grpc::AsyncGenericService* GetGenericService() override { return &generic; }
+
+    // Add request for generic calls.
+    // Note: All the calls are served by a single process function.
+    template<typename SERVICE_IMPL>
+    void Bind(void (SERVICE_IMPL::*processFunc)(const GenericContext&, const ::grpc::ByteBuffer&, ::grpc::ByteBuffer&),
+              const void* processParam = nullptr, const BindOptions& options = BindOptions())
+    {
+        if(isBound)
+        {
+            srv->OnError("Bind() can be called only once for a generic service");
+            return;
+        }
+
+        auto ctx = new (std::nothrow) GenericRequestContext(this, (GenericProcessFunc)processFunc, processParam);
+        if(ctx)
+        {
+            srv->AddRpcRequest(ctx, options);
+            isBound = true;
+        }
+        else
+        {
+            srv->OnError("Bind() out of memory allocating GenericRequestContext");
+        }
+    }
+
+protected:
+    ::grpc::AsyncGenericService generic;
+    GrpcServer* srv{nullptr};
+    bool isBound{false};
+
+    friend class GrpcServer;
+    friend struct GenericRequestContext;
+};
+
+//
+// GenericRequestContext class implementation
+//
+inline void GenericRequestContext::StartProcessing(::grpc::ServerCompletionQueue* cq)
+{
+    state = RequestContext::REQUEST;
+    stream.reset();     // Note: The stream must not outlive its context
+    ctx.emplace(processParam, this);
+    stream.emplace(&ctx->serverContext);
+    req.Clear();
+    isCacheMiss = false;
+
+    // *Request* that the system start processing the next generic call
+    service->generic.RequestCall(&ctx->serverContext, &*stream, cq, cq, this);
+}
+
+inline RequestContext* GenericRequestContext::Clone()
+{
+    auto reqCtx = new (std::nothrow) GenericRequestContext(*this);
+    if(!reqCtx)
+        service->srv->OnError("Clone() out of memory allocating GenericRequestContext");
+    else
+        slotAllocCount++;
+    return reqCtx;
+}
+
 } //namespace gen
 
 
@@ -9,6 +9,7 @@
 #pragma GCC diagnostic ignored "-Wunused-parameter"
 #include <grpcpp/grpcpp.h>
 #include <google/protobuf/util/json_util.h> // Protobuf to/from Json support
+#include <google/protobuf/descriptor.h>     // Service descriptors
 #pragma GCC diagnostic pop
 
 #include <fstream>  // std::istream
@@ -96,6 +97,43 @@ inline bool IsLocalhost(const std::string& ipAddr)
     return isLocalHost;
 }
 
+// Get the full name of a unary RPC of a service (e.g. "/test.Hello/Ping") out of the generated
+// descriptors: The RPC with that name (if not empty), or else the only unary RPC with these
+// request and response types. Return an empty string if there is no such RPC, or more than one.
+// Note: Descriptor names are absl::string_view in the recent protobuf versions.
+inline std::string FindUnaryMethod(const char* serviceName,
+                                   const google::protobuf::Descriptor* reqType,
+                                   const google::protobuf::Descriptor* respType,
+                                   const std::string& methodName = std::string())
+{
+    const google::protobuf::MethodDescriptor* found = nullptr;
+    int matches = 0;
+
+    const google::protobuf::ServiceDescriptor* service =
+        google::protobuf::DescriptorPool::generated_pool()->FindServiceByName(serviceName);
+    for(int i = 0; service && i < service->method_count(); i++)
+    {
+        const google::protobuf::MethodDescriptor* method = service->method(i);
+        if(!methodName.empty() &&
+           std::string_view(method->name().data(), method->name().size()) != methodName)
+            continue;
+
+        if(method->input_type() == reqType && method->output_type() == respType &&
+           !method->client_streaming() && !method->server_streaming())
+        {
+            found = method;
+            matches++;
+        }
+    }
+
+    if(matches != 1)
+        return std::string();
+
+    std::string name = std::string("/") + serviceName + "/";
+    name.append(found->name().data(), found->name().size());
+    return name;
+}
+
 // Build SSL/TLS Channel and Server credentials
 inline bool LoadFile(const std::string& fileName, std::string& buf, std::string& errMsg)
 {
@@ -0,0 +1,184 @@
+// *INDENT-OFF*
+//
+// hedgingPolicy.hpp
+//
+#ifndef __HEDGING_POLICY_HPP__
+#define __HEDGING_POLICY_HPP__
+
+#include "callBudget.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <mutex>
+
+namespace gen {
+
+struct HedgingOptions
+{
+    // Hedge once the call hasn't responded after that percentile of the observed
+    // latencies, but never sooner than minDelay or later than maxDelay.
+    // Note: Until minSamples latencies are observed, the delay is maxDelay.
+    double percentile{0.95};
+    std::chrono::milliseconds minDelay{2};
+    std::chrono::milliseconds maxDelay{1000};
+    unsigned minSamples{100};
+
+    // The latencies are observed over the last one or two windows
+    std::chrono::milliseconds window{10000};
+
+    // Budget: At most that many hedges per call on average (e.g. 0.1 is 10%),
+    // with bursts of up to maxBurst hedges (see CallBudget)
+    double budget{0.1};
+    unsigned maxBurst{10};
+};
+
+//
+// Hedging policy of a unary RPC (see GrpcClient::Call() and GrpcRouter::Forward()):
+// If a call hasn't responded after the hedging delay, a second attempt is sent, and
+// the first response wins. The delay is derived from the latencies of the RPC, so only
+// the slowest calls are hedged, and the budget caps the extra load on the target.
+// Note: Only hedge idempotent (e.g. read-only) RPCs. Use a policy per RPC, since the
+// latencies of different RPCs don't mix.
+//
+class HedgingPolicy
+{
+public:
+    HedgingPolicy() = default;
+    explicit HedgingPolicy(const HedgingOptions& options) : mOptions(options) {}
+    ~HedgingPolicy() = default;
+
+    // A call is starting: Return its hedging delay
+    std::chrono::microseconds OnCall();
+
+    // May the call be hedged? (Takes a hedge out of the budget)
+    bool TryHedge();
+
+    // Record the latency of a successful attempt
+    void OnLatency(std::chrono::microseconds latency);
+
+    uint64_t GetCalls() const { return mCalls; }
+    uint64_t GetHedges() const { return mHedges; }
+    std::chrono::microseconds GetDelay() const { return std::chrono::microseconds(mDelayUs); }
+
+private:
+    HedgingPolicy(const HedgingPolicy&) = delete;
+    HedgingPolicy& operator=(const HedgingPolicy&) = delete;
+
+    using Clock = std::chrono::steady_clock;
+
+    // Latency histogram: 4 buckets per power of two of microseconds (up to ~1 hour)
+    static constexpr int kSubBuckets = 4;
+    static constexpr int kBuckets = 32 * kSubBuckets;
+
+    static int GetBucket(uint64_t us)
+    {
+        if(us < kSubBuckets)
+            return (int)us;
+        int msb = 63 - __builtin_clzll(us);
+        int bucket = msb * kSubBuckets + (int)((us >> (msb - 2)) & (kSubBuckets - 1));
+        return std::min(bucket, kBuckets - 1);
+    }
+
+    // Upper bound (in microseconds) of the latencies of the bucket
+    static uint64_t GetBucketLimit(int bucket)
+    {
+        if(bucket < kSubBuckets)
+            return bucket + 1;
+        int msb = bucket / kSubBuckets;
+        return (uint64_t(kSubBuckets + bucket % kSubBuckets + 1) << (msb - 2));
+    }
+
+    void UpdateDelay();
+
+    HedgingOptions mOptions;
+    CallBudget mBudget{mOptions.budget, mOptions.maxBurst};
+
+    // Two windows of latencies: the current one, and the previous one
+    std::atomic<uint32_t> mHistograms[2][kBuckets] = {};
+    std::atomic<int> mCurrent{0};
+    std::atomic<uint32_t> mSamples{0};      // Samples since the delay was updated
+    std::mutex mWindowMtx;
+    Clock::time_point mWindowStart{Clock::now()};
+
+    std::atomic<int64_t> mDelayUs{std::chrono::microseconds(mOptions.maxDelay).count()};
+    std::atomic<uint64_t> mCalls{0};
+    std::atomic<uint64_t> mHedges{0};
+};
+
+//
+// HedgingPolicy class implementation
+//
+inline std::chrono::microseconds HedgingPolicy::OnCall()
+{
+    mCalls++;
+    mBudget.OnCall();
+    return std::chrono::microseconds(mDelayUs);
+}
+
+inline bool HedgingPolicy::TryHedge()
+{
+    if(!mBudget.TryTake())
+        return false;
+
+    mHedges++;
+    return true;
+}
+
+inline void HedgingPolicy::OnLatency(std::chrono::microseconds latency)
+{
+    mHistograms[mCurrent][GetBucket(std::max<int64_t>(latency.count(), 0))]++;
+
+    // Note: The percentile is only computed every so often
+    if(++mSamples % 64 == 0)
+        UpdateDelay();
+}
+
+inline void HedgingPolicy::UpdateDelay()
+{
+    std::unique_lock<std::mutex> lock(mWindowMtx, std::try_to_lock);
+    if(!lock.owns_lock())
+        return;
+
+    // Start a new window once the current one is over
+    Clock::time_point now = Clock::now();
+    if(now - mWindowStart >= mOptions.window)
+    {
+        int previous = 1 - mCurrent;
+        for(std::atomic<uint32_t>& count : mHistograms[previous])
+            count = 0;
+        mCurrent = previous;
+        mWindowStart = now;
+    }
+
+    uint64_t counts[kBuckets];
+    uint64_t total = 0;
+    for(int bucket = 0; bucket < kBuckets; bucket++)
+    {
+        counts[bucket] = mHistograms[0][bucket] + mHistograms[1][bucket];
+        total += counts[bucket];
+    }
+
+    int64_t delayUs = std::chrono::microseconds(mOptions.maxDelay).count();
+    if(total >= mOptions.minSamples)
+    {
+        uint64_t rank = (uint64_t)std::ceil(mOptions.percentile * total);
+        uint64_t count = 0;
+        for(int bucket = 0; bucket < kBuckets; bucket++)
+        {
+            if(count += counts[bucket]; count >= rank)
+            {
+                delayUs = (int64_t)GetBucketLimit(bucket);
+                break;
+            }
+        }
+        delayUs = std::clamp<int64_t>(delayUs, std::chrono::microseconds(mOptions.minDelay).count(),
+                                      std::chrono::microseconds(mOptions.maxDelay).count());
+    }
+    mDelayUs = delayUs;
+}
+
+} //namespace gen
+
+#endif // __HEDGING_POLICY_HPP__
+// *INDENT-ON*
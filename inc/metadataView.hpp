@@ -0,0 +1,145 @@
+// *INDENT-OFF*
+//
+// metadataView.hpp
+//
+#ifndef __METADATA_VIEW_HPP__
+#define __METADATA_VIEW_HPP__
+
+#include <grpcpp/support/string_ref.h>  // grpc::string_ref
+#include <algorithm>
+#include <cctype>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace gen {
+
+//
+// Flat view of metadata: the (key, value) pairs refer to the strings of the metadata
+// they are taken from (e.g. the client metadata of a server call), and up to kInlineSize
+// pairs are stored inline, so building the view doesn't allocate.
+// Note: The viewed strings must outlive the view. A std::map converts to a view, so
+// the calls that take a view can be given a map.
+//
+class MetadataView
+{
+public:
+    using Entry = std::pair<grpc::string_ref, grpc::string_ref>;
+
+    MetadataView() = default;
+    MetadataView(const std::map<std::string, std::string>& metadata)
+    {
+        for(const auto& [key, value] : metadata)
+            Add(key, value);
+    }
+    ~MetadataView() = default;
+
+    void Add(grpc::string_ref key, grpc::string_ref value)
+    {
+        if(mSize < kInlineSize)
+        {
+            mInline[mSize++] = { key, value };
+            return;
+        }
+
+        // Note: The pairs move to the heap once there are too many of them to be inline
+        if(mOverflow.empty())
+            mOverflow.assign(mInline, mInline + kInlineSize);
+        mOverflow.emplace_back(key, value);
+        mSize++;
+    }
+
+    // Get the value of the first pair with that key (empty if there is none)
+    grpc::string_ref Find(grpc::string_ref key) const
+    {
+        for(const Entry& entry : *this)
+        {
+            if(entry.first == key)
+                return entry.second;
+        }
+        return {};
+    }
+
+    const Entry* begin() const { return GetData(); }
+    const Entry* end() const { return GetData() + mSize; }
+    size_t size() const { return mSize; }
+    bool empty() const { return mSize == 0; }
+
+    void clear()
+    {
+        mOverflow.clear();
+        mSize = 0;
+    }
+
+private:
+    // Do not allow copy constructor and assignment operator (prevent class copy)
+    MetadataView(const MetadataView&) = delete;
+    MetadataView& operator=(const MetadataView&) = delete;
+
+    const Entry* GetData() const { return (mOverflow.empty() ? mInline : mOverflow.data()); }
+
+    static constexpr size_t kInlineSize = 16;
+
+    Entry mInline[kInlineSize];
+    std::vector<Entry> mOverflow;
+    size_t mSize{0};
+};
+
+//
+// Allow-list of metadata keys, compiled once (e.g. by GrpcRouter::SetMetadataAllowList()):
+// A key is allowed if it's in the list, or if it starts with a prefix of the list (an
+// entry that ends with '*', e.g. "x-trace-*"). An empty list allows every key.
+// Note: gRpc metadata keys are lowercase, so the list is lowercased.
+//
+class MetadataFilter
+{
+public:
+    MetadataFilter() = default;
+    explicit MetadataFilter(const std::vector<std::string>& allowList)
+    {
+        for(std::string key : allowList)
+        {
+            std::transform(key.begin(), key.end(), key.begin(), [](unsigned char c) { return (char)std::tolower(c); });
+            if(!key.empty() && key.back() == '*')
+            {
+                key.pop_back();
+                mPrefixes.push_back(key);
+            }
+            else
+            {
+                mKeys.push_back(key);
+            }
+        }
+        std::sort(mKeys.begin(), mKeys.end());
+    }
+    ~MetadataFilter() = default;
+
+    bool IsAllowed(grpc::string_ref key) const
+    {
+        if(IsEmpty())
+            return true;
+
+        auto less = [](grpc::string_ref x, grpc::string_ref y) { return x < y; };
+        if(std::binary_search(mKeys.begin(), mKeys.end(), key, less))
+            return true;
+
+        for(const std::string& prefix : mPrefixes)
+        {
+            if(key.starts_with(prefix))
+                return true;
+        }
+        return false;
+    }
+
+    bool IsEmpty() const { return mKeys.empty() && mPrefixes.empty(); }
+
+private:
+    std::vector<std::string> mKeys;     // Sorted
+    std::vector<std::string> mPrefixes;
+};
+
+} //namespace gen
+
+#endif // __METADATA_VIEW_HPP__
+// *INDENT-ON*
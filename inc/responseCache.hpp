@@ -0,0 +1,195 @@
+// *INDENT-OFF*
+//
+// responseCache.hpp
+//
+#ifndef __RESPONSE_CACHE_HPP__
+#define __RESPONSE_CACHE_HPP__
+
+#include "grpcContext.hpp"  // AppendCallKey
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace gen {
+//
+// Cache of serialized responses of idempotent unary RPCs (see BindOptions::cache).
+// Responses are keyed by the method, the serialized request and the values of the
+// selected metadata keys, so the cache can be shared by any RPCs. They are kept
+// until they expire (TTL) or until they are evicted by the least recently used
+// policy once the cache is full (maxBytes).
+// The cache is split into shards with their own lock and LRU list, so calls
+// served by different threads don't contend for the same lock.
+// Note: Only successful (grpc::OK) responses are cached.
+//
+class ResponseCache
+{
+public:
+    ResponseCache(size_t maxBytes, std::chrono::milliseconds ttl,
+                  const std::vector<std::string>& metadataKeys = {}, size_t shardCount = 16);
+    ~ResponseCache() = default;
+
+    // Make the key of a typed request / a raw (generic) request of the method
+    // (its full name, e.g. "/test.Hello/Ping")
+    void MakeKey(std::string_view method, const google::protobuf::Message& req,
+                 const ::grpc::ServerContextBase& ctx, std::string& key) const;
+    void MakeKey(std::string_view method, const ::grpc::ByteBuffer& req,
+                 const ::grpc::ServerContextBase& ctx, std::string& key) const;
+
+    // Get the response cached for the key. Return false on a miss.
+    // Note: Copying a ByteBuffer doesn't copy the message data.
+    bool Get(const std::string& key, ::grpc::ByteBuffer& resp);
+
+    // Cache the response for the key
+    void Put(const std::string& key, const ::grpc::ByteBuffer& resp);
+
+    // Remove all the responses
+    void Clear();
+
+    uint64_t GetHits() const { return mHits; }
+    uint64_t GetMisses() const { return mMisses; }
+    size_t GetBytes() const { return mBytes; }
+
+private:
+    ResponseCache(const ResponseCache&) = delete;
+    ResponseCache& operator=(const ResponseCache&) = delete;
+
+    using Clock = std::chrono::steady_clock;
+
+    struct Entry
+    {
+        std::string key;
+        ::grpc::ByteBuffer resp;
+        Clock::time_point expiry;
+        size_t bytes{0};
+    };
+
+    struct Shard
+    {
+        std::mutex mtx;
+        std::list<Entry> lru;   // Most recently used first
+        std::unordered_map<std::string_view, std::list<Entry>::iterator> map;  // Note: Keys point into lru
+        size_t bytes{0};
+    };
+
+    Shard& GetShard(const std::string& key) { return *mShards[std::hash<std::string>()(key) % mShards.size()]; }
+    void Erase(Shard& shard, std::list<Entry>::iterator itr);
+
+    std::vector<std::unique_ptr<Shard>> mShards;
+    size_t mShardBytes{0};                  // Max number of bytes per shard
+    std::chrono::milliseconds mTtl;
+    std::vector<std::string> mMetadataKeys; // Metadata the responses depend on
+
+    std::atomic<uint64_t> mHits{0};
+    std::atomic<uint64_t> mMisses{0};
+    std::atomic<size_t> mBytes{0};
+};
+
+//
+// ResponseCache class implementation
+//
+inline ResponseCache::ResponseCache(size_t maxBytes, std::chrono::milliseconds ttl,
+                                    const std::vector<std::string>& metadataKeys, size_t shardCount)
+    : mTtl(ttl), mMetadataKeys(metadataKeys)
+{
+    shardCount = std::max<size_t>(shardCount, 1);
+    for(size_t i = 0; i < shardCount; i++)
+        mShards.emplace_back(new Shard);
+    mShardBytes = maxBytes / shardCount;
+}
+
+inline void ResponseCache::MakeKey(std::string_view method, const google::protobuf::Message& req,
+                                   const ::grpc::ServerContextBase& ctx, std::string& key) const
+{
+    key.assign(method).push_back('\0');
+    AppendCallKey(key, ctx, mMetadataKeys);
+    AppendCallKey(key, req);
+}
+
+inline void ResponseCache::MakeKey(std::string_view method, const ::grpc::ByteBuffer& req,
+                                   const ::grpc::ServerContextBase& ctx, std::string& key) const
+{
+    key.assign(method).push_back('\0');
+    AppendCallKey(key, ctx, mMetadataKeys);
+    AppendCallKey(key, req);
+}
+
+inline bool ResponseCache::Get(const std::string& key, ::grpc::ByteBuffer& resp)
+{
+    Shard& shard = GetShard(key);
+    std::unique_lock<std::mutex> lock(shard.mtx);
+
+    auto itr = shard.map.find(key);
+    if(itr == shard.map.end())
+    {
+        mMisses++;
+        return false;
+    }
+
+    if(Clock::now() >= itr->second->expiry)
+    {
+        Erase(shard, itr->second);
+        mMisses++;
+        return false;
+    }
+
+    // Move the entry to the front of the LRU list
+    shard.lru.splice(shard.lru.begin(), shard.lru, itr->second);
+    resp = itr->second->resp;
+    mHits++;
+    return true;
+}
+
+inline void ResponseCache::Put(const std::string& key, const ::grpc::ByteBuffer& resp)
+{
+    // Note: Count the bytes of the entry bookkeeping too
+    size_t bytes = key.size() + resp.Length() + sizeof(Entry) + 64;
+    if(bytes > mShardBytes)
+        return;     // Never fits
+
+    Shard& shard = GetShard(key);
+    std::unique_lock<std::mutex> lock(shard.mtx);
+
+    if(auto itr = shard.map.find(key); itr != shard.map.end())
+        Erase(shard, itr->second);
+
+    // Evict the least recently used responses until the new one fits
+    while(!shard.lru.empty() && shard.bytes + bytes > mShardBytes)
+        Erase(shard, std::prev(shard.lru.end()));
+
+    shard.lru.push_front({ key, resp, Clock::now() + mTtl, bytes });
+    shard.map.emplace(shard.lru.front().key, shard.lru.begin());
+    shard.bytes += bytes;
+    mBytes += bytes;
+}
+
+inline void ResponseCache::Clear()
+{
+    for(std::unique_ptr<Shard>& shard : mShards)
+    {
+        std::unique_lock<std::mutex> lock(shard->mtx);
+        mBytes -= shard->bytes;
+        shard->map.clear();
+        shard->lru.clear();
+        shard->bytes = 0;
+    }
+}
+
+inline void ResponseCache::Erase(Shard& shard, std::list<Entry>::iterator itr)
+{
+    shard.bytes -= itr->bytes;
+    mBytes -= itr->bytes;
+    shard.map.erase(itr->key);
+    shard.lru.erase(itr);
+}
+
+} //namespace gen
+
+#endif // __RESPONSE_CACHE_HPP__
+// *INDENT-ON*
@@ -0,0 +1,118 @@
+// *INDENT-OFF*
+//
+// retryPolicy.hpp
+//
+#ifndef __RETRY_POLICY_HPP__
+#define __RETRY_POLICY_HPP__
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-parameter"
+#include <grpcpp/grpcpp.h>
+#pragma GCC diagnostic pop
+
+#include "callBudget.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <random>
+#include <vector>
+
+namespace gen {
+
+struct RetryOptions
+{
+    // Max number of attempts of a call (the first one included)
+    unsigned maxAttempts{3};
+
+    // Backoff before a retry: a random delay (full jitter) of up to initialBackoff
+    // before the first retry, multiplied by multiplier for every other retry,
+    // up to maxBackoff
+    std::chrono::milliseconds initialBackoff{10};
+    std::chrono::milliseconds maxBackoff{200};
+    double multiplier{2.0};
+
+    // Budget: At most that many retries per call on average (e.g. 0.1 is 10%),
+    // with bursts of up to maxBurst retries (see CallBudget)
+    double budget{0.1};
+    unsigned maxBurst{10};
+
+    // Failures that are retried: the transient ones, that tell that the
+    // call hasn't been processed (or that processing it again is harmless)
+    std::vector<grpc::StatusCode> retryableCodes{ grpc::UNAVAILABLE };
+};
+
+//
+// Retry policy of idempotent RPCs (see GrpcRouter::Forward()): A call that fails
+// with a retryable status is retried after a jittered exponential backoff, as long
+// as it has attempts left and the budget allows it. The budget caps the retries to
+// a share of the calls, so a target that is down doesn't get the load multiplied.
+// Note: Only retry idempotent RPCs. A policy can be shared by the RPCs of a target,
+// so they share the budget.
+//
+class RetryPolicy
+{
+public:
+    RetryPolicy() = default;
+    explicit RetryPolicy(const RetryOptions& options) : mOptions(options) {}
+    ~RetryPolicy() = default;
+
+    // A call is starting
+    void OnCall()
+    {
+        mCalls++;
+        mBudget.OnCall();
+    }
+
+    // May the call be retried once its attempt has failed with that status code?
+    // (Takes a retry out of the budget)
+    bool TryRetry(grpc::StatusCode code, unsigned attempts);
+
+    // Get the backoff before the retry that follows that many attempts
+    std::chrono::microseconds GetBackoff(unsigned attempts) const;
+
+    uint64_t GetCalls() const { return mCalls; }
+    uint64_t GetRetries() const { return mRetries; }
+
+private:
+    RetryPolicy(const RetryPolicy&) = delete;
+    RetryPolicy& operator=(const RetryPolicy&) = delete;
+
+    RetryOptions mOptions;
+    CallBudget mBudget{mOptions.budget, mOptions.maxBurst};
+
+    std::atomic<uint64_t> mCalls{0};
+    std::atomic<uint64_t> mRetries{0};
+};
+
+//
+// RetryPolicy class implementation
+//
+inline bool RetryPolicy::TryRetry(grpc::StatusCode code, unsigned attempts)
+{
+    if(attempts >= mOptions.maxAttempts ||
+       std::find(mOptions.retryableCodes.begin(), mOptions.retryableCodes.end(), code) == mOptions.retryableCodes.end())
+        return false;
+
+    if(!mBudget.TryTake())
+        return false;
+
+    mRetries++;
+    return true;
+}
+
+inline std::chrono::microseconds RetryPolicy::GetBackoff(unsigned attempts) const
+{
+    double maxBackoffUs = std::chrono::duration<double, std::micro>(mOptions.maxBackoff).count();
+    double backoffUs = std::chrono::duration<double, std::micro>(mOptions.initialBackoff).count() *
+                       std::pow(mOptions.multiplier, attempts > 0 ? attempts - 1 : 0);
+    backoffUs = std::min(backoffUs, maxBackoffUs);
+
+    thread_local std::minstd_rand random(std::random_device{}());
+    return std::chrono::microseconds((int64_t)(backoffUs * std::uniform_real_distribution<double>(0, 1)(random)));
+}
+
+} //namespace gen
+
+#endif // __RETRY_POLICY_HPP__
+// *INDENT-ON*
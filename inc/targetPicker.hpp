@@ -0,0 +1,410 @@
+// *INDENT-OFF*
+//
+// targetPicker.hpp
+//
+#ifndef __TARGET_PICKER_HPP__
+#define __TARGET_PICKER_HPP__
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-parameter"
+#include <grpcpp/grpcpp.h>
+#pragma GCC diagnostic pop
+
+#include "circuitBreaker.hpp"   // CircuitBreaker::IsFailure()
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace gen {
+
+//
+// Picker of the target (backend) a call is forwarded to, when a GrpcRouter
+// forwards calls to more than one target (see GrpcRouter::AddTarget()).
+// Note: Pick() is called concurrently by the server threads.
+//
+struct TargetPicker
+{
+    virtual ~TargetPicker() = default;
+
+    // The targets have changed (called before any call is forwarded to them)
+    virtual void SetTargets(const std::vector<std::string>& /*addressUris*/) {}
+
+    // Return the index of the target to forward the call to
+    virtual size_t Pick(const ::grpc::ServerContextBase& ctx, size_t targetCount) = 0;
+
+    // A call has been forwarded to the target / The call has ended, for the pickers
+    // that track the load and the health of the targets.
+    // Note: The latency is the time to the response of a unary call, and zero for streams.
+    virtual void OnCallStart(size_t /*target*/) {}
+    virtual void OnCallEnd(size_t /*target*/, ::grpc::StatusCode /*code*/,
+                           std::chrono::microseconds /*latency*/) {}
+
+    // Prober of the targets (see GrpcRouter::SetProbe()): it sends a probe call to the
+    // target, and reports its outcome with OnProbeDone() from a client queue thread.
+    using Prober = std::function<void(size_t target)>;
+    virtual void SetProber(const Prober& /*prober*/) {}
+    virtual void OnProbeDone(size_t /*target*/, bool /*ok*/) {}
+};
+
+//
+// Spread the calls evenly among the targets
+//
+class RoundRobinPicker : public TargetPicker
+{
+public:
+    virtual size_t Pick(const ::grpc::ServerContextBase& /*ctx*/, size_t targetCount) override
+    {
+        return mNext++ % targetCount;
+    }
+
+private:
+    std::atomic<size_t> mNext{0};
+};
+
+//
+// Base class of the pickers that forward the calls with the same value of a metadata
+// key (e.g. "sessionid") to the same target, so the per-key state kept by the targets
+// (e.g. a session cache) stays hot. The calls without the key are spread round-robin.
+//
+class MetadataHashPicker : public TargetPicker
+{
+public:
+    explicit MetadataHashPicker(const std::string& metadataKey) : mMetadataKey(metadataKey) {}
+
+    virtual size_t Pick(const ::grpc::ServerContextBase& ctx, size_t targetCount) override
+    {
+        const std::multimap<::grpc::string_ref, ::grpc::string_ref>& metadata = ctx.client_metadata();
+        auto itr = metadata.find(mMetadataKey);
+        if(itr == metadata.end())
+            return mFallback.Pick(ctx, targetCount);
+        return PickHash(Hash({ itr->second.data(), itr->second.size() }), targetCount);
+    }
+
+    // 64-bit FNV-1a hash, mixed (splitmix64 finalizer) to spread the similar keys
+    // Note: Unlike std::hash, it's the same for every build and every process.
+    static uint64_t Hash(std::string_view key)
+    {
+        uint64_t hash = 14695981039346656037ULL;
+        for(char c : key)
+            hash = (hash ^ (unsigned char)c) * 1099511628211ULL;
+
+        hash = (hash ^ (hash >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        hash = (hash ^ (hash >> 27)) * 0x94d049bb133111ebULL;
+        return hash ^ (hash >> 31);
+    }
+
+protected:
+    // For derived class to implement: Map the hash of the key to a target
+    virtual size_t PickHash(uint64_t hash, size_t targetCount) = 0;
+
+private:
+    std::string mMetadataKey;
+    RoundRobinPicker mFallback;
+};
+
+//
+// Consistent hashing on a ring: Every target owns the arcs of the ring that end at
+// its points (replicas), and a key goes to the owner of the arc its hash falls in.
+// Adding or removing a target only moves the keys of its arcs.
+//
+class RingHashPicker : public MetadataHashPicker
+{
+public:
+    RingHashPicker(const std::string& metadataKey, unsigned replicas = 100)
+        : MetadataHashPicker(metadataKey), mReplicas(std::max(replicas, 1u)) {}
+
+    virtual void SetTargets(const std::vector<std::string>& addressUris) override
+    {
+        // Note: The points of a target depend on its address, not on its index
+        mRing.clear();
+        for(size_t i = 0; i < addressUris.size(); i++)
+        {
+            for(unsigned replica = 0; replica < mReplicas; replica++)
+                mRing.emplace_back(Hash(addressUris[i] + "#" + std::to_string(replica)), i);
+        }
+        std::sort(mRing.begin(), mRing.end());
+    }
+
+protected:
+    virtual size_t PickHash(uint64_t hash, size_t targetCount) override
+    {
+        if(mRing.empty())
+            return hash % targetCount;
+
+        auto itr = std::lower_bound(mRing.begin(), mRing.end(), std::make_pair(hash, size_t(0)));
+        return (itr != mRing.end() ? itr->second : mRing.front().second);
+    }
+
+private:
+    unsigned mReplicas;
+    std::vector<std::pair<uint64_t, size_t>> mRing;  // Points of the targets, sorted by hash
+};
+
+//
+// Jump consistent hashing (Lamping & Veach): No memory and an even spread, but the
+// targets are only told apart by their index, so only adding or removing the last
+// target keeps the other keys in place.
+//
+class JumpHashPicker : public MetadataHashPicker
+{
+public:
+    explicit JumpHashPicker(const std::string& metadataKey) : MetadataHashPicker(metadataKey) {}
+
+protected:
+    virtual size_t PickHash(uint64_t hash, size_t targetCount) override
+    {
+        int64_t target = -1;
+        int64_t next = 0;
+        while(next < (int64_t)targetCount)
+        {
+            target = next;
+            hash = hash * 2862933555777941757ULL + 1;
+            next = (int64_t)((target + 1) * (double(1LL << 31) / double((hash >> 33) + 1)));
+        }
+        return (size_t)target;
+    }
+};
+
+struct PowerOfTwoOptions
+{
+    // Weight of the last call in the latency and error rate moving averages (EWMA)
+    double ewmaWeight{0.1};
+
+    // Eject a target once its error rate is above maxErrorRate, or once its latency
+    // is more than maxLatencyFactor times the average latency of the other targets.
+    // A target is only judged once it has served minCalls calls since it was admitted.
+    double maxErrorRate{0.5};
+    double maxLatencyFactor{3.0};
+    unsigned minCalls{20};
+
+    // A latency below that is never too slow (it's noise more than anything else)
+    std::chrono::microseconds minOutlierLatency{10000};
+
+    // Never eject more than that share of the targets
+    double maxEjectedShare{0.5};
+
+    // How long an ejected target is kept out, before it's probed (see GrpcRouter::SetProbe())
+    // and readmitted once the probe succeeds. If there is no prober, the target is
+    // readmitted right away.
+    std::chrono::milliseconds ejectTime{10000};
+};
+
+//
+// Power of two choices: Pick two targets at random and forward the call to the
+// one with fewer outstanding calls, which keeps the calls off a slow target
+// without the herding of "least loaded". The latency and the error rate of every
+// target are tracked, and the outliers (targets much slower or failing more than
+// the rest) are ejected for a while, and probed before they are readmitted.
+//
+class PowerOfTwoPicker : public TargetPicker
+{
+public:
+    PowerOfTwoPicker() = default;
+    explicit PowerOfTwoPicker(const PowerOfTwoOptions& options) : mOptions(options) {}
+
+    virtual void SetTargets(const std::vector<std::string>& addressUris) override;
+    virtual size_t Pick(const ::grpc::ServerContextBase& ctx, size_t targetCount) override;
+    virtual void OnCallStart(size_t target) override;
+    virtual void OnCallEnd(size_t target, ::grpc::StatusCode code, std::chrono::microseconds latency) override;
+    virtual void SetProber(const Prober& prober) override { mProber = prober; }
+    virtual void OnProbeDone(size_t target, bool ok) override;
+
+    bool IsEjected(size_t target) const { return mTargets[target]->state != ADMITTED; }
+    size_t GetEjectedCount() const { return mEjectedCount; }
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    enum : char { ADMITTED, EJECTED, PROBING };
+
+    struct Target
+    {
+        std::atomic<int> outstanding{0};    // Calls in flight
+        std::atomic<double> latency{0};     // Latency EWMA (microseconds)
+        std::atomic<char> state{ADMITTED};
+
+        std::mutex mtx;                     // Guards the rest, and the updates of the EWMAs
+        double errorRate{0};                // Error rate EWMA
+        unsigned calls{0};                  // Calls since the target was admitted
+        Clock::time_point ejectedUntil;
+    };
+
+    // Helpers
+    size_t PickAdmitted(size_t targetCount, size_t skip);
+    bool IsOutlier(size_t target, Target& t) const;
+    void ReadmitEjected();
+    void Readmit(Target& t);
+
+    PowerOfTwoOptions mOptions;
+    std::vector<std::unique_ptr<Target>> mTargets;
+    std::atomic<size_t> mEjectedCount{0};
+    Prober mProber;
+};
+
+//
+// PowerOfTwoPicker class implementation
+//
+inline void PowerOfTwoPicker::SetTargets(const std::vector<std::string>& addressUris)
+{
+    mTargets.clear();
+    for(size_t i = 0; i < addressUris.size(); i++)
+        mTargets.emplace_back(new Target);
+    mEjectedCount = 0;
+}
+
+inline size_t PowerOfTwoPicker::Pick(const ::grpc::ServerContextBase& /*ctx*/, size_t targetCount)
+{
+    if(mEjectedCount > 0)
+        ReadmitEjected();
+
+    size_t first = PickAdmitted(targetCount, targetCount);
+    if(targetCount < 2)
+        return first;
+
+    // Note: The first target is picked at random, so it breaks the ties
+    size_t second = PickAdmitted(targetCount, first);
+    if(mTargets[second]->state != ADMITTED && mTargets[first]->state == ADMITTED)
+        return first;   // Every other target is ejected
+    return (mTargets[second]->outstanding < mTargets[first]->outstanding ? second : first);
+}
+
+// Pick an admitted target (other than skip) at random.
+// Note: If all the other targets are ejected, then any of them will do.
+inline size_t PowerOfTwoPicker::PickAdmitted(size_t targetCount, size_t skip)
+{
+    thread_local std::minstd_rand random(std::random_device{}());
+    size_t count = (skip < targetCount ? targetCount - 1 : targetCount);
+    size_t start = random() % count;
+    for(size_t i = 0; i < count; i++)
+    {
+        size_t target = (start + i) % count;
+        if(target >= skip)
+            target++;
+        if(mTargets[target]->state == ADMITTED)
+            return target;
+    }
+    return (start >= skip ? start + 1 : start);
+}
+
+inline void PowerOfTwoPicker::OnCallStart(size_t target)
+{
+    mTargets[target]->outstanding++;
+}
+
+inline void PowerOfTwoPicker::OnCallEnd(size_t target, ::grpc::StatusCode code, std::chrono::microseconds latency)
+{
+    Target& t = *mTargets[target];
+    t.outstanding--;
+    if(code == ::grpc::CANCELLED)
+        return;
+
+    std::unique_lock<std::mutex> lock(t.mtx);
+    bool failed = CircuitBreaker::IsFailure(code);
+    t.errorRate += mOptions.ewmaWeight * ((failed ? 1.0 : 0.0) - t.errorRate);
+    if(!failed && latency.count() > 0)
+    {
+        double sample = (double)latency.count();
+        t.latency = (t.latency == 0 ? sample : t.latency + mOptions.ewmaWeight * (sample - t.latency));
+    }
+
+    if(t.state != ADMITTED || ++t.calls < mOptions.minCalls || !IsOutlier(target, t))
+        return;
+
+    // Eject the target (unless too many targets are already ejected)
+    size_t ejectedCount = mEjectedCount;
+    do
+    {
+        if(ejectedCount + 1 > mOptions.maxEjectedShare * mTargets.size())
+            return;
+    } while(!mEjectedCount.compare_exchange_weak(ejectedCount, ejectedCount + 1));
+
+    t.state = EJECTED;
+    t.ejectedUntil = Clock::now() + mOptions.ejectTime;
+}
+
+// Is the target failing, or much slower than the other targets?
+// Note: Called with the target mutex locked
+inline bool PowerOfTwoPicker::IsOutlier(size_t target, Target& t) const
+{
+    if(t.errorRate > mOptions.maxErrorRate)
+        return true;
+
+    double latencySum = 0;
+    size_t count = 0;
+    for(size_t i = 0; i < mTargets.size(); i++)
+    {
+        if(double latency = mTargets[i]->latency; i != target && latency > 0 && mTargets[i]->state == ADMITTED)
+        {
+            latencySum += latency;
+            count++;
+        }
+    }
+    return (count > 0 && t.latency > mOptions.minOutlierLatency.count() &&
+            t.latency > mOptions.maxLatencyFactor * latencySum / count);
+}
+
+// Probe (or readmit) the targets that have been ejected long enough
+inline void PowerOfTwoPicker::ReadmitEjected()
+{
+    Clock::time_point now = Clock::now();
+    for(size_t target = 0; target < mTargets.size(); target++)
+    {
+        Target& t = *mTargets[target];
+        if(t.state != EJECTED)
+            continue;
+
+        {
+            std::unique_lock<std::mutex> lock(t.mtx);
+            if(t.state != EJECTED || now < t.ejectedUntil)
+                continue;
+
+            if(!mProber)
+            {
+                Readmit(t);
+                continue;
+            }
+            t.state = PROBING;
+        }
+
+        // Note: The probe can complete on another thread before it returns
+        mProber(target);
+    }
+}
+
+inline void PowerOfTwoPicker::OnProbeDone(size_t target, bool ok)
+{
+    Target& t = *mTargets[target];
+    std::unique_lock<std::mutex> lock(t.mtx);
+    if(ok)
+    {
+        Readmit(t);
+    }
+    else
+    {
+        t.state = EJECTED;
+        t.ejectedUntil = Clock::now() + mOptions.ejectTime;
+    }
+}
+
+// Note: Called with the target mutex locked
+inline void PowerOfTwoPicker::Readmit(Target& t)
+{
+    t.state = ADMITTED;
+    t.errorRate = 0;
+    t.latency = 0;
+    t.calls = 0;
+    mEjectedCount--;
+}
+
+} //namespace gen
+
+#endif // __TARGET_PICKER_HPP__
+// *INDENT-ON*
@@ -0,0 +1,244 @@
+//
+// threadPool.hpp
+//
+#ifndef __THREAD_POOL_HPP__
+#define __THREAD_POOL_HPP__
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <signal.h>     // pthread_sigmask
+
+namespace gen {
+//
+// Bounded work-stealing thread pool.
+// Every worker owns a fixed-size ring of tasks. Submit() spreads tasks among
+// the workers round-robin, and a worker that runs out of its own tasks steals
+// from the others. No memory is allocated once the pool is started.
+//
+class ThreadPool
+{
+public:
+    using Task = std::function<void()>;
+
+    ThreadPool() = default;
+    ~ThreadPool() { Stop(); }
+
+    // Start threadCount workers able to hold up to capacity pending tasks in total
+    bool Start(int threadCount, size_t capacity);
+
+    // Queue a task to run on one of the workers.
+    // Return false if the pool isn't running or all the workers are full.
+    bool Submit(Task&& task);
+
+    // Run all the pending tasks and stop the workers
+    void Stop();
+
+    bool IsRunning() const { return mRunning; }
+    int GetThreadCount() const { return (int)mWorkers.size(); }
+
+private:
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    struct Worker
+    {
+        std::mutex mtx;
+        std::vector<Task> ring;     // Fixed-size ring of pending tasks
+        size_t head{0};             // Index of the oldest task
+        size_t count{0};            // Number of pending tasks
+        std::thread thread;
+
+        bool Push(Task& task);
+        bool PopFront(Task& task);  // Owner takes the oldest task
+        bool PopBack(Task& task);   // Thieves take the newest task
+    };
+
+    void Run(size_t index);
+    bool GetTask(size_t index, Task& task);
+
+    std::vector<std::unique_ptr<Worker>> mWorkers;
+    std::atomic<size_t> mNextWorker{0};     // Round-robin Submit() index
+    std::atomic<size_t> mPending{0};        // Number of tasks in all the rings
+    std::atomic<size_t> mSubmitters{0};     // Submit() calls in progress
+    std::atomic<size_t> mSleepers{0};       // Workers waiting for tasks
+    std::atomic<bool> mRunning{false};      // Tasks can be submitted
+    bool mStopped{false};                   // Workers exit once idle (guarded by mSleepMtx)
+    std::mutex mSleepMtx;
+    std::condition_variable mSleepCv;
+};
+
+//
+// ThreadPool class implementation
+//
+inline bool ThreadPool::Worker::Push(Task& task)
+{
+    std::unique_lock<std::mutex> lock(mtx);
+    if(count == ring.size())
+        return false;   // The ring is full
+
+    ring[(head + count) % ring.size()] = std::move(task);
+    count++;
+    return true;
+}
+
+inline bool ThreadPool::Worker::PopFront(Task& task)
+{
+    std::unique_lock<std::mutex> lock(mtx);
+    if(count == 0)
+        return false;
+
+    task = std::move(ring[head]);
+    head = (head + 1) % ring.size();
+    count--;
+    return true;
+}
+
+inline bool ThreadPool::Worker::PopBack(Task& task)
+{
+    std::unique_lock<std::mutex> lock(mtx);
+    if(count == 0)
+        return false;
+
+    count--;
+    task = std::move(ring[(head + count) % ring.size()]);
+    return true;
+}
+
+inline bool ThreadPool::Start(int threadCount, size_t capacity)
+{
+    if(mRunning || threadCount <= 0)
+        return false;
+
+    // Split the capacity among the workers (at least one task each)
+    size_t ringSize = std::max<size_t>(capacity / threadCount, 1);
+
+    mStopped = false;
+    mRunning = true;
+    for(int i = 0; i < threadCount; i++)
+    {
+        mWorkers.emplace_back(new Worker);
+        mWorkers.back()->ring.resize(ringSize);
+    }
+
+    for(size_t i = 0; i < mWorkers.size(); i++)
+        mWorkers[i]->thread = std::thread(&ThreadPool::Run, this, i);
+
+    return true;
+}
+
+inline bool ThreadPool::Submit(Task&& task)
+{
+    // Note: Stop() waits for the Submit() calls in progress, so a task
+    // can't be pushed once the workers are told to exit
+    mSubmitters++;
+    if(!mRunning)
+    {
+        mSubmitters--;
+        return false;
+    }
+
+    // Try every worker, starting from the next one in round-robin order
+    bool isPushed = false;
+    size_t start = mNextWorker++;
+    for(size_t i = 0; i < mWorkers.size() && !isPushed; i++)
+        isPushed = mWorkers[(start + i) % mWorkers.size()]->Push(task);
+
+    if(isPushed)
+    {
+        mPending++;
+
+        // Only take the mutex if a worker is (or is about to be) waiting.
+        // Note: A worker counts itself as a sleeper before it checks mPending,
+        // so either it sees the task or we see it.
+        if(mSleepers > 0)
+        {
+            { std::unique_lock<std::mutex> lock(mSleepMtx); }
+            mSleepCv.notify_one();
+        }
+    }
+
+    mSubmitters--;
+    return isPushed;    // False if all the workers are full
+}
+
+inline void ThreadPool::Stop()
+{
+    if(!mRunning)
+        return;
+
+    mRunning = false;
+    while(mSubmitters > 0)
+        std::this_thread::yield();
+
+    {
+        std::unique_lock<std::mutex> lock(mSleepMtx);
+        mStopped = true;
+    }
+    mSleepCv.notify_all();
+
+    // Note: Workers run all the pending tasks before they exit
+    for(std::unique_ptr<Worker>& worker : mWorkers)
+    {
+        if(worker->thread.joinable())
+            worker->thread.join();
+    }
+    mWorkers.clear();
+    mPending = 0;
+}
+
+inline bool ThreadPool::GetTask(size_t index, Task& task)
+{
+    // Take a task from our own ring first, then try to steal one
+    if(mWorkers[index]->PopFront(task))
+        return true;
+
+    for(size_t i = 1; i < mWorkers.size(); i++)
+    {
+        if(mWorkers[(index + i) % mWorkers.size()]->PopBack(task))
+            return true;
+    }
+    return false;
+}
+
+inline void ThreadPool::Run(size_t index)
+{
+    // Don't handle SIGHUP or SIGINT in the spawned threads -
+    // let the main thread handle them.
+    sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, SIGHUP);
+    sigaddset(&set, SIGINT);
+    pthread_sigmask(SIG_BLOCK, &set, nullptr);
+
+    Task task;
+    while(true)
+    {
+        if(GetTask(index, task))
+        {
+            mPending--;
+            task();
+            task = nullptr;
+            continue;
+        }
+
+        // Nothing to do, wait for more tasks to arrive
+        std::unique_lock<std::mutex> lock(mSleepMtx);
+        mSleepers++;
+        if(mPending == 0 && !mStopped)
+            mSleepCv.wait(lock);
+        mSleepers--;
+
+        if(mPending == 0 && mStopped)
+            break;  // Nothing left to do and we are stopping
+    }
+}
+
+} //namespace gen
+
+#endif // __THREAD_POOL_HPP__